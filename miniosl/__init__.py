@@ -9,7 +9,7 @@ from .record import np_array_to_sfen_file, sfen_file_to_np_array, \
     SfenBlockStat, load_ki2, read_ki2
 from .drawing import show_channels, state_to_img, \
     hand_pieces_to_ja, ShogiFig, ShogiAnimation
-from .dataset import load_torch_dataset, GameDataset
+from .dataset import load_torch_dataset, GameDataset, ShardDataset
 from .network import StandardNetwork, PVNetwork
 from .usi_process import UsiProcess
 from .player import UsiPlayer, make_player
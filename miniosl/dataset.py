@@ -9,11 +9,15 @@ import recordclass
 
 
 def load_sfen_from_file(sfen, *,
-                        compress_and_rm: bool = False, strict: bool = False
+                        compress_and_rm: bool = False, strict: bool = False,
+                        trusted: bool = False
                         ) -> list[miniosl.SubRecord]:
     """load game records from file for `GameRecordBlock`
 
     games must be completed to serve as training data.
+
+    :param trusted: skip legality checks for records of trusted origin \
+    (e.g., self-play), see :py:meth:`SubRecord.from_usi_file_trusted`
     """
     sfen_npz = ''
     if sfen.endswith('.npz'):
@@ -21,26 +25,33 @@ def load_sfen_from_file(sfen, *,
     elif os.path.isfile(f'{sfen}.npz'):
         sfen_npz = f'{sfen}.npz'
     if os.path.isfile(sfen_npz):
-        with open(sfen_npz, 'r') as f:
-            record_set = miniosl.RecordSet.from_npz(sfen_npz)
-            return [miniosl.SubRecord(_) for _ in record_set.records]
+        with np.load(sfen_npz) as npz:
+            data = [npz[_] for _ in npz.keys() if npz[_].ndim == 1]
+        # repetitions are not detected here, see bitpack::read_binary_record
+        records = miniosl.unpack_sub_records(data[0])
+        if strict and any(_.result == miniosl.InGame for _ in records):
+            raise ValueError('in game')
+        return [_ for _ in records if _.result != miniosl.InGame]
+    if trusted and not compress_and_rm:
+        records = miniosl.SubRecord.from_usi_file_trusted(
+            f'{sfen}', settle_repetition=True)
+        if strict and any(_.result == miniosl.InGame for _ in records):
+            raise ValueError('in game')
+        return [_ for _ in records if _.result != miniosl.InGame]
     data = miniosl.MiniRecordVector()
     ignored = 0
-    with open(f'{sfen}', 'r') as f:
-        for line in f:
-            line = line.strip()
-            record = miniosl.usi_record(line)
-            if record.result == miniosl.InGame:
-                if strict:
-                    logging.warning(f'in game {line}')
-                    raise ValueError('in game')
-                ignored += 1
-                continue
-            data.append(record)
-        if compress_and_rm:
-            record_set = miniosl.RecordSet(data)
-            record_set.save_npz(f'{sfen}.npz')
-            os.remove(f'{sfen}')
+    for record in miniosl.RecordSet.from_usi_file_parallel(f'{sfen}').records:
+        if record.result == miniosl.InGame:
+            if strict:
+                logging.warning(f'in game {record.to_usi()}')
+                raise ValueError('in game')
+            ignored += 1
+            continue
+        data.append(record)
+    if compress_and_rm:
+        record_set = miniosl.RecordSet(data)
+        record_set.save_npz(f'{sfen}.npz')
+        os.remove(f'{sfen}')
     return [miniosl.SubRecord(_) for _ in data]
 
 
@@ -55,19 +66,29 @@ class GameDataset(torch.utils.data.Dataset):
     :param block_unit: number of game records for a block, \
     that is a unit in add/replace oporation
     :param batch_with_collate: need to specify `collate_fn=lambda indices: dataset.collate(indices)` for trainloader, if (and only if) True
+    :param sampling_seed: make positions sampled in `collate` a function of the seed and indices
+    :param compact: keep blocks as `CompactRecordBlock` to save memory, \
+    requires `batch_with_collate`
     """
     def __init__(self, window_size: int, block_unit: int,
                  batch_with_collate: bool = True,
-                 opening_decay_power=None):
+                 opening_decay_power=None,
+                 sampling_seed: int | None = None,
+                 compact: bool = False):
         self.window_size = window_size
         self.block_unit = block_unit
-        self.blocks = miniosl.GameBlockVector()
+        if compact and not batch_with_collate:
+            raise ValueError('compact blocks need batch_with_collate')
+        self.compact = compact
+        self.blocks = miniosl.CompactBlockVector() if compact \
+            else miniosl.GameBlockVector()
         self.cur_block_id = 0
         self.block_limit = (window_size + block_unit - 1) // block_unit
         self.batch_with_collate = batch_with_collate
 
         self.blocks.reserve(self.block_limit)
         self.opening_decay_power = opening_decay_power
+        self.sampling_seed = sampling_seed
 
     def block_id(self) -> int:
         """number of block added so far"""
@@ -92,6 +113,8 @@ class GameDataset(torch.utils.data.Dataset):
         """add or replace the oldest one with `new_block`"""
         if len(new_block) < self.unit_size():
             raise ValueError(f'size error {len(new_block)} {self.block_unit}')
+        if self.compact and not isinstance(new_block, miniosl.CompactRecordBlock):
+            new_block = miniosl.CompactRecordBlock(new_block)
 
         if len(self.blocks) < self.block_limit:
             self.blocks.append(new_block)
@@ -141,6 +164,7 @@ class GameDataset(torch.utils.data.Dataset):
                                  legalmove_labels,
                                  # sampled_ids
                                  decay_power=self.opening_decay_power,
+                                 seed=self.sampling_seed,
                                  )
         # for offset, (p, s) in enumerate(indices):
         #     self.blocks[p][s].sample_feature_labels_to(
@@ -155,6 +179,68 @@ class GameDataset(torch.utils.data.Dataset):
                 )
 
 
+class PrefetchLoader:
+    """iterate batches of :py:class:`BatchPrefetcher` as tensors \
+    in the same layout as `GameDataset.collate`
+
+    buffers are shared with the prefetcher and reused after the tensors are released
+    """
+    def __init__(self, prefetcher: miniosl.BatchPrefetcher, steps: int):
+        self.prefetcher = prefetcher
+        self.steps = steps
+
+    def __len__(self):
+        return self.steps
+
+    def __iter__(self):
+        self.prefetcher.start()
+        for _ in range(self.steps):
+            inputs, policy, value, aux, inputs2, legalmoves \
+                = self.prefetcher.pop()
+            yield (torch.from_numpy(inputs),
+                   torch.from_numpy(policy),
+                   torch.from_numpy(value),
+                   torch.from_numpy(aux),
+                   torch.from_numpy(inputs2),
+                   torch.from_numpy(legalmoves),
+                   )
+
+
+class ShardDataset(torch.utils.data.Dataset):
+    """positions in a :py:class:`PositionShardFile` to be used with `batch_sampler`
+
+    `collate` gives tensors in the same layout as `GameDataset.collate`
+    """
+    def __init__(self, path: str):
+        self.shard = miniosl.PositionShardFile(path)
+
+    def __len__(self):
+        return len(self.shard)
+
+    def __getitem__(self, idx):
+        return idx
+
+    def collate(self, indices):
+        N = len(indices)
+        inputs = np.zeros(N*miniosl.input_unit, dtype=np.int8)
+        inputs2 = np.zeros(N*miniosl.input_unit, dtype=np.int8)
+        policy_labels = np.zeros(N, dtype=np.int32)
+        value_labels = np.zeros(N, dtype=np.float32)
+        aux_labels = np.zeros(N*miniosl.aux_unit, dtype=np.int8)
+        legalmove_labels = np.zeros(N * miniosl.legalmove_bs_sz,
+                                    dtype=np.uint8)
+        self.shard.collate(np.asarray(indices, dtype=np.int64),
+                           inputs, policy_labels, value_labels, aux_labels,
+                           inputs2, legalmove_labels)
+        return (torch.from_numpy(inputs.reshape(N, -1, 9, 9)),
+                torch.from_numpy(policy_labels),
+                torch.from_numpy(value_labels),
+                torch.from_numpy(aux_labels.reshape(N, -1)),
+                torch.from_numpy(inputs2.reshape(N, -1, 9, 9)),
+                torch.from_numpy(legalmove_labels.reshape(N, -1)),
+                )
+
+
 def load_torch_dataset(path: str | list[str]) -> torch.utils.data.Dataset:
     """load dataset from file"""
     if isinstance(path, list) or path.endswith('.sfen') \
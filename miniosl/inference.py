@@ -195,6 +195,26 @@ class TorchInfer(InferenceModel):
         return [_.to('cpu').numpy() for _ in outputs]
 
 
+class NativeInfer(InferenceModel):
+    """CPU inference in C++ (:py:class:`CPUInferenceModel`)
+    for weights exported by :py:func:`export_native`
+    """
+    def __init__(self, path: str):
+        super().__init__('cpu')
+        self.native = miniosl.CPUInferenceModel(path)
+
+    def infer(self, inputs: torch.Tensor):
+        inputs = (inputs.to('cpu') * miniosl.One).round().to(torch.int8)
+        return self.infer_int8(inputs)
+
+    def infer_int8(self, inputs: np.ndarray | torch.Tensor):
+        if isinstance(inputs, torch.Tensor):
+            inputs = inputs.to('cpu').numpy()
+        policy, value = self.native.infer(inputs)
+        aux = np.zeros((len(value), 0), dtype=np.float32)
+        return policy, value, aux
+
+
 def load(path: str, device: str = "", torch_cfg: dict = {},
          *,
          compiled: bool = False,
@@ -217,6 +237,8 @@ def load(path: str, device: str = "", torch_cfg: dict = {},
         return TorchTRTInfer(path, device)
     if path.endswith('.pts'):  # need to used a different extention from TRT's
         return TorchScriptInfer(path, device)
+    if path.endswith('.mnn'):
+        return NativeInfer(path)
     if path.endswith('.pt'):
         NN = miniosl.network.PVNetwork if remove_aux_head \
             else miniosl.network.StandardNetwork
@@ -256,14 +278,26 @@ def load(path: str, device: str = "", torch_cfg: dict = {},
 
 
 class InferenceForGameArray(miniosl.InferenceModelStub):
-    def __init__(self, module: InferenceModel):
-        super().__init__()
+    """adaptor of :py:class:`InferenceModel` for :py:class:`GameArray`
+
+    :param inplace: read features from and write results to the buffers
+        of GameArray directly, without intermediate copies in C++
+    """
+    def __init__(self, module: InferenceModel, inplace: bool = True):
+        super().__init__(inplace)
         self.module = module
 
     def py_infer(self, features):
         features = features.reshape(-1, len(miniosl.channel_id), 9, 9)
         return self.module.infer_int8(features)
 
+    def py_infer_inplace(self, features, policy, value):
+        """features, policy and value are views valid only in this call"""
+        policy_out, value_out, _ = self.py_infer(features)
+        if len(policy) > 0:
+            policy[:] = np.asarray(policy_out).reshape(policy.shape)
+        value[:] = np.asarray(value_out).reshape(value.shape)
+
 
 def export_onnx(model, *, device, filename, remove_aux_head=False):
     import onnx                 # to detect import error eaelier
@@ -342,6 +376,30 @@ def export_torch_script(model, *, device, filename):
     torch.jit.save(ts_module, filename)
 
 
+def export_native(model, *, filename):
+    """save float weights in `state_dict` for :py:class:`CPUInferenceModel`
+
+    format: magic, #tensors, and (name, ndim, shape, float32 data)
+    for each tensor, all integers are uint32 in little endian.
+    """
+    import struct
+    state = {key.removeprefix('_orig_mod.'): value
+             for key, value in model.state_dict().items()
+             if value.is_floating_point()}
+    if not filename.endswith('.mnn'):
+        filename = f'{filename}.mnn'
+    with open(filename, 'wb') as file:
+        file.write(b'MOSLNN01')
+        file.write(struct.pack('<I', len(state)))
+        for key, value in state.items():
+            name = key.encode()
+            data = value.detach().to('cpu', torch.float32).contiguous().numpy()
+            file.write(struct.pack('<I', len(name)))
+            file.write(name)
+            file.write(struct.pack(f'<I{data.ndim}I', data.ndim, *data.shape))
+            file.write(data.astype('<f4').tobytes())
+
+
 def export_model(model: miniosl.PVNetwork, *, device, filename, quiet=False,
                  remove_aux_head=False):
     if filename.endswith('.onnx'):
@@ -353,5 +411,7 @@ def export_model(model: miniosl.PVNetwork, *, device, filename, quiet=False,
         export_torch_script(model, device=device, filename=filename)
     elif filename.endswith('.ptd'):
         model.save_with_dict(filename)
+    elif filename.endswith('.mnn'):
+        export_native(model, filename=filename)
     else:
         raise ValueError("unknown filetype")
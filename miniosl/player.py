@@ -52,6 +52,13 @@ def make_usi_player(cfg_path: str) -> UsiPlayer:
     path_and_args = cfg['path_and_args']
     setoptions = cfg['setoptions']
     cwd = cfg['cwd'] if 'cwd' in cfg else None
+    if 'parallel' in cfg:
+        # native engines thinking concurrently, one process for each
+        go = cfg['go'] if 'go' in cfg else 'byoyomi 1000'
+        pool = [miniosl.UsiEnginePlayer(path_and_args, setoptions,
+                                        go, cwd or '')
+                for _ in range(int(cfg['parallel']))]
+        return miniosl.CPUPlayer(pool, False)
     engine = miniosl.UsiProcess(path_and_args, setoptions, cwd)
     if not hasattr(make_usi_player, 'players'):
         make_usi_player.players = []
@@ -77,6 +84,8 @@ def make_player(
     td_pattern = r'^gumbeltd([1-9][0-9]*)$'
     ave_pattern = r'^gumbelave([1-9][0-9]*)$'
     max_pattern = r'^gumbelmax([1-9][0-9]*)$'
+    sh_pattern = r'^gumbelsh([1-9][0-9]*)-([1-9][0-9]*)$'
+    alphabeta_pattern = r'^alphabeta([1-9][0-9]*)?$'
     config = miniosl.GumbelPlayerConfig()
     config.noise_scale = noise_scale
     config.depth_weight = depth_weight
@@ -91,6 +100,10 @@ def make_player(
                 f'width mismatch {config.root_width} < {config.second_width}'
             )
         return miniosl.FlatGumbelPlayer(config)
+    elif match := re.match(sh_pattern, name):
+        config.root_width = int(match.group(1))
+        config.n_simulations = int(match.group(2))
+        return miniosl.SequentialHalvingPlayer(config)
     elif match := re.match(gumbel_pattern, name):
         config.root_width = int(match.group(1))
         return miniosl.FlatGumbelPlayer(config)
@@ -126,6 +139,9 @@ def make_player(
         for :py:class:`RandomPlayer`, otherwise results in dangling pointer.
         """
         return miniosl.CPUPlayer(miniosl.RandomPlayer(), False)
+    elif match := re.match(alphabeta_pattern, name):
+        depth = int(match.group(1) or 3)
+        return miniosl.CPUPlayer(miniosl.AlphaBetaPlayer(depth), False)
     elif name == "myrandom":
         """save before return to keep its lifetime
         """
@@ -94,6 +94,20 @@ def prune(load, threshold, output):
     book.prune(threshold, output)
 
 
+@main.command()
+@click.argument('books', nargs=-1, type=click.Path(exists=True))
+@click.option('--threshold', type=int, default=1, show_default=True)
+@click.option('--output', default='book.bin', show_default=True)
+@click.option('--work-dir', default='',
+              help="directory for sorted runs [default: OUTPUT.runs]")
+def merge(books, threshold, output, work_dir):
+    """merge BOOKS summing visit counts, without loading them into memory"""
+    n = miniosl.OpeningTree.merge_binary(list(books), output,
+                                         threshold=threshold,
+                                         work_dir=work_dir)
+    logger.info(f'wrote {n} nodes to {output}')
+
+
 @main.command()
 @click.argument('load', type=click.Path(exists=True))
 @click.option('--path', help="csa moves concatinated w/o delimiter")
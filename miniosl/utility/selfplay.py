@@ -57,7 +57,8 @@ def selfplay_array(
         player_a: list[miniosl.PlayerArray],
         player_b: list[miniosl.PlayerArray],
         output: str,
-        csv_writer   # difficult to annotate
+        csv_writer,  # difficult to annotate
+        binary_output: str = '',
 ):
     logging.info(f'{shorten(player_a[0].name())}'
                  + f' v.s. {shorten(player_b[0].name())},'
@@ -75,6 +76,12 @@ def selfplay_array(
                     player_a, player_b,
                     nn_for_array, nn_for_array_b
             )]
+    writer = None
+    if binary_output:
+        # stream records to disk instead of keeping them in memory
+        writer = miniosl.BitpackRecordWriter(binary_output)
+        for m in mgrs:
+            m.set_record_sink(writer)
     # mgrs = [miniosl.GameArray(cfg.parallel, player_a[0], player_b[0],
     #                           nn_for_array[0], nn_for_array_b[0],
     #                           game_config)]
@@ -90,14 +97,14 @@ def selfplay_array(
     prevs = np.zeros(len(mgrs), dtype=int)
 
     def total_completed(mgrs):
-        return sum([len(_.completed()) for _ in mgrs])
+        return sum([_.n_completed() for _ in mgrs])
 
     def task(id, pbar):
         while total_completed(mgrs) < cfg.n_games:
             mgrs[id].step()
             steps[id] += 1
             remains = cfg.n_games - prevs.sum()
-            done = len(mgrs[id].completed())
+            done = mgrs[id].n_completed()
             inc = done - prevs[id]
             pbar.update(min(remains, inc))
             prevs[id] = done
@@ -119,7 +126,25 @@ def selfplay_array(
     N = steps.sum() * cfg.parallel
     logging.info(f'{N} moves in {elapsed/10**3:.2f}s, {elapsed/N:.2f}ms/move, '
                  + f'{elapsed/steps.sum():.2f}ms/steps')
-    counts = save_sfen(sum([list(_.completed()) for _ in mgrs], []), output)
+    stats = mgrs[0].stats()
+    if stats['enabled']:
+        a = stats['player'][0]
+        logging.debug(f"{stats['positions_per_second']:.1f} positions/s"
+                      f" {stats['games_per_second']:.2f} games/s"
+                      f" occupancy {stats['occupancy']:.2f},"
+                      f" request {a['request_seconds']:.2f}s"
+                      f" infer {a['infer_seconds']:.2f}s"
+                      f" result {a['result_seconds']:.2f}s"
+                      f" make_move {stats['make_move_seconds']:.2f}s"
+                      " in the first GameArray (player a)")
+    if writer:
+        writer.flush()
+        counts = np.array(writer.result_count(), dtype=np.int64)
+        logging.info(f'{writer.n_written()} records in {len(writer.files())}'
+                     f' files {binary_output}-*.bin')
+    else:
+        counts = save_sfen(sum([list(_.completed()) for _ in mgrs], []),
+                           output)
     now = datetime.datetime.now().isoformat(timespec='seconds')
     bwin, bloss = counts[int(miniosl.BlackWin)], counts[int(miniosl.WhiteWin)]
     draw = counts[int(miniosl.Draw)]
@@ -134,7 +159,7 @@ def selfplay_array(
                              round(bwin_probability, 3),
                              round(elodiff, 1)
                              ])
-    games = [len(_.completed()) for _ in mgrs]
+    games = [_.n_completed() for _ in mgrs]
     if max(games) - min(games) > cfg.n_games // 2:
         logging.warning(f'games {games}')
     return bwin, draw, bloss
@@ -146,11 +171,11 @@ def main():
         formatter_class=argparse.ArgumentDefaultsHelpFormatter)
     parser.add_argument(
         "--player-a",
-        help="first player (policy|greedy-policy|gumbel4|random)",
+        help="first player (policy|greedy-policy|gumbel4|random|alphabeta3)",
         default="policy")
     parser.add_argument(
         "--player-b",
-        help="first player (policy|greedy-policy|gumbel4|random)",
+        help="first player (policy|greedy-policy|gumbel4|random|alphabeta3)",
         default="policy")
     parser.add_argument(
         "--model", help="model filename",
@@ -176,6 +201,9 @@ def main():
     parser.add_argument("--verbose", action='store_true')
     parser.add_argument("--output", help="filename for game records",
                         default="selfplay-sfen.txt")
+    parser.add_argument("--binary-output",
+                        help="prefix of bitpack files, written in background"
+                        " instead of --output")
     parser.add_argument("--csv-output", help="filename for wins/losses",
                         default='selfplay.csv')
     parser.add_argument("--ignore-draw", action='store_true')
@@ -236,13 +264,16 @@ def main():
         bwin, bdraw, _ = selfplay_array(args,
                                         stub, stub_b,
                                         player_a, player_b,
-                                        args.output, wr)
+                                        args.output, wr,
+                                        args.binary_output)
         if args.both_side:
             pre, ext = os.path.splitext(args.output)
             output = pre + '-r' + ext
+            binary_output = args.binary_output + '-r' \
+                if args.binary_output else ''
             _, wdraw, wwin = selfplay_array(
                 args, stub_b, stub, player_b, player_a,
-                output, wr
+                output, wr, binary_output
             )
             p = (bwin + wwin + bdraw/2 + wdraw/2) / (args.n_games * 2)
             elodiff = miniosl.p2elo(min(p + eps, 1-eps))
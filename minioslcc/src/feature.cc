@@ -1,6 +1,7 @@
 #include "feature.h"
 #include "record.h"
 #include "impl/rng.h"
+#include "impl/bitpack.h"
 
 std::array<int8_t,81> osl::ml::board_dense_feature(const BaseState& state) {
   std::array<int8_t,81> board = { 0 };
@@ -559,6 +560,67 @@ osl::SubRecord::SubRecord(MiniRecord&& record)
     throw std::logic_error("unexpected initial state");
 }
 
+osl::SubRecord osl::SubRecord::from_usi_trusted(std::string_view line, bool settle_repetition) {
+  auto [state, rest] = usi::parse_initial_state(line);
+  SubRecord record;
+  auto [variant, opt_id] = state.guess_variant();
+  record.variant = variant;
+  record.shogi816k_id = opt_id.value_or(0);
+  if (variant != HIRATE && variant != Shogi816K && variant != Aozora)
+    throw std::logic_error("unsupported variant for SubRecord");    
+  if (variant == HIRATE && state != BaseState(HIRATE))
+    throw std::logic_error("unexpected initial state");
+
+  const char *space = " \t\r\n";
+  auto next_word = [&]() {
+    auto head = rest.find_first_not_of(space);
+    if (head == rest.npos)
+      return rest = {};
+    rest.remove_prefix(head);
+    auto word = rest.substr(0, rest.find_first_of(space));
+    rest.remove_prefix(word.size());
+    return word;
+  };
+  auto word = next_word();
+  if (word.empty())
+    return record;
+  if (word != "moves")
+    throw usi::ParseError("moves not found "+std::string(word));
+  record.moves.reserve(rest.size()/5);
+  for (word = next_word(); ! word.empty(); word = next_word()) {
+    if (word == "resign" || word == "win") {
+      const bool resign = word == "resign";
+      record.final_move = resign ? Move::Resign() : Move::DeclareWin();
+      record.result = resign ? loss_result(state.turn()) : win_result(state.turn());
+      break;
+    }
+    Move move = psn::to_move_light(word, state);
+    state.make_move_unsafe(move);
+    record.moves.push_back(move);
+  }
+  if (record.result == InGame && settle_repetition)
+    return SubRecord(usi::read_record(line));
+  return record;
+}
+
+std::vector<osl::SubRecord> osl::SubRecord::from_usi_file_trusted(std::string path, int threads,
+                                                                  bool settle_repetition) {
+  std::vector<std::vector<SubRecord>> chunks;
+  usi::parse_lines_parallel(path, threads,
+                            [&](size_t n) { chunks.resize(n); },
+                            [&](size_t c, std::string_view line) {
+                              chunks[c].push_back(from_usi_trusted(line, settle_repetition));
+                            });
+  std::vector<SubRecord> result;
+  size_t total = 0;
+  for (const auto& chunk: chunks)
+    total += chunk.size();
+  result.reserve(total);
+  for (auto& chunk: chunks)
+    std::ranges::move(chunk, std::back_inserter(result));
+  return result;
+}
+
 osl::BaseState osl::SubRecord::initial_state() const {
   if (variant == Shogi816K)
     return BaseState(Shogi816K, shogi816k_id);
@@ -648,34 +710,46 @@ void osl::SubRecord::export_feature_labels(int idx, nn_input_element *input,
   ml::helper::write_np_aftermove(state, move, aux_label);
 }
 
-int osl::SubRecord::weighted_sampling(int limit, int N, TID tid) {
-  // weigted sampling
-  //
-  // for usual cases of limit > N (e.g., = 11)
-  // - move P1, P2: 2^{-10}
-  // - move Pn (3 <= n <= 11): 2*Pn-1
-  // - move Pn (12 <= n): 1
-  //
-  // Rationale: In MZ, the latest 10^6 game records are kept, and
-  // - for each 2048 (bath size) x 1000 (step) positions, a new generation is generated.
-  // - If uniform, there are 10k-20k of the initial position (apparently too much)
-  // - The weight of 2^{-10} reduces the number to about 10-20,
-  //   reasonable for keeping the average win ratio stable.
-  auto& rng = rngs.at(idx(tid));
-  if (limit-1 > N) {
-    std::uniform_int_distribution<> dist(N, limit-1); // inclusive, move.size()-1 at most
-    int idx = dist(rng);
-    if (idx > N)
-      return idx;
-  }
-  std::uniform_real_distribution<> r01(0, 1);
-  double p = r01(rng);
-  int idx = std::min(N, limit-1);
-  while (idx > 0 && p < 0.5) {
-    --idx;
-    p *= 2;
+namespace osl {
+  namespace {
+    template <class URBG>
+    int weighted_sampling_impl(int limit, int N, URBG& rng) {
+      // weigted sampling
+      //
+      // for usual cases of limit > N (e.g., = 11)
+      // - move P1, P2: 2^{-10}
+      // - move Pn (3 <= n <= 11): 2*Pn-1
+      // - move Pn (12 <= n): 1
+      //
+      // Rationale: In MZ, the latest 10^6 game records are kept, and
+      // - for each 2048 (bath size) x 1000 (step) positions, a new generation is generated.
+      // - If uniform, there are 10k-20k of the initial position (apparently too much)
+      // - The weight of 2^{-10} reduces the number to about 10-20,
+      //   reasonable for keeping the average win ratio stable.
+      if (limit-1 > N) {
+        std::uniform_int_distribution<> dist(N, limit-1); // inclusive, move.size()-1 at most
+        int idx = dist(rng);
+        if (idx > N)
+          return idx;
+      }
+      std::uniform_real_distribution<> r01(0, 1);
+      double p = r01(rng);
+      int idx = std::min(N, limit-1);
+      while (idx > 0 && p < 0.5) {
+        --idx;
+        p *= 2;
+      }
+      return idx;  
+    }
   }
-  return idx;  
+}
+
+int osl::SubRecord::weighted_sampling(int limit, int N, TID tid) {
+  return weighted_sampling_impl(limit, N, rngs.at(idx(tid)));
+}
+
+int osl::SubRecord::weighted_sampling(int limit, int N, rng::CounterRNG& rng) {
+  return weighted_sampling_impl(limit, N, rng);
 }
 
 void osl::SubRecord::sample_feature_labels(nn_input_element *input,
@@ -701,6 +775,30 @@ sample_feature_labels_to(int offset,
   if (! is_hirate_game())
     decay = 0;
   int idx = weighted_sampling(moves.size(), decay, tid);
+  export_feature_labels_to(idx, offset, input_buf, policy_buf, value_buf, aux_buf, input2_buf,
+                           legalmove_buf, sampled_id_buf);
+}
+
+void osl::SubRecord::
+sample_feature_labels_to(int offset,
+                         nn_input_element *input_buf,
+                         int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                         nn_input_element *input2_buf,
+                         uint8_t *legalmove_buf, uint16_t *sampled_id_buf,
+                         int decay, rng::CounterRNG& rng) const {
+  if (! is_hirate_game())
+    decay = 0;
+  int idx = weighted_sampling(moves.size(), decay, rng);
+  export_feature_labels_to(idx, offset, input_buf, policy_buf, value_buf, aux_buf, input2_buf,
+                           legalmove_buf, sampled_id_buf);
+}
+
+void osl::SubRecord::
+export_feature_labels_to(int idx, int offset,
+                         nn_input_element *input_buf,
+                         int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                         nn_input_element *input2_buf,
+                         uint8_t *legalmove_buf, uint16_t *sampled_id_buf) const {
   if (sampled_id_buf)
     sampled_id_buf[offset] = idx;
   int move_label, value_label;
@@ -721,6 +819,108 @@ sample_feature_labels_to(int offset,
 }
 
 
+osl::CompactRecordBlock::CompactRecordBlock(const std::vector<SubRecord>& records) {
+  size_t total = 0;
+  for (const auto& record: records)
+    total += record.moves.size();
+  reserve(records.size(), total);
+  for (const auto& record: records)
+    push_back(record);
+}
+
+void osl::CompactRecordBlock::reserve(size_t records, size_t moves) {
+  codes.reserve(moves);
+  offsets.reserve(records+1);
+  info.reserve(records);
+}
+
+void osl::CompactRecordBlock::push_back(const SubRecord& record) {
+  if (codes.size() + record.moves.size() > UINT32_MAX)
+    throw std::length_error("CompactRecordBlock too many moves");
+  uint8_t final_move;
+  if (record.final_move == Move::Resign())
+    final_move = 1;
+  else if (record.final_move == Move::DeclareWin())
+    final_move = 2;
+  else if (record.final_move.isPass())
+    final_move = (record.final_move == Move::PASS(BLACK)) ? 0 : 3;
+  else
+    throw std::domain_error("CompactRecordBlock unexpected final move " + to_usi(record.final_move));
+
+  auto state = record.initial_state();
+  for (auto move: record.moves) {
+    codes.push_back(bitpack::encode12(state, move));
+    state.make_move_unsafe(move);
+  }
+  offsets.push_back(codes.size());
+  info.push_back({record.shogi816k_id, uint8_t(record.variant), uint8_t(record.result), final_move});
+}
+
+osl::SubRecord osl::CompactRecordBlock::prefix(size_t k, int n) const {
+  const auto& in = info.at(k);
+  SubRecord record;
+  record.variant = GameVariant(in.variant);
+  record.shogi816k_id = in.shogi816k_id;
+  record.result = GameResult(in.result);
+  static const std::array<Move,4> final_moves = {
+    Move::PASS(BLACK), Move::Resign(), Move::DeclareWin(), Move::PASS(WHITE)
+  };
+  record.final_move = final_moves.at(in.final_move);
+
+  const int size = move_size(k);
+  if (n < 0 || n > size)
+    n = size;
+  record.moves.reserve(n);
+  auto state = record.initial_state();
+  for (uint32_t i=offsets[k], end=offsets[k]+n; i<end; ++i) {
+    auto move = bitpack::decode_move12(state, codes[i]);
+    record.moves.push_back(move);
+    state.make_move_unsafe(move);
+  }
+  return record;
+}
+
+osl::MoveVector osl::CompactRecordBlock::moves(size_t k, int n) const {
+  return prefix(k, n).moves;
+}
+
+osl::SubRecord osl::CompactRecordBlock::record(size_t k) const {
+  return prefix(k, -1);
+}
+
+void osl::CompactRecordBlock::
+sample_feature_labels_to(size_t k, int offset,
+                         nn_input_element *input_buf,
+                         int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                         nn_input_element *input2_buf,
+                         uint8_t *legalmove_buf, uint16_t *sampled_id_buf,
+                         int decay, TID tid) const {
+  if (GameVariant(info.at(k).variant) != HIRATE)
+    decay = 0;
+  int idx = SubRecord::weighted_sampling(move_size(k), decay, tid);
+  prefix(k, idx+1).export_feature_labels_to(idx, offset, input_buf, policy_buf, value_buf, aux_buf,
+                                            input2_buf, legalmove_buf, sampled_id_buf);
+}
+
+void osl::CompactRecordBlock::
+sample_feature_labels_to(size_t k, int offset,
+                         nn_input_element *input_buf,
+                         int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                         nn_input_element *input2_buf,
+                         uint8_t *legalmove_buf, uint16_t *sampled_id_buf,
+                         int decay, rng::CounterRNG& rng) const {
+  if (GameVariant(info.at(k).variant) != HIRATE)
+    decay = 0;
+  int idx = SubRecord::weighted_sampling(move_size(k), decay, rng);
+  prefix(k, idx+1).export_feature_labels_to(idx, offset, input_buf, policy_buf, value_buf, aux_buf,
+                                            input2_buf, legalmove_buf, sampled_id_buf);
+}
+
+size_t osl::CompactRecordBlock::memory_bytes() const {
+  return sizeof(*this) + codes.capacity()*sizeof(uint16_t) + offsets.capacity()*sizeof(uint32_t)
+    + info.capacity()*sizeof(Info);
+}
+
 void osl::ml::set_legalmove_bits(const MoveVector& legal_moves, uint8_t *buf) {
   for (auto move: legal_moves) {
     int id = ml::policy_move_label(move);
@@ -3,6 +3,7 @@
 
 #include "state.h"
 #include "infer.h"
+#include "impl/rng.h"
 #include <unordered_map>
 #include <optional>
 
@@ -130,6 +131,21 @@ namespace osl {
                                   uint8_t *legalmove_buf,
                                   uint16_t *sampled_id_buf,
                                   int decay=default_decay, TID tid=TID_ZERO) const;
+    /** sample_feature_labels_to() drawing the index from `rng`, reproducible for a given key of `rng` */
+    void sample_feature_labels_to(int offset,
+                                  nn_input_element *input_buf,
+                                  int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                                  nn_input_element *input2_buf,
+                                  uint8_t *legalmove_buf,
+                                  uint16_t *sampled_id_buf,
+                                  int decay, rng::CounterRNG& rng) const;
+    /** export features and labels of index `idx` to given pointers (must be zero-filled) */
+    void export_feature_labels_to(int idx, int offset,
+                                  nn_input_element *input_buf,
+                                  int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                                  nn_input_element *input2_buf,
+                                  uint8_t *legalmove_buf,
+                                  uint16_t *sampled_id_buf) const;
 
     /** @internal make a state after the first `n` moves
      * marked as internal due to lack of the safety in make_move
@@ -138,7 +154,77 @@ namespace osl {
 
     /** sample int in range [0, limit-1], with progressive 1/2 weight for the opening moves, 2^{-decay} for initial position */
     static int weighted_sampling(int limit, int N=default_decay, TID tid=TID_ZERO);
+    static int weighted_sampling(int limit, int N, rng::CounterRNG& rng);
     static constexpr int default_decay=11;
+
+    /**
+     * read a usi line of trusted origin, e.g., self-play logs, without EffectState.
+     * Each move is validated only by BaseState::move_is_consistent (not by legality),
+     * and the result is set by the final `resign` or `win` (trusted without checking the declaration).
+     * @param settle_repetition if the line has no final move,
+     * parse it again by usi::read_record to settle the result by checkmate, repetition, or draw_limit;
+     * otherwise the result is left `InGame`
+     */
+    static SubRecord from_usi_trusted(std::string_view line, bool settle_repetition=false);
+    /** from_usi_trusted() for each line of a file, in parallel as RecordSet::from_usi_file_parallel
+     * @param threads number of workers, `range_parallel_threads` if 0 (see run_dynamic_parallel)
+     */
+    static std::vector<SubRecord> from_usi_file_trusted(std::string path, int threads=0,
+                                                        bool settle_repetition=false);
+  };
+
+  /**
+   * SubRecords of a block in the training window, compact in memory.
+   * Moves of all records are kept in a single array as bitpack::encode12 codes in 16 bits with
+   * per-record offsets, less than a half of the memory of std::vector<SubRecord> for usual games.
+   * Moves are decoded on demand by replaying the record from its initial state.
+   */
+  class CompactRecordBlock {
+  public:
+    CompactRecordBlock() = default;
+    explicit CompactRecordBlock(const std::vector<SubRecord>& records);
+
+    void push_back(const SubRecord& record);
+    void reserve(size_t records, size_t moves);
+    /** number of records */
+    size_t size() const { return info.size(); }
+    /** number of moves in record `k` */
+    int move_size(size_t k) const { return offsets.at(k+1) - offsets[k]; }
+    GameResult result(size_t k) const { return GameResult(info.at(k).result); }
+    /** decode the first `n` moves (all if n < 0) of record `k` */
+    MoveVector moves(size_t k, int n=-1) const;
+    /** decode record `k` */
+    SubRecord record(size_t k) const;
+    /** SubRecord::sample_feature_labels_to() for record `k`, decoding only the moves needed */
+    void sample_feature_labels_to(size_t k, int offset,
+                                  nn_input_element *input_buf,
+                                  int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                                  nn_input_element *input2_buf,
+                                  uint8_t *legalmove_buf,
+                                  uint16_t *sampled_id_buf,
+                                  int decay=SubRecord::default_decay, TID tid=TID_ZERO) const;
+    void sample_feature_labels_to(size_t k, int offset,
+                                  nn_input_element *input_buf,
+                                  int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                                  nn_input_element *input2_buf,
+                                  uint8_t *legalmove_buf,
+                                  uint16_t *sampled_id_buf,
+                                  int decay, rng::CounterRNG& rng) const;
+    /** bytes used including reserved capacity */
+    size_t memory_bytes() const;
+  private:
+    struct Info {
+      int32_t shogi816k_id;
+      uint8_t variant, result;
+      /** 0 for PASS(BLACK) (the default of MiniRecord, in a draw or unfinished game),
+       * 1 for resign, 2 for DeclareWin, 3 for PASS(WHITE) */
+      uint8_t final_move;
+    };
+    SubRecord prefix(size_t k, int n) const;
+
+    std::vector<uint16_t> codes;
+    std::vector<uint32_t> offsets = {0};
+    std::vector<Info> info;
   };
 }
 
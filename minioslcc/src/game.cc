@@ -4,12 +4,45 @@
 #include "impl/range-parallel.h"
 #include "impl/rng.h"
 #include "impl/checkmate.h"
+#include "impl/usi-process.h"
+#include "impl/alphabeta.h"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
-osl::GameManager::GameManager(GameVariant kind, std::optional<int> shogi816k_id) {
+namespace osl {
+  namespace {
+#ifdef ENABLE_GAME_STATS
+    constexpr bool game_stats_enabled = true;
+    /** add elapsed time to `sum` at destruction */
+    class StopWatch {
+      std::chrono::steady_clock::time_point start;
+      double& sum;
+    public:
+      explicit StopWatch(double& s) : start(std::chrono::steady_clock::now()), sum(s) {}
+      ~StopWatch() {
+        sum += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+    };
+#else
+    constexpr bool game_stats_enabled = false;
+    struct StopWatch {
+      explicit StopWatch(double&) {}
+    };
+#endif
+  }
+}
+
+osl::GameManager::GameManager(GameVariant kind, std::optional<int> shogi816k_id,
+                              std::optional<uint64_t> key)
+  : rng_key(key ? *key : rngs[0]()) {
   if (kind == Shogi816K) {
-    if (shogi816k_id.value_or(-1) < 0)
-      shogi816k_id.emplace(rngs[0]() % Shogi816K_Size);
+    if (shogi816k_id.value_or(-1) < 0) {
+      rng::CounterRNG rng(rng_key, 0, rng::Purpose::Shogi816K);
+      shogi816k_id.emplace(std::uniform_int_distribution<>(0, Shogi816K_Size-1)(rng));
+    }
 
     state = EffectState(BaseState(Shogi816K, shogi816k_id.value()));
   }
@@ -135,7 +168,8 @@ osl::GameManager osl::GameManager::from_record(const MiniRecord& record) {
 
 osl::ParallelGameManager::ParallelGameManager(int N, std::optional<GameConfig> cfg)
   : games(),
-    config(cfg.value_or(GameConfig())) {
+    config(cfg.value_or(GameConfig())),
+    seed(config.seed.value_or(rng::default_seed())) {
   games.reserve(N);
   for (int i=0; i<N; ++i)
     games.emplace_back(make_newgame());
@@ -162,21 +196,26 @@ std::vector<osl::GameResult> osl::ParallelGameManager::make_move_parallel(const
   run_range_parallel(N, add);
   for (int i=0; i<n_parallel(); ++i) {
     if (ret[i] != InGame) {
-      if (! config.ignore_draw || ret[i] != Draw)
-        completed_games.push_back(std::move(games[i].record));
+      if (! config.ignore_draw || ret[i] != Draw) {
+        ++completed_count;
+        if (sink)
+          sink->add(std::move(games[i].record));
+        else
+          completed_games.push_back(std::move(games[i].record));
+      }
       reset(i);
     }
   }
   return ret;
 }
 
-osl::PlayerArray::PlayerArray(bool greedy_) : greedy(greedy_), rngs(rng::make_rng_array()) {
+osl::PlayerArray::PlayerArray(bool greedy_) : greedy(greedy_) {
 }
 
 template <bool with_noise>
 std::vector<std::pair<float,osl::Move>>
 osl::PlayerArray::sort_moves_impl(const MoveVector& moves, const policy_logits_t& logits, int top_n,
-                                  rng_t *rng, float noise_scale) {
+                                  rng::CounterRNG *rng, float noise_scale) {
   std::extreme_value_distribution<> gumbel {0, 1};
   
   std::vector<std::pair<float,Move>> pmv; // priority-move vector
@@ -196,19 +235,19 @@ std::vector<std::pair<float,osl::Move>>
 osl::PlayerArray::sort_moves_with_book(const OpeningTree& book,
                                        BasicHash state_key,
                                        const MoveVector& moves, const policy_logits_t& logits, int top_n,
-                                       rng_t *rng, float noise_scale, float book_weight_p, float book_weight_v
+                                       rng::CounterRNG *rng, float noise_scale, float book_weight_p, float book_weight_v
                                        ) {
   auto node = book.edit(state_key);
   if (! node)
     return sort_moves_with_gumbel(moves, logits, top_n, rng, noise_scale);
-  // record visit
-  (*node)->result_count[InGame] += 1;
+  // record visit, other games may visit the same node concurrently
+  OpeningTree::add_visit(**node);
 
   std::vector<std::pair<float,Move>> pmv; // priority-move vector
   pmv.reserve(moves.size());
   const int sgn = sign(turn(state_key));
   constexpr int exploration_percent = 3;
-  const int expl_sampled = std::uniform_int_distribution<>(0, 100)(rng[0]);
+  const int expl_sampled = std::uniform_int_distribution<>(0, 100)(*rng);
   const int expl = expl_sampled < exploration_percent;
 
   // softmax of logits
@@ -286,15 +325,17 @@ bool osl::PolicyPlayer::recv_result(int,
                                     const std::vector<value_vector_t>&) {
   // always make a decision in a single inference
   check_size(logits.size());
-  auto run = [&](int l, int r, TID tid) {
+  auto run = [&](int l, int r) {
     for (int g=l; g<r; ++g) {
+      const auto& game = (*_games)[g];
+      rng::CounterRNG rng(game.rng_key, game.record.move_size(), rng::Purpose::Gumbel);
       auto ret = greedy
-        ? sort_moves((*_games)[g].legal_moves, logits[g], 1)
-        : sort_moves_with_gumbel((*_games)[g].legal_moves, logits[g], 1, &rngs[idx(tid)]);
+        ? sort_moves(game.legal_moves, logits[g], 1)
+        : sort_moves_with_gumbel(game.legal_moves, logits[g], 1, &rng);
       _decision[g] = ret[0].second;
     }
   };
-  run_range_parallel_tid(n_parallel(), run);
+  run_range_parallel(n_parallel(), run);
   return true;
 }
 
@@ -389,21 +430,22 @@ bool osl::FlatGumbelPlayer::recv_result(int phase,
       root_children_terminal.resize(root_width * n_parallel());    
       // root_children_expl.resize(root_width * n_parallel());    
     }
-    auto run = [&](int l, int r, TID tid) {
+    auto run = [&](int l, int r) {
       // std::vector<float> expl_bonus(root_width);
       for (int g=l; g<r; ++g) {
         auto ns = noise_scale;
         if ((*_games)[g].record.move_size() >= greedy_after)
           ns = 0.0;
         auto nb = 51 + (second_width > 0);
+        rng::CounterRNG rng((*_games)[g].rng_key, (*_games)[g].record.move_size(), rng::Purpose::Gumbel);
         auto ret = book
           ? sort_moves_with_book(*book,
                                  (*_games)[g].record.history.back().basic(),
                                  (*_games)[g].legal_moves, logits[g], root_width,
-                                 &rngs[idx(tid)], ns,
+                                 &rng, ns,
                                  book_weight_p * nb, book_weight_v * nb)
           : sort_moves_with_gumbel((*_games)[g].legal_moves, logits[g], root_width,
-                                   &rngs[idx(tid)], ns);
+                                   &rng, ns);
         while (ret.size() < root_width)
           ret.push_back(ret[0]);
         int offset = g*root_width;
@@ -411,7 +453,7 @@ bool osl::FlatGumbelPlayer::recv_result(int phase,
           root_children[offset + i] = std::make_tuple(ret[i].first, ret[i].second, 0, 0.);
       }
     };
-    run_range_parallel_tid(n_parallel(), run);
+    run_range_parallel(n_parallel(), run);
     return false;
   }
   auto turn = root_move(0).player();
@@ -487,10 +529,352 @@ bool osl::FlatGumbelPlayer::recv_result(int phase,
   return true;
 }
 
+osl::SequentialHalvingPlayer::SequentialHalvingPlayer(GumbelPlayerConfig config)
+  : PlayerArray(/* greedy */ config.noise_scale == 0),
+    GumbelPlayerConfig(config),
+    schedule(make_schedule(config.root_width, config.n_simulations)) {
+  if (child_width < 1)
+    throw std::invalid_argument("child_width " + std::to_string(child_width));
+  if (config.book_path != "") {
+    book = OpeningTree::load_binary(config.book_path, config.book_threshold);
+  } 
+}
+
+osl::SequentialHalvingPlayer::~SequentialHalvingPlayer() {
+}
+
+std::vector<int> osl::SequentialHalvingPlayer::make_schedule(int root_width, int n_simulations) {
+  if (root_width < 1 || n_simulations < 1)
+    throw std::invalid_argument("sequential halving " + std::to_string(root_width)
+                                + " " + std::to_string(n_simulations));
+  // Gumbel MuZero: ceil(log2(m)) rounds sharing the budget equally,
+  // each considered child gets floor(n / (rounds * k)) (at least one) visits in a round
+  const int rounds = std::max(1, (int)std::ceil(std::log2(root_width)));
+  std::vector<int> ret;
+  int k = root_width;
+  for (int r=0; r<rounds; ++r) {
+    int visits = std::max(1, n_simulations / (rounds * k));
+    ret.insert(ret.end(), visits, k);
+    k = std::max(2, (k+1)/2);
+  }
+  return ret;
+}
+
+std::string osl::SequentialHalvingPlayer::name() const {
+  using namespace std::string_literals;
+  auto ret = "gumbel-sh-"s + std::to_string(root_width) + "-" + std::to_string(n_simulations);
+  if (value_mix == GumbelPlayerConfig::td)
+    ret += "td";
+  else if (value_mix == GumbelPlayerConfig::ave)
+    ret += "ave";
+  else if (value_mix == GumbelPlayerConfig::max)
+    ret += "max";
+  return ret;
+}
+
+int osl::SequentialHalvingPlayer::width(int phase) const {
+  if (phase == 0)
+    return 1;                   // root
+  if (1 <= phase && phase <= schedule.size())
+    return schedule[phase-1];
+  throw std::invalid_argument("phase error " + std::to_string(phase));
+}
+
+void osl::SequentialHalvingPlayer::new_series(const std::vector<GameManager>& games) {
+  PlayerArray::new_series(games);
+  trees.clear();
+}
+
+int osl::SequentialHalvingPlayer::Tree::find_child(int id, Move move) const {
+  if (id < 0) {
+    for (int c: order)
+      if (nodes[c].move == move)
+        return c;
+    return -1;
+  }
+  const auto& node = nodes[id];
+  for (int c=node.first_child; c<node.first_child+node.n_children; ++c)
+    if (nodes[c].move == move)
+      return c;
+  return -1;
+}
+
+void osl::SequentialHalvingPlayer::advance(const std::vector<Move>& moves) {
+  if (! reuse_tree || trees.empty())
+    return;
+  check_size(moves.size());
+  auto run = [&](int l, int r) {
+    for (int g=l; g<r; ++g) {
+      auto& tree = trees[g];
+      if (tree.nodes.empty())
+        continue;
+      int c = tree.find_child(tree.root, moves[g]);
+      if (c < 0 || tree.nodes[c].n_children == 0) {
+        tree.clear();
+        continue;
+      }
+      tree.root = c;
+      tree.root_key = make_move(tree.root_key, moves[g]);
+    }
+  };
+  run_range_parallel(n_parallel(), run);
+}
+
+void osl::SequentialHalvingPlayer::reroot(Tree& tree, BasicHash key,
+                                          const std::vector<std::pair<float,Move>>& children) {
+  // keep the old arena only if it follows the current position,
+  // i.e., advance() has been called for each move since the last search
+  const bool reuse = reuse_tree && ! tree.nodes.empty() && tree.root >= 0 && tree.root_key == key;
+  std::vector<Node> fresh;
+  fresh.reserve(reuse ? tree.nodes.size() : root_width);
+  std::vector<std::pair<int,int>> queue; // (old, new)
+  for (int i=0; i<root_width; ++i) {
+    fresh.push_back({children[i].second, children[i].first});
+    int c = reuse ? tree.find_child(tree.root, children[i].second) : -1;
+    if (c < 0 || std::ranges::count(queue, c, &std::pair<int,int>::first))
+      continue;                 // no statistics or padded duplicate
+    fresh.back().visit = tree.nodes[c].visit;
+    fresh.back().value_sum = tree.nodes[c].value_sum;
+    fresh.back().terminal = tree.nodes[c].terminal;
+    queue.emplace_back(c, i);
+  }
+  // compaction in breadth-first order, bounded by the size of a tree made in a search
+  const size_t limit = root_width + (size_t)n_simulations * child_width;
+  for (size_t q=0; q<queue.size(); ++q) {
+    const auto [src, dst] = queue[q];
+    const auto& node = tree.nodes[src];
+    if (node.n_children == 0 || fresh.size() + node.n_children > limit)
+      continue;                 // to be evaluated and expanded again
+    fresh[dst].first_child = fresh.size();
+    fresh[dst].n_children = node.n_children;
+    for (int c=node.first_child; c<node.first_child+node.n_children; ++c) {
+      queue.emplace_back(c, fresh.size());
+      fresh.push_back(tree.nodes[c]);
+      fresh.back().parent = dst;
+      fresh.back().first_child = -1;
+      fresh.back().n_children = 0;
+    }
+  }
+  tree.nodes.swap(fresh);
+  tree.order.resize(root_width);
+  std::iota(tree.order.begin(), tree.order.end(), 0);
+  tree.root = -1;
+  tree.root_key = key;
+}
+
+int osl::SequentialHalvingPlayer::Tree::max_root_visit() const {
+  int ret = 0;
+  for (int c: order)
+    ret = std::max(ret, nodes[c].visit);
+  return ret;
+}
+
+float osl::SequentialHalvingPlayer::root_score(const Tree& tree, int child, int c_visit) const {
+  const auto& node = tree.nodes[child];
+  return node.logit + FlatGumbelPlayer::transformQ_formula(node.q(), c_visit, tree.max_root_visit(), cscale);
+}
+
+int osl::SequentialHalvingPlayer::select_child(const Tree& tree, int id, int c_visit) const {
+  // deterministic selection at non-root nodes in Gumbel MuZero:
+  // argmax pi'(a) - N(a)/(1+sum N), where pi' = softmax(logits + sigma(completedQ))
+  const auto& parent = tree.nodes[id];
+  const int first = parent.first_child, last = first + parent.n_children;
+  int total = 0, maxnb = 0;
+  for (int c=first; c<last; ++c) {
+    total += tree.nodes[c].visit;
+    maxnb = std::max(maxnb, tree.nodes[c].visit);
+  }
+  const float v_unvisited = - parent.q(); // for the player to move at parent
+  std::vector<float> score(parent.n_children);
+  for (int c=first; c<last; ++c) {
+    const auto& child = tree.nodes[c];
+    auto q = child.visit ? child.q() : v_unvisited;
+    score[c-first] = child.logit + FlatGumbelPlayer::transformQ_formula(q, c_visit, maxnb, cscale);
+  }
+  const float smax = std::ranges::max(score);
+  float z = 0;
+  for (auto& e: score) {
+    e = std::exp(e - smax);
+    z += e;
+  }
+  int best = first;
+  float best_score = -std::numeric_limits<float>::infinity();
+  for (int c=first; c<last; ++c) {
+    auto s = score[c-first]/z - tree.nodes[c].visit / (1.0f + total);
+    if (s > best_score) {
+      best = c;
+      best_score = s;
+    }
+  }
+  return best;
+}
+
+void osl::SequentialHalvingPlayer::backup(Tree& tree, int id, float value) {
+  for (; id >= 0; id = tree.nodes[id].parent) {
+    tree.nodes[id].visit += 1;
+    tree.nodes[id].value_sum += value;
+    value = -value;             // negamax
+  }
+}
+
+void osl::SequentialHalvingPlayer::expand(Tree& tree, int id, const MoveVector& moves,
+                                          const policy_logits_t& logits) {
+  if (moves.empty())
+    return;
+  auto sorted = sort_moves(moves, logits, child_width);
+  const int n = std::min((int)sorted.size(), child_width);
+  const int first = tree.nodes.size();
+  for (int i=0; i<n; ++i)
+    tree.nodes.push_back({sorted[i].second, sorted[i].first, id});
+  tree.nodes[id].first_child = first;
+  tree.nodes[id].n_children = n;
+}
+
+namespace osl {
+  namespace {
+    /** value of terminal node for the player who made the last move */
+    float terminal_value(Move last, GameResult result) {
+      if (! has_winner(result))
+        return 0;
+      return (result == win_result(last.player())) ? 1.0 : -1.0;
+    }
+  }
+}
+
+bool osl::SequentialHalvingPlayer::make_request(int phase, nn_input_element *ptr) {
+  check_ready();
+  if (phase == 0) {
+    // request for root
+    GameArray::export_root_features(*_games, ptr);
+    return true;
+  }
+  const int k = width(phase);
+  leaf.assign(n_parallel()*k, -1);
+  leaf_moves.resize(n_parallel()*k);
+  auto run = [&](int l, int r) {
+    MoveVector path;
+    for (int g=l; g<r; ++g) {
+      auto& tree = trees[g];
+      const auto& game = (*_games)[g];
+      const int cv = c_visit(g);
+      for (int i=0; i<k; ++i) {
+        const int slot = g*k + i;
+        int id = tree.order[i];
+        while (tree.nodes[id].n_children > 0)
+          id = select_child(tree, id, cv);
+        leaf[slot] = id;
+        if (tree.nodes[id].terminal != InGame)
+          continue;             // just backup again in recv_result
+        path.clear();
+        for (int p=id; p>=0; p=tree.nodes[p].parent)
+          path.push_back(tree.nodes[p].move);
+        std::ranges::reverse(path);
+        auto *dst = ptr + slot*ml::input_unit;
+        GameResult terminal;
+        if (path.size() == 1)
+          terminal = game.export_heuristic_feature_after(path[0], dst);
+        else {
+          auto history = game.record.moves;
+          history.insert(history.end(), path.begin(), path.end()-1);
+          terminal = GameManager::export_heuristic_feature_after(path.back(), game.record.initial_state,
+                                                                 std::move(history), dst);
+        }
+        tree.nodes[id].terminal = terminal;
+        if (terminal != InGame)
+          continue;
+        EffectState state(game.state);
+        for (auto move: path)
+          state.makeMove(move);
+        state.generateLegal(leaf_moves[slot]);
+      }
+    }
+  };
+  run_range_parallel(n_parallel(), run);
+  return true;                  // policy is needed for expansion
+}
+
+bool osl::SequentialHalvingPlayer::recv_result(int phase,
+                                               const std::vector<policy_logits_t>& logits,
+                                               const std::vector<value_vector_t>& values) {
+  if (phase == 0) {
+    check_size(logits.size(), 1, "SequentialHalvingPlayer recv phase0");
+    trees.resize(n_parallel());
+    // maximum visits of a root child surviving all rounds
+    const auto nb = 50 + schedule.size();
+    auto run = [&](int l, int r) {
+      for (int g=l; g<r; ++g) {
+        auto ns = noise_scale;
+        if ((*_games)[g].record.move_size() >= greedy_after)
+          ns = 0.0;
+        rng::CounterRNG rng((*_games)[g].rng_key, (*_games)[g].record.move_size(), rng::Purpose::Gumbel);
+        auto ret = book
+          ? sort_moves_with_book(*book,
+                                 (*_games)[g].record.history.back().basic(),
+                                 (*_games)[g].legal_moves, logits[g], root_width,
+                                 &rng, ns,
+                                 book_weight_p * nb, book_weight_v * nb)
+          : sort_moves_with_gumbel((*_games)[g].legal_moves, logits[g], root_width,
+                                   &rng, ns);
+        while (ret.size() < root_width)
+          ret.push_back(ret[0]);
+        reroot(trees[g], (*_games)[g].record.history.back().basic(), ret);
+      }
+    };
+    run_range_parallel(n_parallel(), run);
+    return false;
+  }
+  const int k = width(phase);
+  check_size(values.size(), k, "SequentialHalvingPlayer recv phase" + std::to_string(phase));
+  check_size(logits.size(), k, "SequentialHalvingPlayer recv phase" + std::to_string(phase));
+  const bool last = (phase == schedule.size());
+  const bool halving = last || schedule[phase] < k;
+  auto run = [&](int l, int r) {
+    for (int g=l; g<r; ++g) {
+      auto& tree = trees[g];
+      for (int i=0; i<k; ++i) {
+        const int slot = g*k + i, id = leaf[slot];
+        const auto& node = tree.nodes[id];
+        float value;
+        if (node.terminal != InGame)
+          value = terminal_value(node.move, node.terminal);
+        else {
+          value = /* negamax */ - take_value(values[slot]);
+          expand(tree, id, leaf_moves[slot], logits[slot]);
+        }
+        backup(tree, id, value);
+      }
+      if (! halving)
+        continue;
+      const int cv = c_visit(g);
+      std::vector<std::pair<float,int>> sorted;
+      sorted.reserve(k);
+      for (int i=0; i<k; ++i)
+        sorted.emplace_back(root_score(tree, tree.order[i], cv), tree.order[i]);
+      std::ranges::stable_sort(sorted, [](auto l, auto r){ return l.first > r.first; });
+      for (int i=0; i<k; ++i)
+        tree.order[i] = sorted[i].second;
+      if (last)
+        _decision[g] = tree.nodes[tree.order[0]].move;
+    }
+  };
+  run_range_parallel(n_parallel(), run);
+  return last;
+}
+
 osl::SingleCPUPlayer::~SingleCPUPlayer() {
 }
 
-osl::CPUPlayer::CPUPlayer(std::shared_ptr<SingleCPUPlayer> pl, bool greedy) : PlayerArray(greedy), player(pl) {
+osl::Move osl::SingleCPUPlayer::think_game(const GameManager& game) {
+  return think(to_usi(game.record));
+}
+
+osl::CPUPlayer::CPUPlayer(std::shared_ptr<SingleCPUPlayer> pl, bool greedy) : PlayerArray(greedy), pool{pl} {
+}
+
+osl::CPUPlayer::CPUPlayer(std::vector<std::shared_ptr<SingleCPUPlayer>> pl, bool greedy)
+  : PlayerArray(greedy), pool(pl) {
+  if (pool.empty() || std::count(pool.begin(), pool.end(), nullptr))
+    throw std::invalid_argument("CPUPlayer empty pool");
 }
 
 osl::CPUPlayer::~CPUPlayer() {
@@ -498,10 +882,34 @@ osl::CPUPlayer::~CPUPlayer() {
 
 bool osl::CPUPlayer::make_request(int, nn_input_element *) {
   check_ready();
-  for (int g=0; g<n_parallel(); ++g) {
-    std::string usi = to_usi((*_games)[g].record);
-    _decision[g] = player->think(usi); // future
+  const int N = n_parallel(), n_workers = std::min<int>(pool.size(), N);
+  if (n_workers <= 1) {
+    for (int g=0; g<N; ++g)
+      _decision[g] = pool[0]->think_game((*_games)[g]);
+    return false;
   }
+  // each worker takes the next game as soon as its player finishes the previous one
+  std::atomic<int> next = 0;
+  std::vector<std::exception_ptr> failure(n_workers);
+  auto work = [&](int k) {
+    try {
+      for (int g; (g = next++) < N; )
+        _decision[g] = pool[k]->think_game((*_games)[g]);
+    }
+    catch (...) {
+      failure[k] = std::current_exception();
+      next = N;
+    }
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(n_workers);
+  for (int k=0; k<n_workers; ++k)
+    workers.emplace_back(work, k);
+  for (auto& t: workers)
+    t.join();
+  for (auto& e: failure)
+    if (e)
+      std::rethrow_exception(e);
   return false;
 }
 
@@ -511,7 +919,7 @@ bool osl::CPUPlayer::recv_result(int,
   return true;
 }
 
-osl::RandomPlayer::RandomPlayer() : SingleCPUPlayer() {
+osl::RandomPlayer::RandomPlayer() : SingleCPUPlayer(), rng(rng::make_rng()) {
 }
 
 osl::RandomPlayer::~RandomPlayer() {
@@ -522,14 +930,85 @@ osl::Move osl::RandomPlayer::think(std::string line) {
   usi::parse(line, state);
   MoveVector moves;
   state.generateLegal(moves);
-  int id = rngs[0]() % moves.size();
+  int id = rng() % moves.size();
   return moves.at(id);
 }
 
+osl::Move osl::RandomPlayer::think_game(const GameManager& game) {
+  rng::CounterRNG rng(game.rng_key, game.record.move_size(), rng::Purpose::RandomMove);
+  return game.legal_moves.at(rng() % game.legal_moves.size());
+}
+
 std::string osl::RandomPlayer::name() {
   return "random-player";
 }
 
+osl::AlphaBetaPlayer::AlphaBetaPlayer(int depth, uint64_t node_limit, bool r)
+  : rng(rng::make_rng()), randomize(r) {
+  AlphaBetaConfig config;
+  config.depth = depth;
+  config.node_limit = node_limit;
+  engine.reset(new AlphaBetaSearch(config));
+}
+
+osl::AlphaBetaPlayer::~AlphaBetaPlayer() {
+}
+
+osl::Move osl::AlphaBetaPlayer::search(const EffectState& state, const std::vector<HashStatus>& history,
+                                       uint64_t seed) {
+  // games are interleaved among players in a pool, so no entries are carried over
+  engine->clear();
+  auto move = engine->search(state, history, randomize ? (seed | 1) : 0);
+  if (move.isSpecial())
+    throw std::logic_error("AlphaBetaPlayer no legal moves");
+  return move;
+}
+
+osl::Move osl::AlphaBetaPlayer::think(std::string line) {
+  EffectState state;
+  usi::parse(line, state);
+  return search(state, {}, uint64_t(rng()) << 32 | rng());
+}
+
+osl::Move osl::AlphaBetaPlayer::think_game(const GameManager& game) {
+  // a function of the game and ply, whichever player in a pool takes it
+  rng::CounterRNG counter(game.rng_key, game.record.move_size(), rng::Purpose::SearchRoot);
+  return search(game.state, game.record.history, counter());
+}
+
+std::string osl::AlphaBetaPlayer::name() {
+  return "alphabeta-player";
+}
+
+int osl::AlphaBetaPlayer::last_score() const {
+  return engine->score();
+}
+
+uint64_t osl::AlphaBetaPlayer::last_nodes() const {
+  return engine->nodes();
+}
+
+osl::UsiEnginePlayer::UsiEnginePlayer(std::vector<std::string> path_and_args,
+                                      std::vector<std::string> setoptions,
+                                      std::string g, std::string cwd)
+  : engine(new UsiProcess(path_and_args, setoptions, cwd)), go(g) {
+}
+
+osl::UsiEnginePlayer::~UsiEnginePlayer() {
+}
+
+osl::Move osl::UsiEnginePlayer::think(std::string line) {
+  EffectState state;
+  usi::parse(line, state);
+  return usi::to_move(engine->search(line, go), state);
+}
+
+std::string osl::UsiEnginePlayer::name() {
+  auto id = engine->name();
+  std::replace(id.begin(), id.end(), ' ', '_');
+  return id.empty() ? "usi" : id;
+}
+
 
 void osl::GameArray::export_root_features(const std::vector<GameManager>& games, nn_input_element *ptr) {
   const auto N = games.size();
@@ -552,12 +1031,25 @@ osl::GameArray::GameArray(int N, PlayerArray& a, PlayerArray& b,
     random_opening(config.value_or(GameConfig()).random_opening) {
   model[0] = &model_a;
   model[1] = &model_b;
+  if (const auto& sizes = config.value_or(GameConfig()).batch_sizes; ! sizes.empty()) {
+    const bool pad = config->batch_padding;
+    scheduler[0].reset(new BatchScheduler(model_a, sizes, pad));
+    scheduler[1] = (model[0] == model[1]) ? scheduler[0]
+      : std::make_shared<BatchScheduler>(model_b, sizes, pad);
+    model[0] = scheduler[0].get();
+    model[1] = scheduler[1].get();
+  }
+  if (int sz = config.value_or(GameConfig()).eval_cache_size; sz > 0) {
+    cache[0].reset(new EvalCache(sz));
+    cache[1] = (model[0] == model[1]) ? cache[0] : std::make_shared<EvalCache>(sz);
+  }
   
   players[0]->new_series(mgrs.games);
   if (players[0] != players[1])
     players[1]->new_series(mgrs.games);
 
   resize_buffer(std::max(1, max_width));
+  step_stats.enabled = game_stats_enabled;
 }
 
 osl::GameArray::~GameArray() {
@@ -573,6 +1065,21 @@ void osl::GameArray::warmup(int n) {
   }
 }
 
+osl::EvalCacheStats osl::GameArray::eval_cache_stats(int id) const {
+  const auto& c = cache.at(id);
+  return c ? c->stats() : EvalCacheStats();
+}
+
+std::vector<osl::BatchSizeStats> osl::GameArray::batch_stats(int id) const {
+  const auto& s = scheduler.at(id);
+  return s ? s->stats() : std::vector<BatchSizeStats>();
+}
+
+void osl::GameArray::reset_stats() {
+  step_stats = GameArrayStats();
+  step_stats.enabled = game_stats_enabled;
+}
+
 void osl::GameArray::resize_buffer(int width) {
   int sz = width * mgrs.n_parallel();
   input_buf.resize(sz * ml::input_unit); // fill 0 for newly added elements
@@ -581,8 +1088,10 @@ void osl::GameArray::resize_buffer(int width) {
 }
 
 void osl::GameArray::step() {
+  StopWatch step_watch(step_stats.total_seconds);
+  auto& pstats = step_stats.player[side];
   // (1) thinking
-  int safety_limit = 16, cnt=0;
+  int safety_limit = players[side]->max_phases(), cnt=0;
   bool ready = false;
   do {
     // std::cerr << mgrs.games[0].state;
@@ -593,33 +1102,74 @@ void osl::GameArray::step() {
     // so we only need to clear dirty part
     auto limit = std::min(req_size*ml::input_unit*mgrs.n_parallel(),
                           (int)input_buf.size());
-    std::fill(input_buf.begin(), input_buf.begin()+limit, 0);
-    resize_buffer(req_size);
+    bool need_policy;
+    {
+      StopWatch watch(pstats.request_seconds);
+      std::fill(input_buf.begin(), input_buf.begin()+limit, 0);
+      resize_buffer(req_size);
 
-    auto need_policy = players[side]->make_request(cnt, &input_buf[0]);
+      need_policy = players[side]->make_request(cnt, &input_buf[0]);
+    }
 
     if (req_size > 0) {
+      StopWatch watch(pstats.infer_seconds);
       if (! need_policy)
         policy_buf.resize(0);
-      model[side]->batch_infer(input_buf, policy_buf, value_buf);
+      if (cache[side])
+        cache[side]->batch_infer(*model[side], input_buf, policy_buf, value_buf);
+      else
+        model[side]->batch_infer(input_buf, policy_buf, value_buf);
+      if constexpr (game_stats_enabled) {
+        ++pstats.infer_calls;
+        pstats.positions += value_buf.size();
+        pstats.capacity += std::max(1, max_width) * mgrs.n_parallel();
+      }
     }
     
-    ready = players[side]->recv_result(cnt, policy_buf, value_buf);
+    {
+      StopWatch watch(pstats.result_seconds);
+      ready = players[side]->recv_result(cnt, policy_buf, value_buf);
+    }
     if (++cnt > safety_limit)
       throw std::runtime_error("step too long");
   } while (! ready);
+  if constexpr (game_stats_enabled) {
+    ++pstats.steps;
+    pstats.phases += cnt;
+  }
 
   // (2) make move
-  auto moves = players[side]->decision();
+  std::vector<Move> moves;
+  {
+    StopWatch watch(pstats.decision_seconds);
+    moves = players[side]->decision();
+  }
   if (random_opening > 0) {
     std::uniform_real_distribution<> r01(0, 1);
     for (int g=0; g<mgrs.n_parallel(); ++g) {
-      if (mgrs.games[g].record.move_size() >= 2 || r01(rngs[0]) > random_opening)
+      const auto& game = mgrs.games[g];
+      if (game.record.move_size() >= 2)
+        continue;
+      rng::CounterRNG rng(game.rng_key, game.record.move_size(), rng::Purpose::RandomOpening);
+      if (r01(rng) > random_opening)
         continue;
-      std::ranges::sample(mgrs.games[g].legal_moves, &moves[g], 1, rngs[0]);
+      std::ranges::sample(game.legal_moves, &moves[g], 1, rng);
     }
   }
-  auto ret = mgrs.make_move_parallel(moves);
+  const auto completed_before = mgrs.completed_count;
+  std::vector<GameResult> ret;
+  {
+    StopWatch watch(step_stats.make_move_seconds);
+    ret = mgrs.make_move_parallel(moves);
+  }
+  if constexpr (game_stats_enabled) {
+    ++step_stats.steps;
+    step_stats.moves += moves.size();
+    step_stats.games += mgrs.completed_count - completed_before;
+  }
+  players[0]->advance(moves);
+  if (players[0] != players[1])
+    players[1]->advance(moves);
   //std::cerr << to_csa(players[side]->decision()[0]) << '\n';
 
   // (2') misc to force player_a as the first player after completing odd-length game
@@ -4,6 +4,9 @@
 #include "record.h"
 #include "infer.h"
 #include "impl/rng.h"
+#include "impl/evalcache.h"
+#include "impl/batch-scheduler.h"
+#include "impl/record-writer.h"
 
 namespace osl {
   /** run 1:1 game */
@@ -16,10 +19,16 @@ namespace osl {
     EffectState state;
     /** legal moves in current state to detect game ends */
     MoveVector legal_moves;
+    /** key of the random streams of this game (see rng::CounterRNG) */
+    uint64_t rng_key;
 
-    /** start a new game */
+    /** start a new game
+     * @param shogi816k_id drawn from the stream of `rng_key` if not specified for Shogi816K
+     * @param rng_key drawn from the thread local generator if not specified
+     */
     explicit GameManager(GameVariant kind=HIRATE,
-                         std::optional<int> shogi816k_id=std::nullopt);
+                         std::optional<int> shogi816k_id=std::nullopt,
+                         std::optional<uint64_t> rng_key=std::nullopt);
     ~GameManager();
 
     /** make a move
@@ -59,7 +68,11 @@ namespace osl {
   public:
     PlayerArray(bool greedy_);
     virtual ~PlayerArray()=default;
-    void new_series(const std::vector<GameManager>& games);
+    virtual void new_series(const std::vector<GameManager>& games);
+    /** notified after `moves` are made in all games, by either player.
+     * search players may keep the subtree below the moves for reuse in the next decision.
+     */
+    virtual void advance(const std::vector<Move>& /* moves */) {}
     /** return whether need policy in addition to value */
     virtual bool make_request(int phase, nn_input_element *)=0;
     /** return decision made */
@@ -69,6 +82,8 @@ namespace osl {
     /** maximum number of position each player may request at a time */
     virtual int max_width() const { return 1; }
     virtual int width(int /* phase */) const { return max_width(); }
+    /** maximum number of phases to make a decision */
+    virtual int max_phases() const { return 16; }
     virtual std::string name() const=0;
 
     const auto& decision() const { return _decision; }
@@ -78,7 +93,6 @@ namespace osl {
   protected:
     const std::vector<GameManager> *_games = nullptr;
     std::vector<Move> _decision;
-    rng::rng_array_t rngs;
     std::shared_ptr<const OpeningTree> book;
     void check_ready() const;
     void check_size(int n, int scale=1, std::string where="") const;
@@ -89,16 +103,16 @@ namespace osl {
     }
     static std::vector<std::pair<float,Move>>
     sort_moves_with_gumbel(const osl::MoveVector& moves, const policy_logits_t& logits, int top_n,
-                           rng_t *rng, float noise_scale=1.0) {
+                           rng::CounterRNG *rng, float noise_scale=1.0) {
       return sort_moves_impl<true>(moves, logits, top_n, rng, noise_scale);
     }
     template <bool with_noise> static std::vector<std::pair<float,Move>>
     sort_moves_impl(const osl::MoveVector& moves, const policy_logits_t& logits, int top_n,
-                    rng_t *rng=nullptr, float noise_scale=1.0);
+                    rng::CounterRNG *rng=nullptr, float noise_scale=1.0);
     static std::vector<std::pair<float,Move>>
     sort_moves_with_book(const OpeningTree& book, BasicHash state_key,
                          const osl::MoveVector& moves, const policy_logits_t& logits, int top_n,
-                         rng_t *rng, float gumbel_noise_scale=1.0,
+                         rng::CounterRNG *rng, float gumbel_noise_scale=1.0,
                          float book_weight_p=1.0, float book_weight_v=1.0
                          );
   };
@@ -124,6 +138,12 @@ namespace osl {
     std::string book_path = "";
     int book_threshold = 16;
     float book_weight_p = 1, book_weight_v = 1;
+    /** total number of leaf evaluations below root children, for SequentialHalvingPlayer */
+    int n_simulations = 32;
+    /** number of children kept at each interior node, for SequentialHalvingPlayer */
+    int child_width = 16;
+    /** keep subtrees across moves, for SequentialHalvingPlayer */
+    bool reuse_tree = true;
 
     float take_value(const value_vector_t& values) const {
       auto cv = values[0];      // default mc return
@@ -170,23 +190,108 @@ namespace osl {
     std::vector<GameResult> root_children_terminal;
   };
 
+  /**
+   * Gumbel MuZero style player with sequential halving over a simulation budget.
+   *
+   * - phase 0: evaluate root and sample `root_width` moves by gumbel top-k,
+   * - phase 1...: a simulation for each considered root child per phase,
+   *   each descending in its own subtree and expanding one leaf,
+   * - the considered children are halved at the end of each round.
+   *
+   * Leaves of all games are evaluated together in each phase, so the width of a phase is
+   * the number of the root children considered in the round.
+   *
+   * With `reuse_tree`, advance() follows the moves played and the next decision starts from
+   * the statistics of the subtree, compacted into a fresh arena.
+   */
+  struct SequentialHalvingPlayer : public PlayerArray, private GumbelPlayerConfig {
+    explicit SequentialHalvingPlayer(GumbelPlayerConfig config);
+    ~SequentialHalvingPlayer() override;
+
+    bool make_request(int phase, nn_input_element *) override;
+    bool recv_result(int phase,
+                     const std::vector<policy_logits_t>& logits,
+                     const std::vector<value_vector_t>& values) override;
+    int max_width() const override { return root_width; }
+    int width(int phase) const override;
+    int max_phases() const override { return schedule.size() + 1; }
+    std::string name() const override;
+    void new_series(const std::vector<GameManager>& games) override;
+    void advance(const std::vector<Move>& moves) override;
+
+    struct Node {
+      Move move;
+      /** policy logits, plus gumbel noise for root children */
+      float logit = 0;
+      int parent = -1, first_child = -1, n_children = 0;
+      int visit = 0;
+      /** sum of values for the player of `move` */
+      float value_sum = 0;
+      GameResult terminal = InGame;
+
+      float q() const { return visit ? value_sum/visit : 0; }
+    };
+    /** search tree of a game, root children occupy nodes[0, root_width) */
+    struct Tree {
+      std::vector<Node> nodes;
+      /** root children sorted by score, the first `width` of them are considered */
+      std::vector<int> order;
+      /** node of the current position after advance(), -1 for the root */
+      int root = -1;
+      /** hash of the current position */
+      BasicHash root_key;
+      int max_root_visit() const;
+      /** child of `node` (or of the root if -1) by `move`, -1 if not found */
+      int find_child(int node, Move move) const;
+      void clear() { nodes.clear(); order.clear(); root = -1; }
+    };
+    /** number of root children considered for each simulation phase */
+    const std::vector<int>& simulation_schedule() const { return schedule; }
+    const std::vector<Tree>& search_trees() const { return trees; }
+    static std::vector<int> make_schedule(int root_width, int n_simulations);
+  private:
+    float root_score(const Tree& tree, int child, int c_visit) const;
+    int select_child(const Tree& tree, int node, int c_visit) const;
+    void backup(Tree& tree, int node, float value);
+    void expand(Tree& tree, int node, const MoveVector& moves, const policy_logits_t& logits);
+    /** make a new tree for the root children, copying the subtrees kept since the last search */
+    void reroot(Tree& tree, BasicHash key, const std::vector<std::pair<float,Move>>& children);
+    int c_visit(int g) const { return std::max(50, (*_games)[g].record.move_size()); }
+
+    std::vector<int> schedule;
+    std::vector<Tree> trees;
+    /** leaf node waiting evaluation for each request, or -1 */
+    std::vector<int> leaf;
+    std::vector<MoveVector> leaf_moves;
+  };
+
   struct SingleCPUPlayer {
     virtual ~SingleCPUPlayer();
     virtual Move think(std::string usi)=0;
     virtual std::string name()=0;
+    /** think on the current state of `game`, `think(to_usi(game.record))` unless overridden */
+    virtual Move think_game(const GameManager& game);
   };
   
+  /**
+   * adaptor of SingleCPUPlayer for PlayerArray.
+   *
+   * With more than one player in the pool, `think` for each game is dispatched concurrently
+   * to the pool, so that each instance is used by a single thread at a time.
+   */
   struct CPUPlayer : public PlayerArray {
     CPUPlayer(std::shared_ptr<SingleCPUPlayer> player, bool greedy);
+    CPUPlayer(std::vector<std::shared_ptr<SingleCPUPlayer>> pool, bool greedy);
     ~CPUPlayer() override;
     bool make_request(int phase, nn_input_element *) override;
     bool recv_result(int phase,
                      const std::vector<policy_logits_t>& logits,
                      const std::vector<value_vector_t>& values) override;
     int max_width() const override { return 0; }
-    std::string name() const override { return player->name(); }
+    std::string name() const override { return pool[0]->name(); }
+    int pool_size() const { return pool.size(); }
   private:
-    std::shared_ptr<SingleCPUPlayer> player;
+    std::vector<std::shared_ptr<SingleCPUPlayer>> pool;
   };
 
   struct RandomPlayer : public SingleCPUPlayer {
@@ -194,6 +299,57 @@ namespace osl {
     ~RandomPlayer();
     Move think(std::string usi) override;
     std::string name() override;
+    Move think_game(const GameManager& game) override;
+  private:
+    rng_t rng;
+  };
+
+  class AlphaBetaSearch;
+  struct AlphaBetaConfig;
+  /**
+   * SingleCPUPlayer by a small alpha-beta search with material and piece-square evaluation,
+   * for cheap baseline matches without neural networks
+   */
+  struct AlphaBetaPlayer : public SingleCPUPlayer {
+    /**
+     * @param depth maximum depth of iterative deepening
+     * @param node_limit nodes searched for a move
+     * @param randomize break ties of root moves randomly so that games differ,
+     * by rng::CounterRNG of the game in think_game()
+     */
+    explicit AlphaBetaPlayer(int depth=3, uint64_t node_limit=100000, bool randomize=true);
+    ~AlphaBetaPlayer();
+    Move think(std::string usi) override;
+    std::string name() override;
+    Move think_game(const GameManager& game) override;
+    /** score of the last move from the view of the player */
+    int last_score() const;
+    /** nodes searched for the last move */
+    uint64_t last_nodes() const;
+  private:
+    Move search(const EffectState& state, const std::vector<HashStatus>& history, uint64_t seed);
+    std::unique_ptr<AlphaBetaSearch> engine;
+    rng_t rng;
+    bool randomize;
+  };
+
+  class UsiProcess;
+  /** SingleCPUPlayer backed by an external usi engine, each instance owns its process */
+  struct UsiEnginePlayer : public SingleCPUPlayer {
+    /**
+     * @param path_and_args command to launch the engine
+     * @param setoptions lines sent before `isready`
+     * @param go arguments of `go` command for each move
+     */
+    UsiEnginePlayer(std::vector<std::string> path_and_args,
+                    std::vector<std::string> setoptions,
+                    std::string go="byoyomi 1000", std::string cwd="");
+    ~UsiEnginePlayer();
+    Move think(std::string usi) override;
+    std::string name() override;
+  private:
+    std::unique_ptr<UsiProcess> engine;
+    std::string go;
   };
   
   struct GameConfig {
@@ -201,6 +357,16 @@ namespace osl {
     bool ignore_draw = false;
     float random_opening = 0.0;
     GameVariant variant = HIRATE;
+    /** number of entries of the evaluation cache in GameArray, disabled if 0 */
+    int eval_cache_size = 0;
+    /** preferred batch sizes of the models in GameArray (see BatchScheduler), disabled if empty */
+    std::vector<int> batch_sizes;
+    /** pad small batches to a preferred size */
+    bool batch_padding = true;
+    /** seed of the random streams of games, rng::default_seed() if not set.
+     * Self-play with the same seed is reproducible regardless of the number of threads.
+     */
+    std::optional<uint64_t> seed;
   };
   
   struct ParallelGameManager {
@@ -210,15 +376,58 @@ namespace osl {
     int n_parallel() const { return games.size(); }
     
     std::vector<GameResult> make_move_parallel(const std::vector<Move>& move);
-    GameManager make_newgame() const {
-      return GameManager(config.variant);
+    /** start a new game keyed by the next game id */
+    GameManager make_newgame() {
+      return GameManager(config.variant, std::nullopt, rng::game_key(seed, next_game_id++));
     }
     void reset(int g) {
       games.at(g) = make_newgame();
     }
     std::vector<GameManager> games;
+    /** completed games unless `sink` is set */
     std::vector<MiniRecord> completed_games;
     GameConfig config;
+    /** optional destination of completed games instead of `completed_games` */
+    std::shared_ptr<GameRecordSink> sink;
+    /** number of completed games given to `completed_games` or `sink` */
+    size_t completed_count = 0;
+    /** seed of the random streams, config.seed or rng::default_seed() */
+    uint64_t seed;
+    /** id of the next game, assigned in the order of make_newgame calls */
+    uint64_t next_game_id = 0;
+  };
+
+  /**
+   * counters of GameArray::step to see where time goes.
+   * Collected if compiled with ENABLE_GAME_STATS, the cost is a few steady_clock reads per phase.
+   */
+  struct GameArrayStats {
+    /** counters for the phases of a player */
+    struct Player {
+      uint64_t steps = 0, phases = 0, infer_calls = 0;
+      /** positions sent to the model, and their upper bound `max_width * N` for each call */
+      uint64_t positions = 0, capacity = 0;
+      /** time in make_request (feature export), batch_infer, recv_result, and decision */
+      double request_seconds = 0, infer_seconds = 0, result_seconds = 0, decision_seconds = 0;
+      double mean_batch() const { return infer_calls ? 1.0*positions/infer_calls : 0.0; }
+      double occupancy() const { return capacity ? 1.0*positions/capacity : 0.0; }
+    };
+    std::array<Player,2> player;
+    uint64_t steps = 0, moves = 0, games = 0;
+    /** time in make_move_parallel including repetition and game-end checks */
+    double make_move_seconds = 0;
+    /** time spent in step */
+    double total_seconds = 0;
+    bool enabled = false;
+
+    uint64_t positions() const { return player[0].positions + player[1].positions; }
+    double positions_per_second() const { return total_seconds > 0 ? positions()/total_seconds : 0.0; }
+    double moves_per_second() const { return total_seconds > 0 ? moves/total_seconds : 0.0; }
+    double games_per_second() const { return total_seconds > 0 ? games/total_seconds : 0.0; }
+    double occupancy() const {
+      auto c = player[0].capacity + player[1].capacity;
+      return c ? 1.0*positions()/c : 0.0;
+    }
   };
 
   class GameArray {
@@ -231,8 +440,21 @@ namespace osl {
 
     void step();
     const auto& completed() const { return mgrs.completed_games; }
+    /** number of completed games, including those given to the sink */
+    size_t n_completed() const { return mgrs.completed_count; }
+    /** stream completed games to `sink` instead of keeping them in completed() */
+    void set_record_sink(std::shared_ptr<GameRecordSink> sink) { mgrs.sink = sink; }
+    /** games in progress */
+    const std::vector<GameManager>& games() const { return mgrs.games; }
 
     void warmup(int n=4);
+    /** counters of the evaluation cache for the model of player `id` (zero if disabled) */
+    EvalCacheStats eval_cache_stats(int id=0) const;
+    /** counters of each batch size sent to the model of player `id` (empty if `batch_sizes` is not set) */
+    std::vector<BatchSizeStats> batch_stats(int id=0) const;
+    /** timing counters of step(), all zero unless compiled with ENABLE_GAME_STATS */
+    const GameArrayStats& stats() const { return step_stats; }
+    void reset_stats();
     /** @param ptr must be zero-filled in advance */
     static void export_root_features(const std::vector<GameManager>& games, nn_input_element *ptr);
   private:
@@ -241,6 +463,8 @@ namespace osl {
     ParallelGameManager mgrs;
     std::array<PlayerArray*,2> players;
     std::array<InferenceModel*,2> model;
+    std::array<std::shared_ptr<EvalCache>,2> cache;
+    std::array<std::shared_ptr<BatchScheduler>,2> scheduler;
     bool side=0;
     std::vector<nn_input_element> input_buf;
     std::vector<policy_logits_t> policy_buf;
@@ -249,6 +473,7 @@ namespace osl {
     std::vector<int8_t> skip_one_turn;
     int max_width;
     double random_opening=0.0;
+    GameArrayStats step_stats;
   };
 }
 
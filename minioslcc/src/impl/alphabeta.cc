@@ -0,0 +1,290 @@
+#include "impl/alphabeta.h"
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace osl {
+  namespace alphabeta {
+    constexpr CArray<int,Ptype_SIZE> value_table = {
+      0, 0,                     // empty, edge
+      520, 500, 500, 520, 1050, 1250, // PPAWN, PLANCE, PKNIGHT, PSILVER, PBISHOP, PROOK
+      0, 550, 100, 300, 350, 500, 800, 950, // KING, GOLD, PAWN, LANCE, KNIGHT, SILVER, BISHOP, ROOK
+    };
+    /** indexed by rank from the owner's view, 1 for the farthest */
+    constexpr CArray<int,10> pawn_advance = { 0, 0, 40, 25, 15, 8, 0, 0, 0, 0 };
+
+    bool gold_like(Ptype ptype) {
+      return ptype == GOLD || ptype == SILVER || (! is_basic(ptype) && ptype != PBISHOP && ptype != PROOK);
+    }
+    int distance(Square l, Square r) {
+      return std::max(std::abs(l.x() - r.x()), std::abs(l.y() - r.y()));
+    }
+    /** scores beyond this are mate in (MateValue - |value|) plies */
+    constexpr int MateThreshold = MateValue - 1000;
+    /** mate scores in the table are relative to the node, while those in the search are to the root */
+    int value_to_table(int value, int ply) {
+      if (value >= MateThreshold)
+        return value + ply;
+      if (value <= -MateThreshold)
+        return value - ply;
+      return value;
+    }
+    int value_from_table(int value, int ply) {
+      if (value >= MateThreshold)
+        return value - ply;
+      if (value <= -MateThreshold)
+        return value + ply;
+      return value;
+    }
+  }
+}
+
+int osl::alphabeta::piece_value(Ptype ptype) {
+  return value_table[idx(ptype)];
+}
+
+int osl::alphabeta::evaluate(const EffectState& state) {
+  CArray<int,2> score = {0, 0};
+  for (int id: state.active_pieces().toRange()) {
+    const Piece p = state.pieceOf(id);
+    const Player owner = p.owner();
+    const Ptype ptype = p.ptype();
+    if (! p.isOnBoard()) {
+      score[owner] += value_table[idx(ptype)] * 11 / 10; // flexibility of pieces in hand
+      continue;
+    }
+    const Square sq = p.square();
+    const int y = change_y_view(owner, sq.y());
+    if (ptype == KING) {
+      score[owner] += (y >= 8) ? 30 : (y == 7 ? 10 : std::max(-120, -20*(7-y)));
+      continue;
+    }
+    score[owner] += value_table[idx(ptype)];
+    if (ptype == PAWN)
+      score[owner] += pawn_advance[y];
+    if (state.king_active(owner) && gold_like(ptype)) {
+      const int d = distance(sq, state.kingSquare(owner));
+      score[owner] += (d == 1) ? 40 : (d == 2 ? 20 : 0);
+    }
+    if (state.king_active(alt(owner))) {
+      const int d = distance(sq, state.kingSquare(alt(owner)));
+      score[owner] += (d == 1) ? 35 : (d == 2 ? 20 : (d == 3 ? 5 : 0));
+    }
+  }
+  const Player turn = state.turn();
+  return score[turn] - score[alt(turn)];
+}
+
+osl::AlphaBetaSearch::AlphaBetaSearch(AlphaBetaConfig c) : config(c) {
+  if (config.depth < 1 || config.tt_log2 < 1 || config.tt_log2 > 30 || config.quiesce_depth < 0)
+    throw std::invalid_argument("AlphaBetaSearch config");
+  table.resize(size_t(1) << config.tt_log2);
+}
+
+osl::AlphaBetaSearch::~AlphaBetaSearch() {
+}
+
+void osl::AlphaBetaSearch::clear() {
+  std::ranges::fill(table, Entry());
+}
+
+osl::AlphaBetaSearch::Entry& osl::AlphaBetaSearch::entry(const BasicHash& hash) {
+  return table[key(hash) & (table.size() - 1)];
+}
+
+void osl::AlphaBetaSearch::order(const EffectState& state, MoveVector& moves, Move tt_move, int ply) const {
+  std::vector<std::pair<int,Move>> scored;
+  scored.reserve(moves.size());
+  for (Move move: moves) {
+    int priority = 0;
+    if (move == tt_move)
+      priority = 1000000;
+    else if (move.isCapture() || move.isPromotion()) {
+      const int v = state.see(move);
+      priority = (v >= 0 ? 100000 : -100000) + v;
+    }
+    else if (ply < killers.size() && (move == killers[ply][0] || move == killers[ply][1]))
+      priority = (move == killers[ply][0]) ? 50001 : 50000;
+    scored.emplace_back(priority, move);
+  }
+  std::ranges::stable_sort(scored, [](const auto& l, const auto& r) { return l.first > r.first; });
+  for (size_t i=0; i<moves.size(); ++i)
+    moves[i] = scored[i].second;
+}
+
+int osl::AlphaBetaSearch::quiesce(const EffectState& state, int qdepth, int ply, int alpha, int beta) {
+  ++node_count;
+  const Player P = state.turn();
+  MoveVector moves;
+  const bool in_check = state.inCheck();
+  int best = -alphabeta::Infty;
+  if (in_check) {
+    state.generateLegal(moves);
+    if (moves.empty())
+      return -alphabeta::MateValue + ply;
+    if (qdepth <= 0)
+      return alphabeta::evaluate(state);
+    order(state, moves, Move(), ply);
+  }
+  else {
+    best = alphabeta::evaluate(state);
+    if (best >= beta || qdepth <= 0)
+      return best;
+    alpha = std::max(alpha, best);
+    // captures, promoted whenever possible
+    std::vector<std::pair<int,Move>> captures;
+    for (int id: state.piecesOnBoard(alt(P)).toRange()) {
+      const Piece target = state.pieceOf(id);
+      if (target.ptype() == KING)
+        continue;
+      const Square to = target.square();
+      for (int aid: state.effectAt(P, to).toRange()) {
+        const Piece attacker = state.pieceOf(aid);
+        const Square from = attacker.square();
+        const Ptype ptype = attacker.ptype();
+        const bool promote = can_promote(ptype)
+          && (promote_area_y(P, from.y()) || promote_area_y(P, to.y()));
+        const Move move(from, to, promote ? osl::promote(ptype) : ptype, target.ptype(), promote, P);
+        if (! state.isSafeMove(move))
+          continue;
+        const int v = state.see(move);
+        if (v >= 0)
+          captures.emplace_back(v, move);
+      }
+    }
+    std::ranges::stable_sort(captures, [](const auto& l, const auto& r) { return l.first > r.first; });
+    for (const auto& [v, move]: captures)
+      moves.push_back(move);
+  }
+  for (Move move: moves) {
+    EffectState child(state);
+    child.makeMove(move);
+    const int v = -quiesce(child, qdepth-1, ply+1, -beta, -alpha);
+    if (v > best) {
+      best = v;
+      if (v > alpha) {
+        alpha = v;
+        if (alpha >= beta)
+          break;
+      }
+    }
+    if (stopped())
+      break;
+  }
+  return best;
+}
+
+int osl::AlphaBetaSearch::negamax(const EffectState& state, BasicHash hash, int depth, int ply,
+                                  int alpha, int beta) {
+  if (depth <= 0)
+    return quiesce(state, config.quiesce_depth, ply, alpha, beta);
+  ++node_count;
+  const uint64_t k = key(hash);
+  if (repetition.contains(k) || std::ranges::count(path, k)) {
+    ++repetition_draws;
+    return 0;
+  }
+  Entry& e = entry(hash);
+  Move tt_move;
+  if (e.key == k) {
+    tt_move = e.move;
+    if (e.depth >= depth) {
+      const int value = alphabeta::value_from_table(e.value, ply);
+      if (e.bound == 0 || (e.bound == 1 && value >= beta) || (e.bound == 2 && value <= alpha))
+        return value;
+    }
+  }
+  MoveVector moves;
+  state.generateLegal(moves);
+  if (moves.empty())
+    return -alphabeta::MateValue + ply;
+  order(state, moves, tt_move, ply);
+
+  const int alpha0 = alpha;
+  const uint64_t draws0 = repetition_draws;
+  int best = -alphabeta::Infty;
+  Move best_move;
+  path.push_back(k);
+  for (Move move: moves) {
+    EffectState child(state);
+    child.makeMove(move);
+    const int v = -negamax(child, make_move(hash, move), depth-1, ply+1, -beta, -alpha);
+    if (stopped())
+      break;
+    if (v > best) {
+      best = v;
+      best_move = move;
+      if (v > alpha) {
+        alpha = v;
+        if (alpha >= beta) {
+          if (! move.isCapture() && ply < killers.size() && killers[ply][0] != move) {
+            killers[ply][1] = killers[ply][0];
+            killers[ply][0] = move;
+          }
+          break;
+        }
+      }
+    }
+  }
+  path.pop_back();
+  if (stopped())
+    return best;
+  e.key = k;
+  e.move = best_move;
+  e.value = alphabeta::value_to_table(best, ply);
+  // a value depending on repetitions in the path is kept only for move ordering
+  e.depth = (repetition_draws == draws0) ? depth : 0;
+  e.bound = (best >= beta) ? 1 : (best <= alpha0 ? 2 : 0);
+  return best;
+}
+
+osl::Move osl::AlphaBetaSearch::search(const EffectState& state, const std::vector<HashStatus>& history,
+                                       uint64_t seed) {
+  node_count = 0;
+  repetition_draws = 0;
+  root_score = 0;
+  root_depth = 0;
+  killers.assign(config.depth + 1, {Move(), Move()});
+  repetition.clear();
+  path.clear();
+  const BasicHash root_hash = hash_code(state);
+  for (size_t i=0; i+1<history.size(); ++i)
+    repetition.insert(key(history[i].basic()));
+
+  MoveVector moves;
+  state.generateLegal(moves);
+  if (moves.empty())
+    return Move::Resign();
+  if (seed) {
+    std::default_random_engine rng(seed);
+    std::ranges::shuffle(moves, rng);
+  }
+  Move best_move = moves[0];
+  const uint64_t root_key = key(root_hash);
+  for (int depth=1; depth<=config.depth; ++depth) {
+    order(state, moves, best_move, 0);
+    int alpha = -alphabeta::Infty, best = -alphabeta::Infty;
+    Move candidate = moves[0];
+    path.assign(1, root_key);
+    for (Move move: moves) {
+      EffectState child(state);
+      child.makeMove(move);
+      const int v = -negamax(child, make_move(root_hash, move), depth-1, 1, -alphabeta::Infty, -alpha);
+      if (stopped())
+        break;
+      if (v > best) {
+        best = v;
+        candidate = move;
+        alpha = std::max(alpha, v);
+      }
+    }
+    if (stopped())
+      break;
+    best_move = candidate;
+    root_score = best;
+    root_depth = depth;
+    if (best >= alphabeta::MateValue - depth)
+      break;
+  }
+  return best_move;
+}
@@ -0,0 +1,86 @@
+#ifndef MINIOSL_ALPHABETA_H
+#define MINIOSL_ALPHABETA_H
+
+#include "state.h"
+#include "impl/hash.h"
+#include <vector>
+#include <unordered_set>
+#include <cstdint>
+
+namespace osl {
+  namespace alphabeta {
+    constexpr int Infty = 32000, MateValue = 30000;
+    /** material value, pawn=100 */
+    int piece_value(Ptype ptype);
+    /** static evaluation, material and piece-square terms, from the view of the side to move */
+    int evaluate(const EffectState& state);
+  }
+
+  struct AlphaBetaConfig {
+    /** maximum depth of iterative deepening */
+    int depth = 4;
+    /** search is stopped after this number of nodes, returning the result of the last iteration */
+    uint64_t node_limit = 200000;
+    /** plies of capture search beyond the horizon */
+    int quiesce_depth = 8;
+    /** number of transposition table entries in log2 */
+    int tt_log2 = 18;
+  };
+
+  /**
+   * small alpha-beta search for baseline matches without neural networks.
+   *
+   * Negamax with iterative deepening, transposition table, killer moves, and quiescence
+   * search of captures ordered by EffectState::see.
+   * Positions repeated in the search path or the game history are scored as draws,
+   * and such path-dependent values are not reused from the table.
+   * The table persists across searches; clear() it at the start of a game.
+   */
+  class AlphaBetaSearch {
+  public:
+    explicit AlphaBetaSearch(AlphaBetaConfig config=AlphaBetaConfig());
+    ~AlphaBetaSearch();
+
+    /**
+     * @param history states so far, the last one is `state`, to detect repetitions
+     * @param seed shuffles root moves of equal value if non-zero
+     * @return best move, or Move::Resign() if no legal moves
+     */
+    Move search(const EffectState& state, const std::vector<HashStatus>& history={}, uint64_t seed=0);
+
+    /** score of the last search from the view of the side to move at the root */
+    int score() const { return root_score; }
+    /** depth completed in the last search */
+    int completed_depth() const { return root_depth; }
+    uint64_t nodes() const { return node_count; }
+    /** clear the transposition table */
+    void clear();
+  private:
+    struct Entry {
+      uint64_t key = 0;
+      Move move;
+      int16_t value = 0;
+      int8_t depth = -1;
+      uint8_t bound = 0;
+    };
+    int negamax(const EffectState& state, BasicHash hash, int depth, int ply, int alpha, int beta);
+    int quiesce(const EffectState& state, int qdepth, int ply, int alpha, int beta);
+    void order(const EffectState& state, MoveVector& moves, Move tt_move, int ply) const;
+    Entry& entry(const BasicHash& hash);
+    static uint64_t key(const BasicHash& hash) {
+      return hash.first ^ (uint64_t(hash.second) * 0x9e3779b97f4a7c15ull);
+    }
+    bool stopped() const { return node_count >= config.node_limit; }
+
+    AlphaBetaConfig config;
+    std::vector<Entry> table;
+    std::vector<std::array<Move,2>> killers;
+    std::unordered_set<uint64_t> repetition;
+    std::vector<uint64_t> path;
+    uint64_t node_count = 0, repetition_draws = 0;
+    int root_score = 0, root_depth = 0;
+  };
+}
+
+#endif
+// MINIOSL_ALPHABETA_H
@@ -0,0 +1,147 @@
+#include "impl/batch-prefetcher.h"
+#include "impl/rng.h"
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+osl::BatchPrefetcher::BatchPrefetcher(BatchPrefetcherConfig c)
+  : cfg(c), state(c.ring_size, Free) {
+  if (cfg.batch_size < 1 || cfg.n_threads < 1 || cfg.ring_size < cfg.n_threads+1 || cfg.window_size < 1)
+    throw std::invalid_argument("BatchPrefetcher config");
+  seed = cfg.seed ? *cfg.seed : ((uint64_t(std::random_device()()) << 32) | std::random_device()());
+  const size_t N = cfg.batch_size;
+  ring.resize(cfg.ring_size);
+  for (auto& batch: ring) {
+    batch.inputs.resize(N*ml::input_unit);
+    batch.inputs2.resize(cfg.with_inputs2 ? N*ml::input_unit : 0);
+    batch.aux_labels.resize(N*ml::aux_unit);
+    batch.policy_labels.resize(N);
+    batch.value_labels.resize(N);
+    batch.legalmove_labels.resize(cfg.with_legalmoves ? N*ml::legalmove_bs_sz : 0);
+    batch.sampled_ids.resize(N);
+  }
+}
+
+osl::BatchPrefetcher::~BatchPrefetcher() {
+  stop();
+}
+
+void osl::BatchPrefetcher::add(CompactRecordBlock block) {
+  if (block.size() == 0)
+    throw std::invalid_argument("BatchPrefetcher::add empty block");
+  auto ptr = std::make_shared<const CompactRecordBlock>(std::move(block));
+  std::lock_guard<std::mutex> lock(m);
+  window.push_back(ptr);
+  window_records += ptr->size();
+  while (window.size() > 1 && window_records - window.front()->size() >= cfg.window_size) {
+    window_records -= window.front()->size();
+    window.erase(window.begin());
+  }
+  cv.notify_all();
+}
+
+size_t osl::BatchPrefetcher::stored_records() const {
+  std::lock_guard<std::mutex> lock(m);
+  return window_records;
+}
+
+void osl::BatchPrefetcher::start() {
+  std::lock_guard<std::mutex> lock(m);
+  if (running)
+    return;
+  running = true;
+  for (int i=0; i<cfg.n_threads; ++i)
+    workers.emplace_back([this]() { work(); });
+}
+
+void osl::BatchPrefetcher::stop() {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    running = false;
+  }
+  cv.notify_all();
+  for (auto& worker: workers)
+    worker.join();
+  workers.clear();
+}
+
+void osl::BatchPrefetcher::work() {
+  while (true) {
+    int slot = -1;
+    window_t snapshot;
+    size_t records;
+    {
+      std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock, [&]() {
+        return ! running || (window_records > 0 && std::ranges::count(state, Free) > 0);
+      });
+      if (! running)
+        return;
+      slot = std::ranges::find(state, Free) - state.begin();
+      state[slot] = Filling;
+      ring[slot].id = next_fill++;
+      snapshot = window;
+      records = window_records;
+    }
+    fill(ring[slot], snapshot, records);
+    {
+      std::lock_guard<std::mutex> lock(m);
+      state[slot] = Ready;
+    }
+    cv.notify_all();
+  }
+}
+
+void osl::BatchPrefetcher::fill(TrainingBatch& batch, const window_t& blocks, size_t records) const {
+  std::ranges::fill(batch.inputs, 0);
+  std::ranges::fill(batch.inputs2, 0);
+  std::ranges::fill(batch.aux_labels, 0);
+  std::ranges::fill(batch.legalmove_labels, 0);
+  auto *i2ptr = cfg.with_inputs2 ? batch.inputs2.data() : nullptr;
+  auto *lmptr = cfg.with_legalmoves ? batch.legalmove_labels.data() : nullptr;
+  const auto key = rng::game_key(seed, batch.id);
+  std::uniform_int_distribution<size_t> uniform(0, records-1);
+  for (int i=0; i<cfg.batch_size; ++i) {
+    rng::CounterRNG rng(key, i, rng::Purpose::TrainingSample);
+    size_t r = uniform(rng);
+    auto block = blocks.begin();
+    while (r >= (*block)->size())
+      r -= (*block++)->size();
+    (*block)->sample_feature_labels_to(r, i, batch.inputs.data(), batch.policy_labels.data(),
+                                       batch.value_labels.data(), batch.aux_labels.data(),
+                                       i2ptr, lmptr, batch.sampled_ids.data(), cfg.decay, rng);
+  }
+}
+
+int osl::BatchPrefetcher::pop() {
+  std::unique_lock<std::mutex> lock(m);
+  auto ready = [&]() {
+    for (size_t i=0; i<ring.size(); ++i)
+      if (state[i] == Ready && ring[i].id == next_pop)
+        return int(i);
+    return -1;
+  };
+  int slot = ready();
+  if (slot < 0) {
+    if (! running)
+      throw std::logic_error("BatchPrefetcher::pop not running");
+    if (window_records == 0)
+      throw std::logic_error("BatchPrefetcher::pop no records");
+    cv.wait(lock, [&]() { return (slot = ready()) >= 0 || ! running; });
+    if (slot < 0)
+      throw std::logic_error("BatchPrefetcher::pop stopped");
+  }
+  state[slot] = InUse;
+  ++next_pop;
+  return slot;
+}
+
+void osl::BatchPrefetcher::release(int slot) {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    if (state.at(slot) != InUse)
+      throw std::logic_error("BatchPrefetcher::release slot not in use");
+    state[slot] = Free;
+  }
+  cv.notify_all();
+}
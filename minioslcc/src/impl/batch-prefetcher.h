@@ -0,0 +1,88 @@
+#ifndef MINIOSL_BATCH_PREFETCHER_H
+#define MINIOSL_BATCH_PREFETCHER_H
+
+#include "feature.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace osl {
+  struct BatchPrefetcherConfig {
+    int batch_size = 1024;
+    /** number of batch buffers, at least `n_threads + 1` */
+    int ring_size = 4;
+    /** background threads each of which fills a whole batch at a time */
+    int n_threads = 2;
+    /** number of records kept, the oldest block is replaced when exceeded (as GameDataset) */
+    int window_size = 1000000;
+    int decay = SubRecord::default_decay;
+    /** export afterstate features and legal moves */
+    bool with_inputs2 = true, with_legalmoves = true;
+    /** batches are a function of the seed and the window if set (see rng::CounterRNG) */
+    std::optional<uint64_t> seed;
+  };
+
+  /** buffers of a batch, layout is the same as those given to collate_features */
+  struct TrainingBatch {
+    std::vector<nn_input_element> inputs, inputs2, aux_labels;
+    std::vector<int32_t> policy_labels;
+    std::vector<float> value_labels;
+    std::vector<uint8_t> legalmove_labels;
+    std::vector<uint16_t> sampled_ids;
+    /** serial number of the batch */
+    uint64_t id = 0;
+  };
+
+  /**
+   * training batches prepared by background threads.
+   *
+   * Owns the window of CompactRecordBlocks, samples records uniformly from the window,
+   * and fills a ring of preallocated TrainingBatch buffers.
+   * A consumer takes the next batch by pop() (batches are delivered in the order of id),
+   * reads it in place, and returns the buffer by release().
+   * Blocks can be added at any time; a batch in preparation keeps the window at its start.
+   */
+  class BatchPrefetcher {
+  public:
+    explicit BatchPrefetcher(BatchPrefetcherConfig config=BatchPrefetcherConfig());
+    ~BatchPrefetcher();
+
+    /** add a block, or replace the oldest one when the window is full */
+    void add(CompactRecordBlock block);
+    /** number of records in the window */
+    size_t stored_records() const;
+    /** start background threads, no-op if already running */
+    void start();
+    /** stop background threads after the batches in preparation */
+    void stop();
+    /** wait for the next batch, a consumer should not hold all slots of the ring
+     * @return slot id of the ring, valid until release(slot)
+     */
+    int pop();
+    void release(int slot);
+    const TrainingBatch& batch(int slot) const { return ring.at(slot); }
+    const BatchPrefetcherConfig& config() const { return cfg; }
+  private:
+    typedef std::vector<std::shared_ptr<const CompactRecordBlock>> window_t;
+    enum SlotState : uint8_t { Free, Filling, Ready, InUse };
+    void work();
+    void fill(TrainingBatch& batch, const window_t& blocks, size_t records) const;
+
+    BatchPrefetcherConfig cfg;
+    std::vector<TrainingBatch> ring;
+    std::vector<SlotState> state;
+    window_t window;
+    size_t window_records = 0;
+    uint64_t seed;
+    uint64_t next_fill = 0, next_pop = 0;
+    bool running = false;
+    mutable std::mutex m;
+    std::condition_variable cv;
+    std::vector<std::thread> workers;
+  };
+}
+
+#endif
+// MINIOSL_BATCH_PREFETCHER_H
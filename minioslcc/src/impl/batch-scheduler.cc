@@ -0,0 +1,109 @@
+#include "impl/batch-scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+osl::BatchScheduler::BatchScheduler(InferenceModel& mo, std::vector<int> s, bool p, double occ)
+  : model(mo), sizes(std::move(s)), pad(p), min_occupancy(occ) {
+  std::ranges::sort(sizes);
+  sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+  if (sizes.empty() || sizes.front() < 1)
+    throw std::invalid_argument("BatchScheduler needs positive sizes");
+}
+
+osl::BatchScheduler::~BatchScheduler() {
+}
+
+std::vector<std::pair<int,int>> osl::BatchScheduler::plan(int n) const {
+  std::vector<std::pair<int,int>> ret;
+  while (n > 0) {
+    auto up = std::ranges::lower_bound(sizes, n);     // smallest size >= n
+    if (up != sizes.end() && *up == n) {
+      ret.emplace_back(n, n);
+      break;
+    }
+    if (up == sizes.begin()) {                         // n < every size
+      ret.emplace_back(n, pad ? *up : n);
+      break;
+    }
+    if (pad && up != sizes.end() && n >= min_occupancy * *up) {
+      ret.emplace_back(n, *up);
+      break;
+    }
+    const int down = *std::prev(up);                   // largest size < n
+    ret.emplace_back(down, down);
+    n -= down;
+  }
+  return ret;
+}
+
+void osl::BatchScheduler::run(std::vector<nn_input_element>& in, std::vector<policy_logits_t>& policy,
+                              std::vector<value_vector_t>& value, int n_real) {
+  const int size = value.size();
+  auto start = std::chrono::steady_clock::now();
+  model.batch_infer(in, policy, value);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::lock_guard<std::mutex> lock(m);
+  auto& s = table[size];
+  s.size = size;
+  ++s.calls;
+  s.positions += n_real;
+  s.padded += size - n_real;
+  s.seconds += elapsed.count();
+}
+
+void osl::BatchScheduler::batch_infer(std::vector<nn_input_element>& in,
+                                      std::vector<policy_logits_t>& policy_out,
+                                      std::vector<value_vector_t>& vout) {
+  const int N = in.size() / ml::input_unit;
+  const bool need_policy = ! policy_out.empty();
+  if (vout.size() != N || (need_policy && policy_out.size() != N))
+    throw std::invalid_argument("BatchScheduler::batch_infer size mismatch");
+  if (N == 0)
+    return;
+  const auto pieces = plan(N);
+  if (pieces.size() == 1 && pieces[0].second == N) {
+    run(in, policy_out, vout, N);
+    return;
+  }
+  int offset = 0;
+  for (auto [n, size]: pieces) {
+    piece_input.resize(size * ml::input_unit);
+    std::memcpy(&piece_input[0], &in[offset*ml::input_unit], n*ml::input_unit);
+    std::fill(piece_input.begin() + n*ml::input_unit, piece_input.end(), 0);
+    piece_policy.resize(need_policy ? size : 0);
+    piece_value.resize(size);
+    run(piece_input, piece_policy, piece_value, n);
+    if (need_policy)
+      std::copy_n(piece_policy.begin(), n, policy_out.begin() + offset);
+    std::copy_n(piece_value.begin(), n, vout.begin() + offset);
+    offset += n;
+  }
+}
+
+void osl::BatchScheduler::test_run(std::vector<nn_input_element>& /* in */,
+                                   std::vector<policy_logits_t>& /* policy_out */,
+                                   std::vector<value_vector_t>& /* vout */) {
+  for (int size: sizes) {
+    piece_input.assign(size * ml::input_unit, 0);
+    piece_policy.resize(size);
+    piece_value.resize(size);
+    model.test_run(piece_input, piece_policy, piece_value);
+  }
+}
+
+std::vector<osl::BatchSizeStats> osl::BatchScheduler::stats() const {
+  std::lock_guard<std::mutex> lock(m);
+  std::vector<BatchSizeStats> ret;
+  for (const auto& [size, s]: table)
+    ret.push_back(s);
+  return ret;
+}
+
+void osl::BatchScheduler::reset_stats() {
+  std::lock_guard<std::mutex> lock(m);
+  table.clear();
+}
@@ -0,0 +1,81 @@
+#ifndef MINIOSL_BATCH_SCHEDULER_H
+#define MINIOSL_BATCH_SCHEDULER_H
+
+#include "infer.h"
+#include <map>
+#include <mutex>
+
+namespace osl {
+  /** counters of BatchScheduler for a batch size actually sent to the model */
+  struct BatchSizeStats {
+    int size = 0;
+    uint64_t calls = 0;
+    /** positions requested, excluding padding */
+    uint64_t positions = 0;
+    /** zero-filled positions added to reach `size` */
+    uint64_t padded = 0;
+    /** total wall-clock time spent in `batch_infer` of the model */
+    double seconds = 0.0;
+    double occupancy() const { return positions + padded ? 1.0*positions/(positions + padded) : 0.0; }
+    double mean_latency_ms() const { return calls ? 1000.0*seconds/calls : 0.0; }
+    double positions_per_second() const { return seconds > 0 ? positions/seconds : 0.0; }
+  };
+
+  /**
+   * InferenceModel sending requests to `model` only in preferred batch sizes.
+   *
+   * A request of N positions is cut from the front into the largest preferred size not exceeding
+   * the rest.  The tail is padded with zero-filled positions up to the smallest preferred size
+   * covering it if the real positions fill at least `min_occupancy` of the batch,
+   * otherwise it is cut further, and a tail smaller than every preferred size is padded
+   * (or sent as is if `pad` is false).
+   * A request of exactly a preferred size is forwarded without copy.
+   * Merging requests of different callers is the role of ShmInferenceServer.
+   */
+  class BatchScheduler : public InferenceModel {
+  public:
+    /**
+     * @param sizes preferred batch sizes, e.g., the sizes a TensorRT engine is built for
+     * @param pad false to send tails as they are instead of padding
+     * @param min_occupancy ratio of real positions required to pad a tail to a larger size
+     */
+    BatchScheduler(InferenceModel& model, std::vector<int> sizes,
+                   bool pad=true, double min_occupancy=0.5);
+    ~BatchScheduler();
+
+    void batch_infer(std::vector<nn_input_element>& in,
+                     std::vector<policy_logits_t>& policy_out,
+                     std::vector<value_vector_t>& vout) override;
+    /** run every preferred size once by `model.test_run`, not counted in stats */
+    void test_run(std::vector<nn_input_element>& in,
+                  std::vector<policy_logits_t>& policy_out,
+                  std::vector<value_vector_t>& vout) override;
+
+    /**
+     * split `n` positions into batches
+     * @return pairs of (number of real positions, batch size)
+     */
+    std::vector<std::pair<int,int>> plan(int n) const;
+    /** counters for each batch size used so far, in ascending order of size */
+    std::vector<BatchSizeStats> stats() const;
+    void reset_stats();
+    const std::vector<int>& preferred_sizes() const { return sizes; }
+  private:
+    void run(std::vector<nn_input_element>& in, std::vector<policy_logits_t>& policy,
+             std::vector<value_vector_t>& value, int n_real);
+
+    InferenceModel& model;
+    std::vector<int> sizes;
+    bool pad;
+    double min_occupancy;
+    mutable std::mutex m;
+    std::map<int, BatchSizeStats> table;
+    // work area
+    std::vector<nn_input_element> piece_input;
+    std::vector<policy_logits_t> piece_policy;
+    std::vector<value_vector_t> piece_value;
+  };
+}
+
+#endif
+// MINIOSL_BATCH_SCHEDULER_H
@@ -1,5 +1,6 @@
 #include "bitpack.h"
 #include "feature.h"
+#include "impl/range-parallel.h"
 #include <algorithm>
 #include <iostream>
 #include <cmath>
@@ -288,55 +289,170 @@ int osl::bitpack::append_binary_record(const MiniRecord& record, std::vector<uin
   return out.size() - size_at_beginning;
 }
 
-int osl::bitpack::read_binary_record(const uint64_t *&in, MiniRecord& record) {
-  auto ptr_at_beginning = in;
-  uint64_t work = *in++;
-  int remain = 64;
-  auto retrieve = [&]() {
-    if (remain >= 12) {
-      auto value = work & (one_hot(12)-1); work >>= 12; remain -= 12;
-      return value;
-    }
-    uint64_t value = work;
-    work = *in++;
-    value += (work & (one_hot(12-remain)-1)) << remain;
-    work >>= 12-remain;
-    remain = 64 - 12 + remain;
-    return value;
-  };
-  uint16_t header = retrieve();
-  if (header == 0) {
-    // extended path for shogi 816k or other variants
-    int hi = retrieve(), lo = retrieve();
-    auto variant = (GameVariant)(1 + (hi >> 9));
-    std::optional<int> opt_id;
-    if (variant == Shogi816K) {
-      int id = (hi % 512) * 4096 + lo;
-      opt_id.emplace(id);
+namespace osl {
+  namespace bitpack {
+    namespace {
+      /** sequential reader of codes written by append_binary_record */
+      class Code12Reader {
+        const uint64_t *in;
+        uint64_t work;
+        int remain = 64;
+      public:
+        explicit Code12Reader(const uint64_t *ptr) : in(ptr+1), work(*ptr) {}
+        uint32_t next() {
+          if (remain >= 12) {
+            auto value = work & (one_hot(12)-1); work >>= 12; remain -= 12;
+            return value;
+          }
+          uint64_t value = work;
+          work = *in++;
+          value += (work & (one_hot(12-remain)-1)) << remain;
+          work >>= 12-remain;
+          remain = 64 - 12 + remain;
+          return value;
+        }
+        /** the next word to be loaded */
+        const uint64_t *position() const { return in; }
+      };
+      struct BinaryHeader {
+        GameVariant variant = HIRATE;
+        std::optional<int> shogi816k_id;
+        int length = 0;
+        GameResult result = InGame;
+        /** number of 12-bit codes including the header and the final move */
+        int codes() const {
+          return (variant == HIRATE ? 1 : 4) + length + (has_winner(result) ? 1 : 0);
+        }
+      };
+      BinaryHeader read_header(Code12Reader& reader) {
+        BinaryHeader ret;
+        uint16_t header = reader.next();
+        if (header == 0) {
+          // extended path for shogi 816k or other variants
+          int hi = reader.next(), lo = reader.next();
+          ret.variant = (GameVariant)(1 + (hi >> 9));
+          if (ret.variant == Shogi816K) {
+            int id = (hi % 512) * 4096 + lo;
+            ret.shogi816k_id.emplace(id);
+          }
+          header = reader.next();
+        }
+        // std::cerr << "header " << header << ' ' << std::bitset<12>(header) << '\n';
+        ret.length = header >> 2;
+        ret.result = GameResult(header & 3);
+        return ret;
+      }
+      /** the stored result with the draw_limit rule of MiniRecord::settle_repetition() (repetitions are not detected) */
+      GameResult settled_result(const BinaryHeader& header) {
+        if (header.result == InGame && header.length >= MiniRecord::draw_limit)
+          return Draw;
+        return header.result;
+      }
     }
-    record.set_initial_state(BaseState(variant, opt_id), variant, opt_id);
-    header = retrieve();
   }
-  else {
+}
+
+int osl::bitpack::read_binary_record(const uint64_t *&in, MiniRecord& record) {
+  Code12Reader reader(in);
+  auto header = read_header(reader);
+  if (header.variant == HIRATE)
     record.set_initial_state(BaseState(HIRATE));
-  }
-  // std::cerr << "header " << header << ' ' << std::bitset<12>(header) << '\n';
-  const int length = header >> 2;
-  record.moves.reserve(length);
-  record.result = GameResult(header & 3);
+  else
+    record.set_initial_state(BaseState(header.variant, header.shogi816k_id),
+                             header.variant, header.shogi816k_id);
+  record.moves.reserve(header.length);
+  record.result = header.result;
 
   EffectState state(record.initial_state);
-  for (int cnt=0; cnt < length; ++cnt) {
-    uint16_t code = retrieve();
+  for (int cnt=0; cnt < header.length; ++cnt) {
+    uint16_t code = reader.next();
     auto move = decode_move12(state, code);
     state.makeMove(move);
     record.append_move(move, state.inCheck());
   }
   if (record.has_winner())
-    record.final_move = decode_move12(state, retrieve());
+    record.final_move = decode_move12(state, reader.next());
 
   record.settle_repetition();
-  
-  return in - ptr_at_beginning;
+
+  const int n = reader.position() - in;
+  in = reader.position();
+  return n;
+}
+
+int osl::bitpack::read_binary_record(const uint64_t *&in, SubRecord& record) {
+  Code12Reader reader(in);
+  auto header = read_header(reader);
+  record.variant = header.variant;
+  record.shogi816k_id = header.shogi816k_id.value_or(0);
+  record.result = header.result;
+  record.final_move = Move::PASS(BLACK); // default of MiniRecord, as read_binary_record(MiniRecord)
+  record.moves.resize(header.length);
+
+  BaseState state = record.initial_state();
+  for (auto& move: record.moves) {
+    move = decode_move12(state, reader.next());
+    state.make_move_unsafe(move);
+  }
+  if (has_winner(header.result))
+    record.final_move = decode_move12(state, reader.next());
+  record.result = settled_result(header);
+
+  const int n = reader.position() - in;
+  in = reader.position();
+  return n;
+}
+
+int osl::bitpack::binary_record_words(const uint64_t *ptr) {
+  Code12Reader reader(ptr);
+  return (read_header(reader).codes()*12 + 63) / 64;
+}
+
+osl::bitpack::MoveArena
+osl::bitpack::read_binary_records_parallel(const uint64_t *ptr, size_t n_words, int threads) {
+  MoveArena arena;
+  // headers are sequential, with the offsets of both words and moves
+  std::vector<size_t> word_offsets;
+  for (size_t pos=0; pos<n_words;) {
+    Code12Reader reader(ptr+pos);
+    auto header = read_header(reader);
+    const size_t words = (header.codes()*12 + 63) / 64;
+    if (pos + words > n_words)
+      throw std::domain_error("read_binary_records_parallel truncated record at " + std::to_string(pos));
+    word_offsets.push_back(pos);
+    arena.offsets.push_back(arena.offsets.back() + header.length);
+    arena.variants.push_back(header.variant);
+    arena.shogi816k_ids.push_back(header.shogi816k_id.value_or(0));
+    arena.results.push_back(settled_result(header));
+    pos += words;
+  }
+  const size_t N = word_offsets.size();
+  arena.moves.resize(arena.offsets.back());
+  arena.final_moves.resize(N, Move::PASS(BLACK));
+
+  run_dynamic_parallel(N, [&](size_t k) {
+    Code12Reader reader(ptr+word_offsets[k]);
+    read_header(reader);
+    BaseState state = arena.variants[k] == Shogi816K
+      ? BaseState(Shogi816K, arena.shogi816k_ids[k]) : BaseState(arena.variants[k]);
+    for (size_t i=arena.offsets[k]; i<arena.offsets[k+1]; ++i) {
+      auto move = decode_move12(state, reader.next());
+      arena.moves[i] = move;
+      state.make_move_unsafe(move);
+    }
+    if (has_winner(arena.results[k]))
+      arena.final_moves[k] = decode_move12(state, reader.next());
+  }, threads, 256);
+  return arena;
+}
+
+osl::SubRecord osl::bitpack::MoveArena::record(size_t k) const {
+  SubRecord ret;
+  ret.moves.assign(moves.begin()+offsets.at(k), moves.begin()+offsets.at(k+1));
+  ret.variant = variants[k];
+  ret.shogi816k_id = shogi816k_ids[k];
+  ret.final_move = final_moves[k];
+  ret.result = results[k];
+  return ret;
 }
 
@@ -7,6 +7,7 @@
 
 namespace osl
 {
+  struct SubRecord;
   typedef __uint128_t uint128_t;
   namespace bitpack
   {
@@ -37,6 +38,34 @@ namespace osl
      * @return number of uint64s read
      */
     int read_binary_record(const uint64_t*& ptr, MiniRecord&);
+    /** read a record as read_binary_record() but moves only, replaying a BaseState
+     * without EffectState, hash, or repetition.
+     * An `InGame` result becomes `Draw` at MiniRecord::draw_limit as read_binary_record(),
+     * but repetitions are not detected, so that such a record (not written by a settled MiniRecord)
+     * remains `InGame` here while it is `Draw` by read_binary_record().
+     * @return number of uint64s read
+     */
+    int read_binary_record(const uint64_t*& ptr, SubRecord&);
+    /** number of uint64s of the record at `ptr`, reading its header only */
+    int binary_record_words(const uint64_t *ptr);
+
+    /** moves of many records in a single array, see read_binary_records_parallel() */
+    struct MoveArena {
+      std::vector<Move> moves;
+      /** moves of record `k` are in `[offsets[k], offsets[k+1])` */
+      std::vector<size_t> offsets = {0};
+      std::vector<GameVariant> variants;
+      std::vector<int32_t> shogi816k_ids;
+      std::vector<GameResult> results;
+      std::vector<Move> final_moves;
+
+      size_t size() const { return results.size(); }
+      SubRecord record(size_t k) const;
+    };
+    /** decode records written one after another in `n_words`, in parallel by `threads`
+     * (`range_parallel_threads` if 0, see run_dynamic_parallel) after a sequential scan of their headers
+     */
+    MoveArena read_binary_records_parallel(const uint64_t *ptr, size_t n_words, int threads=0);
     
     namespace detail {
       uint64_t combination_id(int first, int second);
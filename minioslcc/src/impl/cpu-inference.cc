@@ -0,0 +1,394 @@
+#include "impl/cpu-inference.h"
+#include "impl/details.h"
+#include "impl/range-parallel.h"
+#include <unordered_map>
+#include <fstream>
+#include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <cmath>
+#include <cstring>
+
+namespace osl {
+  namespace nn {
+#ifdef __AVX__
+    constexpr int simd_width = 8;
+#else
+    constexpr int simd_width = 4;     // sse2 or neon
+#endif
+    /** simd vector by gcc/clang extension */
+    typedef float vec_t __attribute__((vector_size(sizeof(float)*simd_width)));
+    inline vec_t load(const float *p) { vec_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+    inline void store(float *p, vec_t v) { std::memcpy(p, &v, sizeof(v)); }
+
+    /** MR x 16 block of C kept in registers over the whole K */
+    template <int MR>
+    void gemm_tile16(int N, int K, const float *A, const float *B, const float *bias, float *C) {
+      constexpr int NV = 16 / simd_width;
+      vec_t acc[MR][NV];
+#pragma GCC unroll 16
+      for (int r=0; r<MR; ++r)
+#pragma GCC unroll 4
+        for (int v=0; v<NV; ++v)
+          acc[r][v] = load(bias + v*simd_width);
+      for (int k=0; k<K; ++k) {
+        vec_t b[NV];
+#pragma GCC unroll 4
+        for (int v=0; v<NV; ++v)
+          b[v] = load(B + k*N + v*simd_width);
+#pragma GCC unroll 16
+        for (int r=0; r<MR; ++r) {
+          const float a = A[r*K + k];
+#pragma GCC unroll 4
+          for (int v=0; v<NV; ++v)
+            acc[r][v] += a * b[v];
+        }
+      }
+#pragma GCC unroll 16
+      for (int r=0; r<MR; ++r)
+#pragma GCC unroll 4
+        for (int v=0; v<NV; ++v)
+          store(C + r*N + v*simd_width, acc[r][v]);
+    }
+    /** a column of C for remainders */
+    void gemm_column(int M, int N, int K, const float *A, const float *B, float bias, float *C) {
+      for (int i=0; i<M; ++i) {
+        float sum = bias;
+        for (int k=0; k<K; ++k)
+          sum += A[i*K + k] * B[k*N];
+        C[i*N] = sum;
+      }
+    }
+  }
+}
+
+void osl::nn::gemm(int M, int N, int K, const float *A, const float *B, const float *bias, float *C) {
+  // for each panel of 16 columns, B[:, j:j+16] is reused for all rows of A
+  constexpr int MR = simd_width == 4 ? 3 : 4; // 16 registers in sse2
+  int j = 0;
+  for (; j+16 <= N; j += 16) {
+    int i = 0;
+    for (; i+MR <= M; i += MR)
+      gemm_tile16<MR>(N, K, A + i*K, B + j, bias + j, C + i*N + j);
+    for (; i < M; ++i)
+      gemm_tile16<1>(N, K, A + i*K, B + j, bias + j, C + i*N + j);
+  }
+  for (; j < N; ++j)
+    gemm_column(M, N, K, A, B + j, bias[j], C + j);
+}
+
+namespace osl {
+  namespace nn {
+    struct Workspace {
+      std::vector<float> x, a, b, c, t, u, col, pooled, hidden;
+      std::vector<float>& sized(std::vector<float>& v, size_t n) {
+        if (v.size() < n)
+          v.resize(n);
+        return v;
+      }
+    };
+
+    struct Tensor {
+      std::vector<int> shape;
+      std::vector<float> data;
+    };
+    typedef std::unordered_map<std::string, Tensor> tensor_map_t;
+
+    tensor_map_t read_tensors(const std::string& path) {
+      std::ifstream is(path, std::ios::binary);
+      if (! is)
+        throw std::runtime_error("CPUInferenceModel cannot open " + path);
+      char magic[8];
+      is.read(magic, 8);
+      if (! is || std::memcmp(magic, CPUInferenceModel::magic, 8) != 0)
+        throw std::runtime_error("CPUInferenceModel unknown format " + path);
+      auto read_u32 = [&]() {
+        uint32_t v;
+        is.read(reinterpret_cast<char*>(&v), sizeof(v));
+        if (! is)
+          throw std::runtime_error("CPUInferenceModel truncated " + path);
+        return v;
+      };
+      tensor_map_t ret;
+      const auto count = read_u32();
+      for (uint32_t i=0; i<count; ++i) {
+        std::string name(read_u32(), '\0');
+        is.read(name.data(), name.size());
+        Tensor t;
+        t.shape.resize(read_u32());
+        size_t size = 1;
+        for (auto& d: t.shape)
+          size *= (d = read_u32());
+        t.data.resize(size);
+        is.read(reinterpret_cast<char*>(t.data.data()), size*sizeof(float));
+        if (! is)
+          throw std::runtime_error("CPUInferenceModel truncated " + path);
+        ret[name] = std::move(t);
+      }
+      return ret;
+    }
+
+    const Tensor& get(const tensor_map_t& tensors, const std::string& name, size_t size) {
+      auto p = tensors.find(name);
+      if (p == tensors.end())
+        throw std::runtime_error("CPUInferenceModel missing " + name);
+      if (size && p->second.data.size() != size)
+        throw std::runtime_error("CPUInferenceModel size mismatch " + name);
+      return p->second;
+    }
+
+    /** `Conv2d` of network.py, i.e., convolution without bias followed by BatchNorm2d */
+    Dense make_conv(const tensor_map_t& tensors, const std::string& prefix) {
+      const auto& w = get(tensors, prefix + ".conv.weight", 0); // [out][in][kh][kw]
+      if (w.shape.size() != 4)
+        throw std::runtime_error("CPUInferenceModel unexpected shape " + prefix);
+      const int out = w.shape[0], in = w.shape[1], taps = w.shape[2]*w.shape[3];
+      const auto& gamma = get(tensors, prefix + ".bn.weight", out).data;
+      const auto& beta = get(tensors, prefix + ".bn.bias", out).data;
+      const auto& mean = get(tensors, prefix + ".bn.running_mean", out).data;
+      const auto& var = get(tensors, prefix + ".bn.running_var", out).data;
+      constexpr float eps = 1e-3;
+      Dense ret;
+      ret.in = in*taps;
+      ret.out = out;
+      ret.weight.resize(ret.in*out);
+      ret.bias.resize(out);
+      for (int o=0; o<out; ++o) {
+        const float scale = gamma[o] / std::sqrt(var[o] + eps);
+        ret.bias[o] = beta[o] - mean[o]*scale;
+        for (int i=0; i<in; ++i)
+          for (int t=0; t<taps; ++t)
+            ret.weight[(t*in + i)*out + o] = w.data[(o*in + i)*taps + t] * scale;
+      }
+      return ret;
+    }
+
+    Dense make_linear(const tensor_map_t& tensors, const std::string& prefix) {
+      const auto& w = get(tensors, prefix + ".weight", 0); // [out][in]
+      if (w.shape.size() != 2)
+        throw std::runtime_error("CPUInferenceModel unexpected shape " + prefix);
+      Dense ret;
+      ret.out = w.shape[0];
+      ret.in = w.shape[1];
+      ret.bias = get(tensors, prefix + ".bias", ret.out).data;
+      ret.weight.resize(ret.in*ret.out);
+      for (int o=0; o<ret.out; ++o)
+        for (int i=0; i<ret.in; ++i)
+          ret.weight[i*ret.out + o] = w.data[o*ret.in + i];
+      return ret;
+    }
+
+    void apply(const Dense& layer, int rows, const float *in, float *out) {
+      gemm(rows, layer.out, layer.in, in, layer.weight.data(), layer.bias.data(), out);
+    }
+    void relu(float *x, size_t n) {
+      for (size_t i=0; i<n; ++i)
+        x[i] = std::max(x[i], 0.0f);
+    }
+    float silu(float x) {
+      return x / (1.0f + std::exp(-x));
+    }
+
+    /** 3x3 receptive fields with zero padding, [sample][square][tap][channel] */
+    void im2col3x3(const float *src, int n, int channels, float *dst) {
+      for (int s=0; s<n; ++s)
+        for (int y=0; y<9; ++y)
+          for (int x=0; x<9; ++x) {
+            float *row = dst + ((s*81 + y*9 + x)*9)*channels;
+            for (int dy=0; dy<3; ++dy)
+              for (int dx=0; dx<3; ++dx) {
+                float *cell = row + (dy*3 + dx)*channels;
+                const int yy = y + dy - 1, xx = x + dx - 1;
+                if (yy < 0 || yy >= 9 || xx < 0 || xx >= 9)
+                  std::fill(cell, cell + channels, 0.0f);
+                else
+                  std::copy_n(src + (s*81 + yy*9 + xx)*channels, channels, cell);
+              }
+          }
+    }
+    /** 9x1 receptive fields (columns on the board), [sample][x][y][channel] */
+    void im2col9x1(const float *src, int n, int channels, float *dst) {
+      for (int s=0; s<n; ++s)
+        for (int x=0; x<9; ++x)
+          for (int y=0; y<9; ++y)
+            std::copy_n(src + (s*81 + y*9 + x)*channels, channels,
+                        dst + ((s*9 + x)*9 + y)*channels);
+    }
+  }
+}
+
+osl::CPUInferenceModel::CPUInferenceModel(const std::string& path, int c, int t)
+  : chunk(c), n_threads(t > 0 ? t : range_parallel_threads) {
+  if (chunk < 1)
+    throw std::invalid_argument("CPUInferenceModel chunk " + std::to_string(chunk));
+  auto tensors = nn::read_tensors(path);
+  conv1 = nn::make_conv(tensors, "body.conv1");
+  if (conv1.in != ml::input_channels*9)
+    throw std::runtime_error("CPUInferenceModel input channels " + std::to_string(conv1.in/9));
+  for (int i=0; ; ++i) {
+    const std::string prefix = "body.body." + std::to_string(i);
+    Block block;
+    if (tensors.contains(prefix + ".convin.conv.weight")) {
+      block.convin = nn::make_conv(tensors, prefix + ".convin");
+      block.conv1a = nn::make_conv(tensors, prefix + ".block1.0");
+      block.conv1b = nn::make_conv(tensors, prefix + ".block1.2");
+      block.conv2a = nn::make_conv(tensors, prefix + ".block2.0");
+      block.conv2b = nn::make_conv(tensors, prefix + ".block2.2");
+      block.convout = nn::make_conv(tensors, prefix + ".convout");
+      block.file = nn::make_conv(tensors, prefix + ".conv_filea");
+    }
+    else if (tensors.contains(prefix + ".block.linear.weight")) {
+      block.pool = true;
+      block.pool_a = nn::make_conv(tensors, prefix + ".block.conv1x1a");
+      block.pool_b = nn::make_conv(tensors, prefix + ".block.conv1x1b");
+      block.pool_out = nn::make_conv(tensors, prefix + ".block.conv1x1out");
+      block.pool_linear = nn::make_linear(tensors, prefix + ".block.linear");
+    }
+    else
+      break;
+    blocks.push_back(std::move(block));
+  }
+  policy1 = nn::make_conv(tensors, "head.head.0");
+  policy2 = nn::make_conv(tensors, "head.head.2");
+  if (policy2.out*81 != ml::policy_unit)
+    throw std::runtime_error("CPUInferenceModel policy channels " + std::to_string(policy2.out));
+  value_conv = nn::make_conv(tensors, "value_head.head.0");
+  value_fc1 = nn::make_linear(tensors, "value_head.head.3");
+  value_fc2 = nn::make_linear(tensors, "value_head.head.5");
+  if (value_conv.out != 1 || value_fc1.in != 81
+      || value_fc2.out != std::tuple_size_v<value_vector_t>)
+    throw std::runtime_error("CPUInferenceModel unexpected value head");
+}
+
+osl::CPUInferenceModel::~CPUInferenceModel() {
+}
+
+void osl::CPUInferenceModel::forward(const nn_input_element *in, int n,
+                                     policy_logits_t *policy, value_vector_t *value,
+                                     nn::Workspace& work) const {
+  using namespace nn;
+  const int P = n*81, C = channels(), C0 = ml::input_channels;
+  float *x = work.sized(work.x, P*C).data();
+  // input, from [channel][square] to [square][channel]
+  {
+    float *t = work.sized(work.t, P*C0).data();
+    for (int s=0; s<n; ++s)
+      for (int ch=0; ch<C0; ++ch)
+        for (int sq=0; sq<81; ++sq)
+          t[(s*81 + sq)*C0 + ch] = ml::to_float(in[(s*C0 + ch)*81 + sq]);
+    float *col = work.sized(work.col, P*9*C0).data();
+    im2col3x3(t, n, C0, col);
+    apply(conv1, P, col, x);
+    relu(x, P*C);
+  }
+  for (const auto& block: blocks) {
+    float *a = work.sized(work.a, P*C).data(), *b = work.sized(work.b, P*C).data(),
+      *c = work.sized(work.c, P*C).data(), *t = work.sized(work.t, P*C).data();
+    if (block.pool) {
+      apply(block.pool_a, P, x, a);
+      relu(a, P*C);
+      apply(block.pool_b, P, x, b);
+      relu(b, P*C);
+      float *pooled = work.sized(work.pooled, n*2*C).data(),
+        *bias = work.sized(work.hidden, n*C).data();
+      for (int s=0; s<n; ++s)
+        for (int ch=0; ch<C; ++ch) {
+          float max = b[(s*81)*C + ch], sum = 0;
+          for (int sq=0; sq<81; ++sq) {
+            max = std::max(max, b[(s*81 + sq)*C + ch]);
+            sum += b[(s*81 + sq)*C + ch];
+          }
+          pooled[s*2*C + ch] = max;
+          pooled[s*2*C + C + ch] = sum / 81;
+        }
+      apply(block.pool_linear, n, pooled, bias);
+      for (int s=0; s<n; ++s)
+        for (int sq=0; sq<81; ++sq)
+          for (int ch=0; ch<C; ++ch)
+            a[(s*81 + sq)*C + ch] += bias[s*C + ch];
+      apply(block.pool_out, P, a, t);
+    }
+    else {
+      const int B = block.convin.out;
+      float *col = work.sized(work.col, P*9*B).data(), *u = work.sized(work.u, P*B).data();
+      apply(block.convin, P, x, a);
+      relu(a, P*B);
+      im2col3x3(a, n, B, col);
+      apply(block.conv1a, P, col, u);
+      relu(u, P*B);
+      im2col3x3(u, n, B, col);
+      apply(block.conv1b, P, col, b);
+      for (int i=0; i<P*B; ++i)
+        c[i] = silu(a[i] + b[i]);
+      im2col3x3(c, n, B, col);
+      apply(block.conv2a, P, col, u);
+      relu(u, P*B);
+      im2col3x3(u, n, B, col);
+      apply(block.conv2b, P, col, b);
+      // files: [sample][x][channel], broadcast along y
+      im2col9x1(a, n, B, col);
+      apply(block.file, n*9, col, u);
+      for (int s=0; s<n; ++s)
+        for (int y=0; y<9; ++y)
+          for (int xx=0; xx<9; ++xx)
+            for (int ch=0; ch<B; ++ch) {
+              const int i = (s*81 + y*9 + xx)*B + ch;
+              c[i] = silu(c[i] + b[i] + u[(s*9 + xx)*B + ch]);
+            }
+      apply(block.convout, P, c, t);
+    }
+    for (int i=0; i<P*C; ++i)
+      x[i] = silu(x[i] + t[i]);
+  }
+  // heads
+  float *a = work.sized(work.a, P*C).data(), *t = work.sized(work.t, P*C).data();
+  if (policy) {
+    apply(policy1, P, x, a);
+    relu(a, P*C);
+    apply(policy2, P, a, t);
+    const int O = policy2.out;
+    for (int s=0; s<n; ++s)
+      for (int sq=0; sq<81; ++sq)
+        for (int o=0; o<O; ++o)
+          policy[s][o*81 + sq] = t[(s*81 + sq)*O + o];
+  }
+  apply(value_conv, P, x, a);
+  relu(a, P);
+  float *hidden = work.sized(work.hidden, n*value_fc1.out).data();
+  apply(value_fc1, n, a, hidden);
+  relu(hidden, n*value_fc1.out);
+  apply(value_fc2, n, hidden, t);
+  for (int s=0; s<n; ++s)
+    for (int i=0; i<value_fc2.out; ++i)
+      value[s][i] = std::tanh(t[s*value_fc2.out + i]);
+}
+
+void osl::CPUInferenceModel::batch_infer(std::vector<nn_input_element>& in,
+                                         std::vector<policy_logits_t>& policy_out,
+                                         std::vector<value_vector_t>& vout) {
+  const int N = in.size() / ml::input_unit;
+  const bool need_policy = ! policy_out.empty();
+  if (vout.size() != N || (need_policy && policy_out.size() != N))
+    throw std::invalid_argument("CPUInferenceModel::batch_infer size mismatch");
+  const int n_chunks = (N + chunk - 1) / chunk;
+  std::atomic<int> next = 0;
+  auto work = [&]() {
+    nn::Workspace workspace;
+    for (int k; (k = next++) < n_chunks; ) {
+      const int l = k*chunk, r = std::min(l + chunk, N);
+      forward(&in[l*ml::input_unit], r - l, need_policy ? &policy_out[l] : nullptr, &vout[l],
+              workspace);
+    }
+  };
+  const int n_workers = std::min(n_threads, n_chunks);
+  if (n_workers <= 1) {
+    work();
+    return;
+  }
+  std::vector<std::thread> workers;
+  workers.reserve(n_workers);
+  for (int i=0; i<n_workers; ++i)
+    workers.emplace_back(work);
+  for (auto& w: workers)
+    w.join();
+}
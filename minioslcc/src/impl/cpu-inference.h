@@ -0,0 +1,68 @@
+#ifndef MINIOSL_CPU_INFERENCE_H
+#define MINIOSL_CPU_INFERENCE_H
+
+#include "infer.h"
+#include <string>
+#include <vector>
+
+namespace osl {
+  namespace nn {
+    /**
+     * convolution or linear layer with batch normalization folded.
+     * `weight` is in [k][out] order, where k enumerates taps and input channels of a receptive field.
+     */
+    struct Dense {
+      int in = 0, out = 0;
+      std::vector<float> weight, bias;
+    };
+    /** C[m][n] = A[m][k] B[k][n] + bias[n], row major */
+    void gemm(int M, int N, int K, const float *A, const float *B, const float *bias, float *C);
+    struct Workspace;
+  }
+
+  /**
+   * `PVNetwork` in miniosl/network.py evaluated on CPU, without python nor torch.
+   *
+   * The weights are loaded from a file made by `miniosl.inference.export_native`,
+   * a sequence of named float32 tensors of `state_dict()`.
+   * Batch normalization is folded into the preceding convolution at loading.
+   * Activations are kept in channels-last order so that each convolution is a single gemm,
+   * and a batch is split into chunks processed in parallel.
+   * The aux head of StandardNetwork is ignored.
+   */
+  class CPUInferenceModel : public InferenceModel {
+  public:
+    /**
+     * @param chunk number of positions processed at once by a thread
+     * @param n_threads 0 to follow `range_parallel_threads`
+     */
+    explicit CPUInferenceModel(const std::string& path, int chunk=8, int n_threads=0);
+    ~CPUInferenceModel();
+    void batch_infer(std::vector<nn_input_element>& in,
+                     std::vector<policy_logits_t>& policy_out,
+                     std::vector<value_vector_t>& vout) override;
+
+    int channels() const { return conv1.out; }
+    int n_blocks() const { return blocks.size(); }
+    int value_hidden() const { return value_fc1.out; }
+
+    static constexpr char magic[9] = "MOSLNN01";
+  private:
+    struct Block {
+      /** ResBlockAlt(PoolBias) if true, otherwise KatagoBlock */
+      bool pool = false;
+      nn::Dense convin, conv1a, conv1b, conv2a, conv2b, convout, file;
+      nn::Dense pool_a, pool_b, pool_out, pool_linear;
+    };
+    void forward(const nn_input_element *in, int n, policy_logits_t *policy, value_vector_t *value,
+                 nn::Workspace& work) const;
+
+    nn::Dense conv1;
+    std::vector<Block> blocks;
+    nn::Dense policy1, policy2, value_conv, value_fc1, value_fc2;
+    int chunk, n_threads;
+  };
+}
+
+#endif
+// MINIOSL_CPU_INFERENCE_H
@@ -0,0 +1,169 @@
+#include "impl/evalcache.h"
+#include "impl/details.h"
+#include "impl/range-parallel.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+osl::EvalCache::EvalCache(size_t capacity, int n_shards) {
+  if (n_shards < 1 || capacity < n_shards)
+    throw std::invalid_argument("EvalCache capacity " + std::to_string(capacity)
+                                + " shards " + std::to_string(n_shards));
+  shard_capacity = capacity / n_shards;
+  shards.reserve(n_shards);
+  for (int i=0; i<n_shards; ++i) {
+    shards.emplace_back(new Shard);
+    shards.back()->table.reserve(shard_capacity);
+  }
+}
+
+osl::EvalCache::~EvalCache() {
+}
+
+osl::EvalCache::Key osl::EvalCache::make_key(const nn_input_element *features) {
+  static_assert(ml::input_unit % sizeof(uint64_t) == 0);
+  // two lanes of multiply-xorshift, enough to identify input planes in practice
+  uint64_t lo = 0x243f6a8885a308d3ull, hi = 0x13198a2e03707344ull;
+  for (size_t i=0; i<ml::input_unit; i+=sizeof(uint64_t)) {
+    uint64_t w;
+    std::memcpy(&w, features + i, sizeof(w));
+    lo = (lo ^ w) * 0x9e3779b97f4a7c15ull;
+    lo ^= lo >> 29;
+    hi = (hi + w) * 0xbf58476d1ce4e5b9ull;
+    hi ^= hi >> 31;
+  }
+  return {lo, hi};
+}
+
+bool osl::EvalCache::lookup(const Key& key, policy_logits_t *policy, value_vector_t& value) {
+  ++lookups;
+  auto& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.m);
+  auto p = s.table.find(key.lo);
+  if (p == s.table.end() || p->second->key != key || (policy && ! p->second->has_policy))
+    return false;
+  s.lru.splice(s.lru.begin(), s.lru, p->second);
+  value = p->second->value;
+  if (policy)
+    *policy = p->second->policy;
+  ++hits;
+  return true;
+}
+
+void osl::EvalCache::insert(const Key& key, const policy_logits_t *policy, const value_vector_t& value) {
+  auto& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.m);
+  auto p = s.table.find(key.lo);
+  if (p != s.table.end()) {
+    // overwrite, possibly with policy
+    auto& e = *p->second;
+    if (policy || e.key != key) {
+      e.has_policy = (bool)policy;
+      if (policy)
+        e.policy = *policy;
+    }
+    e.key = key;
+    e.value = value;
+    s.lru.splice(s.lru.begin(), s.lru, p->second);
+    return;
+  }
+  ++inserts;
+  if (s.lru.size() >= shard_capacity) {
+    // reuse the least recently used entry
+    ++evictions;
+    s.table.erase(s.lru.back().key.lo);
+    s.lru.splice(s.lru.begin(), s.lru, std::prev(s.lru.end()));
+  }
+  else
+    s.lru.emplace_front();
+  auto& e = s.lru.front();
+  e.key = key;
+  e.has_policy = (bool)policy;
+  e.value = value;
+  if (policy)
+    e.policy = *policy;
+  s.table[key.lo] = s.lru.begin();
+}
+
+void osl::EvalCache::batch_infer(InferenceModel& model,
+                                 std::vector<nn_input_element>& in,
+                                 std::vector<policy_logits_t>& policy_out,
+                                 std::vector<value_vector_t>& vout) {
+  const int N = in.size() / ml::input_unit;
+  const bool need_policy = ! policy_out.empty();
+  if (vout.size() != N || (need_policy && policy_out.size() != N))
+    throw std::invalid_argument("EvalCache::batch_infer size mismatch");
+  keys.resize(N);
+  source.resize(N);
+  // (1) lookup
+  auto run = [&](int l, int r) {
+    for (int i=l; i<r; ++i) {
+      keys[i] = make_key(&in[i*ml::input_unit]);
+      bool hit = lookup(keys[i], need_policy ? &policy_out[i] : nullptr, vout[i]);
+      source[i] = hit ? -1 : i;
+    }
+  };
+  run_range_parallel(N, run);
+  // (2) merge identical requests, e.g., duplicated root children
+  requests.clear();
+  std::unordered_map<uint64_t, int> first_request;
+  for (int i=0; i<N; ++i) {
+    if (source[i] < 0)
+      continue;
+    auto [p, fresh] = first_request.try_emplace(keys[i].lo, requests.size());
+    if (fresh || keys[requests[p->second]] != keys[i]) {
+      source[i] = requests.size();
+      requests.push_back(i);
+    }
+    else {
+      source[i] = p->second;
+      ++batch_duplicates;
+    }
+  }
+  if (requests.empty())
+    return;
+  // (3) inference for the rest
+  const int M = requests.size();
+  miss_input.resize(M * ml::input_unit);
+  miss_policy.resize(need_policy ? M : 0);
+  miss_value.resize(M);
+  for (int j=0; j<M; ++j)
+    std::copy_n(&in[requests[j]*ml::input_unit], ml::input_unit, &miss_input[j*ml::input_unit]);
+  model.batch_infer(miss_input, miss_policy, miss_value);
+  // (4) scatter
+  for (int i=0; i<N; ++i) {
+    if (source[i] < 0)
+      continue;
+    const int j = source[i];
+    vout[i] = miss_value[j];
+    if (need_policy)
+      policy_out[i] = miss_policy[j];
+  }
+  auto store = [&](int l, int r) {
+    for (int j=l; j<r; ++j)
+      insert(keys[requests[j]], need_policy ? &miss_policy[j] : nullptr, miss_value[j]);
+  };
+  run_range_parallel(M, store);
+}
+
+osl::EvalCacheStats osl::EvalCache::stats() const {
+  return { lookups, hits, inserts, evictions, batch_duplicates };
+}
+
+void osl::EvalCache::clear() {
+  for (auto& s: shards) {
+    std::lock_guard<std::mutex> lock(s->m);
+    s->lru.clear();
+    s->table.clear();
+  }
+  lookups = hits = inserts = evictions = batch_duplicates = 0;
+}
+
+size_t osl::EvalCache::size() const {
+  size_t ret = 0;
+  for (auto& s: shards) {
+    std::lock_guard<std::mutex> lock(s->m);
+    ret += s->lru.size();
+  }
+  return ret;
+}
@@ -0,0 +1,88 @@
+#ifndef MINIOSL_EVALCACHE_H
+#define MINIOSL_EVALCACHE_H
+
+#include "infer.h"
+#include <unordered_map>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+namespace osl {
+  /** counters of EvalCache */
+  struct EvalCacheStats {
+    uint64_t lookups = 0, hits = 0, inserts = 0, evictions = 0;
+    /** requests merged with an identical request in the same batch */
+    uint64_t batch_duplicates = 0;
+    double hit_rate() const { return lookups ? 1.0*hits/lookups : 0.0; }
+  };
+
+  /**
+   * bounded cache of inference results shared by the games in GameArray.
+   *
+   * The key is a 128bit digest of the input planes, which are a function of the current state
+   * and the last `ml::history_length` moves.
+   * Entries are distributed to independently locked shards, each with LRU replacement.
+   */
+  class EvalCache {
+  public:
+    struct Key {
+      uint64_t lo, hi;
+      friend bool operator==(const Key&, const Key&) = default;
+    };
+    /** @param capacity maximum number of entries in total */
+    explicit EvalCache(size_t capacity, int n_shards=16);
+    ~EvalCache();
+
+    static Key make_key(const nn_input_element *features);
+    /** copy the cached result if available
+     * @param policy nullptr if only value is needed
+     */
+    bool lookup(const Key& key, policy_logits_t *policy, value_vector_t& value);
+    /** @param policy nullptr if not available */
+    void insert(const Key& key, const policy_logits_t *policy, const value_vector_t& value);
+
+    /**
+     * inference through the cache.
+     * cache hits and duplicates in the batch are removed before calling `model.batch_infer`,
+     * and the results are scattered back afterwards.
+     * @param policy_out empty if only value is needed, similar to `InferenceModel::batch_infer`
+     */
+    void batch_infer(InferenceModel& model,
+                     std::vector<nn_input_element>& in,
+                     std::vector<policy_logits_t>& policy_out,
+                     std::vector<value_vector_t>& vout);
+
+    EvalCacheStats stats() const;
+    void clear();
+    size_t size() const;
+    size_t capacity() const { return shard_capacity * shards.size(); }
+  private:
+    struct Entry {
+      Key key;
+      bool has_policy;
+      value_vector_t value;
+      policy_logits_t policy;
+    };
+    struct Shard {
+      std::mutex m;
+      std::list<Entry> lru;     // front is the most recent
+      std::unordered_map<uint64_t, std::list<Entry>::iterator> table;
+    };
+    Shard& shard(const Key& key) { return *shards[key.hi % shards.size()]; }
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shard_capacity;
+    std::atomic<uint64_t> lookups = 0, hits = 0, inserts = 0, evictions = 0, batch_duplicates = 0;
+    // work area for batch_infer
+    std::vector<Key> keys;
+    std::vector<int> source;    // index of the request to be inferred or -1 if hit
+    std::vector<int> requests;
+    std::vector<nn_input_element> miss_input;
+    std::vector<policy_logits_t> miss_policy;
+    std::vector<value_vector_t> miss_value;
+  };
+}
+
+#endif
+// MINIOSL_EVALCACHE_H
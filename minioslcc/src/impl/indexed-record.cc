@@ -0,0 +1,132 @@
+#include "impl/indexed-record.h"
+#include "impl/bitpack.h"
+#include <iostream>
+
+osl::IndexedRecordWriter::IndexedRecordWriter(std::string p) : path(p) {
+  os.open(path, std::ios::binary);
+  if (! os)
+    throw std::runtime_error("IndexedRecordWriter cannot open " + path);
+  const uint64_t header[indexed_record::header_words] = { 0 }; // filled by close()
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+osl::IndexedRecordWriter::~IndexedRecordWriter() {
+  try {
+    close();
+  }
+  catch (std::exception& e) {
+    std::cerr << "~IndexedRecordWriter " << e.what() << '\n';
+  }
+}
+
+void osl::IndexedRecordWriter::add(MiniRecord&& record) {
+  add(static_cast<const MiniRecord&>(record));
+}
+
+void osl::IndexedRecordWriter::add(const MiniRecord& record) {
+  std::lock_guard<std::mutex> lock(m);
+  if (! os.is_open())
+    throw std::logic_error("IndexedRecordWriter already closed");
+  work.clear();
+  try {
+    if (! bitpack::append_binary_record(record, work)) {
+      ++skipped;                // empty record
+      return;
+    }
+  }
+  catch (std::domain_error&) {
+    ++skipped;
+    return;
+  }
+  os.write(reinterpret_cast<const char*>(work.data()), work.size()*sizeof(uint64_t));
+  index.push_back({offset, uint16_t(work.size()), uint16_t(record.moves.size()),
+                   uint8_t(record.result), uint8_t(record.variant), 0});
+  offset += work.size();
+}
+
+void osl::IndexedRecordWriter::flush() {
+  std::lock_guard<std::mutex> lock(m);
+  os.flush();
+  if (! os)
+    throw std::runtime_error("IndexedRecordWriter write error " + path);
+}
+
+void osl::IndexedRecordWriter::close() {
+  std::lock_guard<std::mutex> lock(m);
+  if (! os.is_open())
+    return;
+  os.write(reinterpret_cast<const char*>(index.data()), index.size()*sizeof(indexed_record::Entry));
+  const uint64_t header[indexed_record::header_words] = {
+    indexed_record::magic, indexed_record::version, index.size(), offset
+  };
+  os.seekp(0);
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+  os.close();
+  if (! os)
+    throw std::runtime_error("IndexedRecordWriter write error " + path);
+}
+
+size_t osl::IndexedRecordWriter::n_written() const {
+  std::lock_guard<std::mutex> lock(m);
+  return index.size();
+}
+
+size_t osl::IndexedRecordWriter::n_skipped() const {
+  std::lock_guard<std::mutex> lock(m);
+  return skipped;
+}
+
+osl::IndexedRecordFile::IndexedRecordFile(const std::string& path) : file(path, false) {
+  const size_t n_words = file.size() / sizeof(uint64_t);
+  const uint64_t *header = file.words();
+  if (n_words < indexed_record::header_words || header[0] != indexed_record::magic)
+    throw std::domain_error("IndexedRecordFile not an indexed record file " + path);
+  if (header[1] != indexed_record::version)
+    throw std::domain_error("IndexedRecordFile unsupported version " + std::to_string(header[1]));
+  n_records = header[2];
+  index_offset = header[3];
+  // in the form of division not to overflow by a broken header
+  if (index_offset < indexed_record::header_words || index_offset > n_words
+      || n_records > (n_words - index_offset) * sizeof(uint64_t) / sizeof(indexed_record::Entry))
+    throw std::domain_error("IndexedRecordFile broken index " + path);
+  index = reinterpret_cast<const indexed_record::Entry*>(header + index_offset);
+}
+
+osl::IndexedRecordFile::~IndexedRecordFile() {
+}
+
+const osl::indexed_record::Entry& osl::IndexedRecordFile::entry(size_t k) const {
+  if (k >= n_records)
+    throw std::out_of_range("IndexedRecordFile " + std::to_string(k));
+  const auto& e = index[k];
+  if (e.offset < indexed_record::header_words || e.words == 0
+      || e.offset > index_offset || e.words > index_offset - e.offset)
+    throw std::domain_error("IndexedRecordFile broken entry " + std::to_string(k));
+  return e;
+}
+
+const uint64_t *osl::IndexedRecordFile::record_words(size_t k) const {
+  const auto& e = entry(k);
+  const uint64_t *ptr = file.words() + e.offset;
+  if (bitpack::binary_record_words(ptr) != e.words)
+    throw std::domain_error("IndexedRecordFile inconsistent entry " + std::to_string(k));
+  return ptr;
+}
+
+osl::MiniRecord osl::IndexedRecordFile::record(size_t k) const {
+  const uint64_t *ptr = record_words(k);
+  MiniRecord record;
+  bitpack::read_binary_record(ptr, record);
+  return record;
+}
+
+osl::SubRecord osl::IndexedRecordFile::sub_record(size_t k) const {
+  const uint64_t *ptr = record_words(k);
+  SubRecord record;
+  bitpack::read_binary_record(ptr, record);
+  return record;
+}
+
+std::vector<osl::Move> osl::IndexedRecordFile::moves(size_t k) const {
+  return sub_record(k).moves;
+}
@@ -0,0 +1,91 @@
+#ifndef MINIOSL_INDEXED_RECORD_H
+#define MINIOSL_INDEXED_RECORD_H
+
+#include "impl/record-writer.h"
+#include "feature.h"
+#include "impl/mapped-file.h"
+
+namespace osl {
+  /**
+   * file of bitpack binary records with an index for random access.
+   *
+   * Layout in uint64_t words:
+   * - header: magic, version, number of records, word offset of the index
+   * - records: each in `bitpack::append_binary_record` format, one after another
+   * - index: an Entry for each record
+   */
+  namespace indexed_record {
+    constexpr uint64_t magic = 0x315844494c534f4dull; // "MOSLIDX1" in little endian
+    constexpr uint64_t version = 1;
+    constexpr int header_words = 4;
+    struct Entry {
+      /** word offset of the record from the head of file */
+      uint64_t offset;
+      uint16_t words, moves;
+      uint8_t result, variant;
+      uint16_t reserved;
+    };
+    static_assert(sizeof(Entry) == 16);
+  }
+
+  /** write records to a file with an index, see `indexed_record`
+   *
+   * The index is kept in memory and written by close(), records are appended as they are added.
+   */
+  class IndexedRecordWriter : public GameRecordSink {
+  public:
+    explicit IndexedRecordWriter(std::string path);
+    /** close() unless closed, errors are reported to std::cerr */
+    ~IndexedRecordWriter();
+    /** append a record, thread-safe.  Records not supported by the bitpack format are skipped. */
+    void add(MiniRecord&& record) override;
+    void add(const MiniRecord& record);
+    void flush() override;
+    /** write the index and header, no records can be added afterwards */
+    void close();
+
+    size_t n_written() const;
+    size_t n_skipped() const;
+  private:
+    const std::string path;
+    mutable std::mutex m;
+    std::ofstream os;
+    std::vector<indexed_record::Entry> index;
+    std::vector<uint64_t> work;
+    uint64_t offset = indexed_record::header_words;
+    size_t skipped = 0;
+  };
+
+  /**
+   * memory-mapped reader of a file written by IndexedRecordWriter.
+   * Each accessor decodes only the record asked, and result(k) and move_size(k) read the index only.
+   */
+  class IndexedRecordFile {
+  public:
+    explicit IndexedRecordFile(const std::string& path);
+    ~IndexedRecordFile();
+
+    size_t size() const { return n_records; }
+    GameResult result(size_t k) const { return GameResult(entry(k).result); }
+    GameVariant variant(size_t k) const { return GameVariant(entry(k).variant); }
+    int move_size(size_t k) const { return entry(k).moves; }
+    /** moves of record `k` */
+    std::vector<Move> moves(size_t k) const;
+    /** decode record `k` with its history */
+    MiniRecord record(size_t k) const;
+    /** decode record `k` without history, lighter than record() */
+    SubRecord sub_record(size_t k) const;
+  private:
+    /** @throw std::domain_error if the entry points outside of the records */
+    const indexed_record::Entry& entry(size_t k) const;
+    const uint64_t *record_words(size_t k) const;
+
+    MappedFile file;
+    const indexed_record::Entry *index = nullptr;
+    size_t n_records = 0;
+    uint64_t index_offset = 0;
+  };
+}
+
+#endif
+// MINIOSL_INDEXED_RECORD_H
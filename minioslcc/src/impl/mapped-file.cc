@@ -0,0 +1,29 @@
+#include "impl/mapped-file.h"
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+osl::MappedFile::MappedFile(const std::string& path, bool sequential) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::domain_error("file not found"+path);
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    length = st.st_size;
+    void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("mmap failed "+path);
+    }
+    ::madvise(p, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    ptr = static_cast<const char*>(p);
+  }
+  ::close(fd);
+}
+
+osl::MappedFile::~MappedFile() {
+  if (ptr)
+    ::munmap(const_cast<char*>(ptr), length);
+}
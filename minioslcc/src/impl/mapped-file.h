@@ -0,0 +1,29 @@
+#ifndef MINIOSL_MAPPED_FILE_H
+#define MINIOSL_MAPPED_FILE_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace osl {
+  /** read-only mapping of a whole file */
+  class MappedFile {
+  public:
+    /** @param sequential hint for the access pattern, random access otherwise */
+    explicit MappedFile(const std::string& path, bool sequential=true);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view view() const { return {ptr, length}; }
+    /** the head of the file, aligned to a page */
+    const uint64_t *words() const { return reinterpret_cast<const uint64_t*>(ptr); }
+    size_t size() const { return length; }
+  private:
+    const char *ptr = nullptr;
+    size_t length = 0;
+  };
+}
+
+#endif
+// MINIOSL_MAPPED_FILE_H
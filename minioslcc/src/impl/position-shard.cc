@@ -0,0 +1,203 @@
+#include "impl/position-shard.h"
+#include "impl/more.h"
+#include "impl/rng.h"
+#include <iostream>
+
+namespace osl {
+  namespace position_shard {
+    constexpr int piece_bits = 9, code_stand = 324, code_inactive = (1 << piece_bits) - 1;
+    constexpr int turn_bit = 40 * piece_bits;
+    static_assert(turn_bit < 64 * std::tuple_size_v<PackedState>);
+  }
+}
+
+osl::position_shard::PackedState osl::position_shard::pack_state(const BaseState& state) {
+  PackedState code = { 0 };
+  auto put = [&](int offset, uint64_t value) {
+    code[offset / 64] |= value << (offset % 64);
+    if (offset % 64 + piece_bits > 64)
+      code[offset / 64 + 1] |= value >> (64 - offset % 64);
+  };
+  for (int id: all_piece_id()) {
+    uint64_t value = code_inactive;
+    if (state.active_pieces().test(id)) {
+      const Piece p = state.pieceOf(id);
+      if (p.isOnBoard())
+        value = p.square().index81() + 81*idx(p.owner()) + 162*is_promoted(p.ptype());
+      else
+        value = code_stand + idx(p.owner());
+    }
+    put(id * piece_bits, value);
+  }
+  if (state.turn() == WHITE)
+    code[turn_bit / 64] |= one_hot(turn_bit % 64);
+  return code;
+}
+
+osl::BaseState osl::position_shard::unpack_state(const PackedState& code) {
+  auto get = [&](int offset) {
+    uint64_t value = code[offset / 64] >> (offset % 64);
+    if (offset % 64 + piece_bits > 64)
+      value |= code[offset / 64 + 1] << (64 - offset % 64);
+    return int(value & ((1u << piece_bits) - 1));
+  };
+  BaseState state;
+  state.initEmpty();
+  for (int id: all_piece_id()) {
+    const int value = get(id * piece_bits);
+    if (value == code_inactive)
+      continue;
+    const Ptype basic = piece_id_ptype[id];
+    if (value >= code_stand) {
+      if (value > code_stand + 1)
+        throw std::domain_error("position_shard::unpack_state broken code");
+      state.setPiece(players[value - code_stand], Square::STAND(), basic);
+      continue;
+    }
+    const bool promoted = value >= 162;
+    state.setPiece(players[(value % 162) / 81], Square::from_index81(value % 81),
+                   promoted ? promote(basic) : basic);
+  }
+  state.setTurn((code[turn_bit / 64] >> (turn_bit % 64)) & 1 ? WHITE : BLACK);
+  state.initFinalize();
+  return state;
+}
+
+osl::position_shard::Entry osl::position_shard::make_entry(const SubRecord& record, int idx) {
+  if (! (0 <= idx && idx < record.moves.size()) || record.result == InGame)
+    throw std::range_error("position_shard::make_entry: out of range or in game " + std::to_string(idx));
+  const int H = ml::history_length, h = std::min(H, idx);
+  BaseState base = record.initial_state();
+  for (int i=0; i<idx-h; ++i)
+    base.make_move_unsafe(record.moves[i]);
+
+  Entry entry = {};
+  entry.state = pack_state(base);
+  for (int i=0; i<h; ++i)
+    entry.history[i] = record.moves[idx-h+i].intValue();
+  entry.n_history = h;
+  entry.move = record.moves[idx].intValue();
+  entry.sampled_id = idx;
+
+  const bool flipped = ((h == 0) ? base.turn() : alt(record.moves[idx-1].player())) == WHITE;
+  Move move = record.moves[idx];
+  auto result = record.result;
+  if (flipped) {
+    move = move.rotate180();
+    result = flip(result);
+  }
+  entry.policy_label = ml::policy_move_label(move);
+  entry.value_label = (idx < 2) ? 0 : ml::value_label(result);
+  return entry;
+}
+
+osl::PositionShardWriter::PositionShardWriter(std::string p) : path(p) {
+  os.open(path, std::ios::binary);
+  if (! os)
+    throw std::runtime_error("PositionShardWriter cannot open " + path);
+  const uint64_t header[position_shard::header_words] = { 0 }; // filled by close()
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+osl::PositionShardWriter::~PositionShardWriter() {
+  try {
+    close();
+  }
+  catch (std::exception& e) {
+    std::cerr << "~PositionShardWriter " << e.what() << '\n';
+  }
+}
+
+void osl::PositionShardWriter::add(const SubRecord& record, int idx) {
+  if (! os.is_open())
+    throw std::logic_error("PositionShardWriter already closed");
+  const auto entry = position_shard::make_entry(record, idx);
+  os.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+  ++count;
+}
+
+void osl::PositionShardWriter::add_samples(const std::vector<SubRecord>& records, int samples,
+                                           int decay, uint64_t seed) {
+  for (size_t k=0; k<records.size(); ++k) {
+    if (records[k].moves.empty() || records[k].result == InGame)
+      continue;
+    for (int j=0; j<samples; ++j) {
+      rng::CounterRNG rng(rng::game_key(seed, k), j, rng::Purpose::TrainingSample);
+      add(records[k], SubRecord::weighted_sampling(records[k].moves.size(), decay, rng));
+    }
+  }
+}
+
+void osl::PositionShardWriter::close() {
+  if (! os.is_open())
+    return;
+  const uint64_t header[position_shard::header_words] = {
+    position_shard::magic, position_shard::version, count, sizeof(position_shard::Entry)
+  };
+  os.seekp(0);
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+  os.close();
+  if (! os)
+    throw std::runtime_error("PositionShardWriter write error " + path);
+}
+
+osl::PositionShardFile::PositionShardFile(const std::string& path) : file(path, false) {
+  const size_t n_words = file.size() / sizeof(uint64_t);
+  const uint64_t *header = file.words();
+  if (n_words < position_shard::header_words || header[0] != position_shard::magic)
+    throw std::domain_error("PositionShardFile not a position shard " + path);
+  if (header[1] != position_shard::version || header[3] != sizeof(position_shard::Entry))
+    throw std::domain_error("PositionShardFile unsupported version " + std::to_string(header[1]));
+  n_entries = header[2];
+  // in the form of division not to overflow by a broken header
+  if (n_entries > (n_words - position_shard::header_words) * sizeof(uint64_t) / sizeof(position_shard::Entry))
+    throw std::domain_error("PositionShardFile truncated " + path);
+  entries = reinterpret_cast<const position_shard::Entry*>(header + position_shard::header_words);
+}
+
+osl::PositionShardFile::~PositionShardFile() {
+}
+
+const osl::position_shard::Entry& osl::PositionShardFile::entry(size_t k) const {
+  if (k >= n_entries)
+    throw std::out_of_range("PositionShardFile " + std::to_string(k));
+  return entries[k];
+}
+
+void osl::PositionShardFile::
+export_feature_labels_to(size_t k, int offset,
+                         nn_input_element *input_buf,
+                         int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                         nn_input_element *input2_buf,
+                         uint8_t *legalmove_buf, uint16_t *sampled_id_buf) const {
+  const auto& e = entry(k);
+  if (e.n_history > ml::history_length)
+    throw std::domain_error("PositionShardFile broken entry " + std::to_string(k));
+  const BaseState base = position_shard::unpack_state(e.state);
+  MoveVector history;
+  for (int i=0; i<e.n_history; ++i)
+    history.push_back(Move::makeDirect(e.history[i]));
+  const Move played = Move::makeDirect(e.move);
+
+  if (sampled_id_buf)
+    sampled_id_buf[offset] = e.sampled_id;
+  auto [state, flipped] = ml::export_features(base, history, input_buf + offset*ml::input_unit);
+  policy_buf[offset] = e.policy_label;
+  value_buf[offset] = e.value_label;
+  ml::helper::write_np_aftermove(state, flipped ? played.rotate180() : played,
+                                 aux_buf + offset*ml::aux_unit);
+  if (input2_buf) {
+    BaseState base2 = base;
+    history.push_back(played);
+    if (history.size() > ml::history_length) {
+      base2.make_move_unsafe(history[0]);
+      history.erase(history.begin());
+    }
+    ml::export_features(base2, history, input2_buf + offset*ml::input_unit);
+  }
+  if (legalmove_buf) {
+    MoveVector legal_moves;
+    state.generateLegal(legal_moves);
+    ml::set_legalmove_bits(legal_moves, legalmove_buf + offset*ml::legalmove_bs_sz);
+  }
+}
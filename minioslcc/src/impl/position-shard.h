@@ -0,0 +1,96 @@
+#ifndef MINIOSL_POSITION_SHARD_H
+#define MINIOSL_POSITION_SHARD_H
+
+#include "feature.h"
+#include "impl/mapped-file.h"
+#include <fstream>
+
+namespace osl {
+  /**
+   * shard of sampled positions for training, featurized without replaying games.
+   *
+   * An entry keeps the state just before the history moves of the position (unflipped),
+   * the history moves, the move played at the position, and its labels, so that
+   * the same features as SubRecord::export_feature_labels_to() are restored
+   * by applying at most `ml::history_length` moves.
+   *
+   * Layout: header of `header_words` uint64_t (magic, version, number of entries, sizeof(Entry)),
+   * followed by Entry for each position, readable by mmap or `np.fromfile`.
+   */
+  namespace position_shard {
+    constexpr uint64_t magic = 0x31534f504c534f4dull; // "MOSLPOS1" in little endian
+    constexpr uint64_t version = 1;
+    constexpr int header_words = 4;
+    /** a state in 361 bits, 9 bits for each piece id and the side to move */
+    typedef std::array<uint64_t,6> PackedState;
+    PackedState pack_state(const BaseState& state);
+    BaseState unpack_state(const PackedState& code);
+
+    struct Entry {
+      /** state before `history` */
+      PackedState state;
+      /** Move::intValue() of the history, the oldest first, the first `n_history` items are valid */
+      std::array<int32_t,ml::history_length> history;
+      /** Move::intValue() of the move played at the position */
+      int32_t move;
+      int16_t policy_label;
+      int8_t value_label;
+      uint8_t n_history;
+      /** index of the position in its game record */
+      uint16_t sampled_id;
+      uint16_t reserved;
+    };
+    static_assert(sizeof(Entry) == 88);
+
+    /** make an entry for the position of `idx`-th move in `record` */
+    Entry make_entry(const SubRecord& record, int idx);
+  }
+
+  /** write sampled positions of game records to a shard */
+  class PositionShardWriter {
+  public:
+    explicit PositionShardWriter(std::string path);
+    /** close() unless closed, errors are reported to std::cerr */
+    ~PositionShardWriter();
+    void add(const SubRecord& record, int idx);
+    /**
+     * add `samples` positions of each record drawn by SubRecord::weighted_sampling
+     * reproducibly for `seed` and the index of the record
+     */
+    void add_samples(const std::vector<SubRecord>& records, int samples,
+                     int decay=SubRecord::default_decay, uint64_t seed=0);
+    /** write the header, no entries can be added afterwards */
+    void close();
+    size_t size() const { return count; }
+  private:
+    const std::string path;
+    std::ofstream os;
+    size_t count = 0;
+  };
+
+  /** memory-mapped reader of a shard written by PositionShardWriter */
+  class PositionShardFile {
+  public:
+    explicit PositionShardFile(const std::string& path);
+    ~PositionShardFile();
+
+    size_t size() const { return n_entries; }
+    const position_shard::Entry& entry(size_t k) const;
+    /** export features and labels of entry `k` to given pointers (must be zero-filled),
+     * the same as SubRecord::export_feature_labels_to()
+     */
+    void export_feature_labels_to(size_t k, int offset,
+                                  nn_input_element *input_buf,
+                                  int32_t *policy_buf, float *value_buf, nn_input_element *aux_buf,
+                                  nn_input_element *input2_buf,
+                                  uint8_t *legalmove_buf,
+                                  uint16_t *sampled_id_buf) const;
+  private:
+    MappedFile file;
+    const position_shard::Entry *entries = nullptr;
+    size_t n_entries = 0;
+  };
+}
+
+#endif
+// MINIOSL_POSITION_SHARD_H
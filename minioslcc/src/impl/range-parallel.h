@@ -1,6 +1,11 @@
+#ifndef MINIOSL_RANGE_PARALLEL_H
+#define MINIOSL_RANGE_PARALLEL_H
+
 #include "rng.h"
 #include <thread>
 #include <algorithm>
+#include <atomic>
+#include <exception>
 #include <vector>
 
 namespace osl {
@@ -43,4 +48,49 @@ namespace osl {
     for (auto& w: workers)
       w.join();
   }
+
+  /**
+   * call `f(i)` for each i in [0, N), workers taking the next `unit` items as they finish,
+   * for items of uneven loads.
+   * @param threads number of workers, `range_parallel_threads` if not positive
+   * or without ENABLE_RANGE_PARALLEL
+   * An exception thrown by `f` stops handing out items and is rethrown after all workers finish.
+   */
+  inline void run_dynamic_parallel(size_t N, auto f, int threads=0, size_t unit=1) {
+    if (threads <= 0 || range_parallel_threads < 2)
+      threads = range_parallel_threads;
+    const size_t n_workers = std::min<size_t>(threads, (N+unit-1)/unit);
+    if (n_workers < 2) {
+      for (size_t i=0; i<N; ++i)
+        f(i);
+      return;
+    }
+    std::atomic<size_t> next = 0;
+    std::exception_ptr failure;
+    std::atomic<bool> failed = false;
+    auto work = [&]() {
+      try {
+        for (size_t begin; (begin = next.fetch_add(unit)) < N;)
+          for (size_t i=begin; i<std::min(begin+unit, N); ++i)
+            f(i);
+      }
+      catch (...) {
+        if (! failed.exchange(true))
+          failure = std::current_exception();
+        next = N;
+      }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(n_workers-1);
+    for (size_t i=1; i<n_workers; ++i)
+      workers.emplace_back(work);
+    work();
+    for (auto& w: workers)
+      w.join();
+    if (failure)
+      std::rethrow_exception(failure);
+  }
 }
+
+#endif
+// MINIOSL_RANGE_PARALLEL_H
@@ -0,0 +1,349 @@
+#include "impl/rank-coder.h"
+#include <algorithm>
+#include <bit>
+#include <fstream>
+
+namespace osl {
+  namespace rankcode {
+    constexpr char magic[8] = {'M', 'O', 'S', 'L', 'R', 'C', '0', '2'};
+    constexpr int length_bits = 10, shogi816k_id_bits = 21;
+    static_assert(Shogi816K_Size < (1 << shogi816k_id_bits));
+    /** final moves of records with a winner */
+    enum FinalMoveCode { FinalResign, FinalDeclare, FinalOther };
+    /** material values for order_moves(), frozen as a part of the format, pawn=100 */
+    constexpr CArray<int,Ptype_SIZE> piece_value = {
+      0, 0,                     // empty, edge
+      520, 500, 500, 520, 1050, 1250, // PPAWN, PLANCE, PKNIGHT, PSILVER, PBISHOP, PROOK
+      0, 550, 100, 300, 350, 500, 800, 950, // KING, GOLD, PAWN, LANCE, KNIGHT, SILVER, BISHOP, ROOK
+    };
+  }
+}
+
+/*
+ * The ranks in archives are positions in this ordering, so that any change here, including
+ * the constants above, makes existing streams undecodable; bump `magic` together.
+ * It depends only on the rules (effects, checks) and not on search or evaluation functions.
+ */
+
+void osl::rankcode::order_moves(const EffectState& state, Move last_move, MoveVector& moves) {
+  const Player P = state.turn();
+  const bool in_check = state.inCheck();
+  std::vector<std::pair<int,Move>> scored;
+  scored.reserve(moves.size());
+  for (Move move: moves) {
+    const Square to = move.to();
+    const Ptype ptype = move.ptype();
+    int score = 0;
+    const int defense = state.countEffect(P, to) - (move.isDrop() ? 0 : 1);
+    const bool attacked = state.countEffect(alt(P), to) > 0;
+    if (move.isCapture()) {
+      const int gain = piece_value[idx(move.capturePtype())];
+      // a crude exchange, losing the moved piece if the target is protected
+      const int exchange = attacked ? gain - piece_value[idx(move.oldPtype())] : gain;
+      score += 1000 + std::max(exchange, 0) + gain;
+    }
+    if (last_move.isNormal() && to == last_move.to())
+      score += 300;             // recapture
+    if (move.isPromotion())
+      score += 400;
+    else if (! move.isDrop() && can_promote(ptype)
+             && (promote_area_y(P, move.from().y()) || promote_area_y(P, to.y()))
+             && (ptype == PAWN || ptype == BISHOP || ptype == ROOK))
+      score -= 800;             // rarely played
+    if (state.isCheck(move))
+      score += 200;
+    if (ptype != KING && attacked)
+      score -= piece_value[idx(ptype)] / (defense > 0 ? 2 : 1);
+    if (ptype == KING && ! in_check)
+      score -= 100;
+    if (move.isDrop())
+      score -= 50;
+    scored.emplace_back(score, move);
+  }
+  std::ranges::stable_sort(scored, [](const auto& l, const auto& r) { return l.first > r.first; });
+  for (size_t i=0; i<moves.size(); ++i)
+    moves[i] = scored[i].second;
+}
+
+osl::rankcode::detail::Model::Model() {
+  result.fill(prob_init);
+  for (auto& probs: bucket)
+    probs.fill(prob_init);
+  for (auto& probs: mantissa)
+    probs.fill(prob_init);
+}
+
+void osl::rankcode::detail::RangeEncoder::shift_low() {
+  if (uint32_t(low) < 0xFF000000u || (low >> 32) != 0) {
+    uint8_t carry = low >> 32, temp = cache;
+    do {
+      os.put(char(uint8_t(temp + carry)));
+      temp = 0xFF;
+    } while (--cache_size != 0);
+    cache = uint8_t(low >> 24);
+  }
+  ++cache_size;
+  low = (low & 0x00FFFFFFu) << 8;
+}
+
+void osl::rankcode::detail::RangeEncoder::encode(Prob& prob, int bit) {
+  const uint32_t bound = (range >> prob_bits) * prob;
+  if (bit == 0) {
+    range = bound;
+    prob += ((1 << prob_bits) - prob) >> adapt_shift;
+  }
+  else {
+    low += bound;
+    range -= bound;
+    prob -= prob >> adapt_shift;
+  }
+  while (range < (1u << 24)) {
+    range <<= 8;
+    shift_low();
+  }
+}
+
+void osl::rankcode::detail::RangeEncoder::encode_direct(uint32_t value, int bits) {
+  for (int i=bits-1; i>=0; --i) {
+    range >>= 1;
+    if ((value >> i) & 1)
+      low += range;
+    while (range < (1u << 24)) {
+      range <<= 8;
+      shift_low();
+    }
+  }
+}
+
+void osl::rankcode::detail::RangeEncoder::flush() {
+  for (int i=0; i<5; ++i)
+    shift_low();
+}
+
+osl::rankcode::detail::RangeDecoder::RangeDecoder(std::istream& in) : is(in) {
+  for (int i=0; i<5; ++i)
+    code = (code << 8) | next_byte();
+}
+
+uint8_t osl::rankcode::detail::RangeDecoder::next_byte() {
+  auto c = is.get();
+  return (c == std::istream::traits_type::eof()) ? 0 : uint8_t(c);
+}
+
+int osl::rankcode::detail::RangeDecoder::decode(Prob& prob) {
+  const uint32_t bound = (range >> prob_bits) * prob;
+  int bit;
+  if (code < bound) {
+    range = bound;
+    prob += ((1 << prob_bits) - prob) >> adapt_shift;
+    bit = 0;
+  }
+  else {
+    code -= bound;
+    range -= bound;
+    prob -= prob >> adapt_shift;
+    bit = 1;
+  }
+  while (range < (1u << 24)) {
+    range <<= 8;
+    code = (code << 8) | next_byte();
+  }
+  return bit;
+}
+
+uint32_t osl::rankcode::detail::RangeDecoder::decode_direct(int bits) {
+  uint32_t value = 0;
+  for (int i=0; i<bits; ++i) {
+    range >>= 1;
+    int bit = 0;
+    if (code >= range) {
+      code -= range;
+      bit = 1;
+    }
+    value = (value << 1) | bit;
+    while (range < (1u << 24)) {
+      range <<= 8;
+      code = (code << 8) | next_byte();
+    }
+  }
+  return value;
+}
+
+osl::rankcode::RecordEncoder::RecordEncoder(std::ostream& o) : os(o), coder(o) {
+  os.write(magic, sizeof(magic));
+}
+
+osl::rankcode::RecordEncoder::~RecordEncoder() {
+  if (! finished)
+    finish();
+}
+
+void osl::rankcode::RecordEncoder::encode_rank(int rank) {
+  using namespace detail;
+  const int b = std::bit_width(unsigned(rank+1)) - 1;
+  for (int i=0; i<b; ++i)
+    coder.encode(model.bucket[context][i], 1);
+  if (b < rank_buckets-1)
+    coder.encode(model.bucket[context][b], 0);
+  const uint32_t mantissa = rank+1 - (1u << b);
+  const int tb = std::min(b, tree_bits), low_bits = b - tb;
+  int node = 1;
+  for (int i=tb-1; i>=0; --i) {
+    const int bit = (mantissa >> (i + low_bits)) & 1;
+    coder.encode(model.mantissa[b][node], bit);
+    node = node*2 + bit;
+  }
+  coder.encode_direct(mantissa & ((1u << low_bits) - 1), low_bits);
+  context = std::min(b, rank_contexts-1);
+}
+
+void osl::rankcode::RecordEncoder::add(const MiniRecord& record) {
+  if (finished)
+    throw std::logic_error("RecordEncoder already finished");
+  if (record.variant != HIRATE && record.variant != Shogi816K && record.variant != Aozora)
+    throw std::domain_error("RecordEncoder unsupported variant");
+  if (record.variant == HIRATE && record.initial_state != BaseState(HIRATE))
+    throw std::domain_error("RecordEncoder initial state not supported");
+  if (record.moves.size() >= (1u << length_bits))
+    throw std::domain_error("RecordEncoder length limit over "+std::to_string(record.moves.size()));
+  // ranks are computed first so that an illegal move leaves the stream intact
+  std::vector<int> ranks;
+  ranks.reserve(record.moves.size());
+  EffectState state(record.initial_state);
+  Move last_move;
+  for (Move move: record.moves) {
+    MoveVector moves;
+    state.generateLegal(moves);
+    order_moves(state, last_move, moves);
+    auto p = std::ranges::find(moves, move);
+    if (p == moves.end())
+      throw std::domain_error("RecordEncoder illegal move " + to_csa(move));
+    ranks.push_back(p - moves.begin());
+    state.makeMove(move);
+    last_move = move;
+  }
+
+  coder.encode(model.more[0], 1);
+  coder.encode_direct(record.variant, 2);
+  if (record.variant == Shogi816K)
+    coder.encode_direct(record.shogi816k_id.value_or(0), shogi816k_id_bits);
+  coder.encode_direct(record.moves.size(), length_bits);
+  coder.encode(model.result[1], record.result >> 1);
+  coder.encode(model.result[2 + (record.result >> 1)], record.result & 1);
+  for (int rank: ranks)
+    encode_rank(rank);
+  if (record.has_winner()) {
+    auto code = (record.final_move == Move::Resign()) ? FinalResign
+      : ((record.final_move == Move::DeclareWin()) ? FinalDeclare : FinalOther);
+    coder.encode_direct(code, 2);
+  }
+}
+
+void osl::rankcode::RecordEncoder::finish() {
+  if (finished)
+    return;
+  coder.encode(model.more[0], 0);
+  coder.flush();
+  os.flush();
+  finished = true;
+}
+
+std::istream& osl::rankcode::RecordDecoder::read_header(std::istream& is) {
+  char header[sizeof(magic)];
+  if (! is.read(header, sizeof(header)) || ! std::equal(header, header+sizeof(header), magic))
+    throw std::domain_error("RecordDecoder header not found");
+  return is;
+}
+
+osl::rankcode::RecordDecoder::RecordDecoder(std::istream& is) : coder(read_header(is)) {
+}
+
+int osl::rankcode::RecordDecoder::decode_rank() {
+  using namespace detail;
+  int b = 0;
+  while (b < rank_buckets-1 && coder.decode(model.bucket[context][b]))
+    ++b;
+  const int tb = std::min(b, tree_bits), low_bits = b - tb;
+  int node = 1;
+  for (int i=0; i<tb; ++i)
+    node = node*2 + coder.decode(model.mantissa[b][node]);
+  const uint32_t mantissa = ((node - (1 << tb)) << low_bits) | coder.decode_direct(low_bits);
+  context = std::min(b, rank_contexts-1);
+  return (1 << b) + mantissa - 1;
+}
+
+bool osl::rankcode::RecordDecoder::next(MiniRecord& record) {
+  if (done || coder.decode(model.more[0]) == 0) {
+    done = true;
+    return false;
+  }
+  const auto variant = GameVariant(coder.decode_direct(2));
+  std::optional<int> shogi816k_id;
+  if (variant == Shogi816K)
+    shogi816k_id = coder.decode_direct(shogi816k_id_bits);
+  else if (variant != HIRATE && variant != Aozora)
+    throw std::domain_error("RecordDecoder broken variant");
+  const int length = coder.decode_direct(length_bits);
+  const int hi = coder.decode(model.result[1]);
+  const auto result = GameResult(hi*2 + coder.decode(model.result[2 + hi]));
+
+  if (variant == HIRATE)
+    record.set_initial_state(BaseState(HIRATE));
+  else
+    record.set_initial_state(BaseState(variant, shogi816k_id), variant, shogi816k_id);
+  record.moves.reserve(length);
+  EffectState state(record.initial_state);
+  Move last_move;
+  for (int i=0; i<length; ++i) {
+    MoveVector moves;
+    state.generateLegal(moves);
+    order_moves(state, last_move, moves);
+    const int rank = decode_rank();
+    if (rank >= moves.size())
+      throw std::domain_error("RecordDecoder broken rank");
+    const Move move = moves[rank];
+    state.makeMove(move);
+    record.append_move(move, state.inCheck());
+    last_move = move;
+  }
+  record.result = result;
+  if (record.has_winner()) {
+    auto code = coder.decode_direct(2);
+    if (code == FinalResign)
+      record.final_move = Move::Resign();
+    else if (code == FinalDeclare)
+      record.final_move = Move::DeclareWin();
+  }
+  record.settle_repetition();
+  return true;
+}
+
+size_t osl::rankcode::save(const std::string& path, const std::vector<MiniRecord>& records) {
+  std::ofstream os(path, std::ios::binary);
+  if (! os)
+    throw std::runtime_error("rankcode::save cannot open " + path);
+  RecordEncoder encoder(os);
+  size_t written = 0;
+  for (const auto& record: records) {
+    if (record.moves.empty())
+      continue;
+    encoder.add(record);
+    ++written;
+  }
+  encoder.finish();
+  if (! os)
+    throw std::runtime_error("rankcode::save write error " + path);
+  return written;
+}
+
+std::vector<osl::MiniRecord> osl::rankcode::load(const std::string& path) {
+  std::ifstream is(path, std::ios::binary);
+  if (! is)
+    throw std::domain_error("file not found" + path);
+  RecordDecoder decoder(is);
+  std::vector<MiniRecord> records;
+  MiniRecord record;
+  while (decoder.next(record))
+    records.push_back(record);
+  return records;
+}
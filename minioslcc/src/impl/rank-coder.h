@@ -0,0 +1,107 @@
+#ifndef MINIOSL_RANK_CODER_H
+#define MINIOSL_RANK_CODER_H
+
+#include "record.h"
+#include <iostream>
+#include <array>
+
+namespace osl {
+  /**
+   * entropy-coded game records, denser than the 12 bits per move of bitpack.
+   *
+   * Each move is replaced by its rank among legal moves sorted by a static heuristic
+   * (order_moves()), and the ranks are compressed by an adaptive binary range coder
+   * (the same family as LZMA's) whose statistics are carried over across records in a stream.
+   * A stream is therefore decoded from its head; split archives into files for random access.
+   */
+  namespace rankcode {
+    /** sort legal moves of `state` from the most likely, deterministic for a state and `last_move`.
+     * A part of the format: any change needs a new magic of streams.
+     */
+    void order_moves(const EffectState& state, Move last_move, MoveVector& moves);
+
+    /** @internal adaptive binary range coder */
+    namespace detail {
+      constexpr int prob_bits = 11, adapt_shift = 5;
+      typedef uint16_t Prob;
+      constexpr Prob prob_init = (1 << prob_bits) / 2;
+      /** rank up to 1023 is coded by `bucket = bit_width(rank+1)-1` and the lower bits */
+      constexpr int rank_buckets = 10, rank_contexts = 4, tree_bits = 4;
+      struct Model {
+        std::array<Prob,1> more = {prob_init};
+        std::array<std::array<Prob,rank_buckets>,rank_contexts> bucket;
+        std::array<std::array<Prob,1 << tree_bits>,rank_buckets> mantissa;
+        std::array<Prob,4> result;
+        Model();
+      };
+      class RangeEncoder {
+      public:
+        explicit RangeEncoder(std::ostream& os) : os(os) {}
+        void encode(Prob& prob, int bit);
+        void encode_direct(uint32_t value, int bits);
+        void flush();
+      private:
+        void shift_low();
+        std::ostream& os;
+        uint64_t low = 0;
+        uint32_t range = 0xFFFFFFFFu, cache_size = 1;
+        uint8_t cache = 0;
+      };
+      class RangeDecoder {
+      public:
+        explicit RangeDecoder(std::istream& is);
+        int decode(Prob& prob);
+        uint32_t decode_direct(int bits);
+      private:
+        uint8_t next_byte();
+        std::istream& is;
+        uint32_t range = 0xFFFFFFFFu, code = 0;
+      };
+    }
+
+    /** write records to a stream, a header is written at construction */
+    class RecordEncoder {
+    public:
+      explicit RecordEncoder(std::ostream& os);
+      /** finish() unless finished */
+      ~RecordEncoder();
+      /** @throw std::domain_error for records not supported (other variants or 1024 moves or more) */
+      void add(const MiniRecord& record);
+      /** write the end mark and flush the coder, no records can be added afterwards */
+      void finish();
+    private:
+      void encode_rank(int rank);
+      std::ostream& os;
+      detail::RangeEncoder coder;
+      detail::Model model;
+      int context = 0;
+      bool finished = false;
+    };
+
+    class RecordDecoder {
+    public:
+      /** @throw std::domain_error if the stream does not start with the header */
+      explicit RecordDecoder(std::istream& is);
+      /** read the next record with its history as bitpack::read_binary_record
+       * @return false at the end of records
+       */
+      bool next(MiniRecord& record);
+    private:
+      static std::istream& read_header(std::istream& is);
+      int decode_rank();
+      detail::RangeDecoder coder;
+      detail::Model model;
+      int context = 0;
+      bool done = false;
+    };
+
+    /** write `records` to a file by RecordEncoder, skipping empty ones
+     * @return number of records written
+     */
+    size_t save(const std::string& path, const std::vector<MiniRecord>& records);
+    std::vector<MiniRecord> load(const std::string& path);
+  }
+}
+
+#endif
+// MINIOSL_RANK_CODER_H
@@ -0,0 +1,138 @@
+#include "impl/record-writer.h"
+#include "impl/bitpack.h"
+#include <iomanip>
+#include <sstream>
+
+osl::GameRecordSink::~GameRecordSink() {
+}
+
+osl::BitpackRecordWriter::BitpackRecordWriter(std::string p, int rpf, int mp)
+  : prefix(p), records_per_file(rpf), max_pending(mp) {
+  if (records_per_file < 1 || max_pending < 1)
+    throw std::invalid_argument("BitpackRecordWriter " + std::to_string(records_per_file)
+                                + " " + std::to_string(max_pending));
+  worker = std::thread([this]() { run(); });
+}
+
+osl::BitpackRecordWriter::~BitpackRecordWriter() {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    stop = true;
+  }
+  ready.notify_all();
+  worker.join();
+}
+
+void osl::BitpackRecordWriter::rethrow_if_failed() {
+  if (failure)
+    std::rethrow_exception(failure);
+}
+
+void osl::BitpackRecordWriter::add(MiniRecord&& record) {
+  {
+    std::unique_lock<std::mutex> lock(m);
+    space.wait(lock, [&]{ return queue.size() < max_pending || failure; });
+    rethrow_if_failed();
+    queue.push_back(std::move(record));
+  }
+  ready.notify_one();
+}
+
+void osl::BitpackRecordWriter::flush() {
+  std::unique_lock<std::mutex> lock(m);
+  idle.wait(lock, [&]{ return (queue.empty() && ! busy) || failure; });
+  rethrow_if_failed();
+}
+
+size_t osl::BitpackRecordWriter::n_written() const {
+  std::lock_guard<std::mutex> lock(m);
+  return written;
+}
+
+size_t osl::BitpackRecordWriter::n_skipped() const {
+  std::lock_guard<std::mutex> lock(m);
+  return skipped;
+}
+
+std::array<size_t,osl::GameResultTypes> osl::BitpackRecordWriter::result_count() const {
+  std::lock_guard<std::mutex> lock(m);
+  return results;
+}
+
+std::vector<std::string> osl::BitpackRecordWriter::files() const {
+  std::lock_guard<std::mutex> lock(m);
+  return paths;
+}
+
+void osl::BitpackRecordWriter::open_next() {
+  std::ostringstream ss;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    ss << prefix << '-' << std::setw(6) << std::setfill('0') << paths.size() << ".bin";
+    paths.push_back(ss.str());
+  }
+  os.close();
+  os.open(ss.str(), std::ios::binary);
+  if (! os)
+    throw std::runtime_error("BitpackRecordWriter cannot open " + ss.str());
+  records_in_file = 0;
+}
+
+void osl::BitpackRecordWriter::run() {
+  std::deque<MiniRecord> local;
+  std::vector<uint64_t> work;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m);
+      ready.wait(lock, [&]{ return stop || ! queue.empty(); });
+      if (queue.empty())
+        break;                  // stop
+      local.swap(queue);
+      busy = true;
+    }
+    space.notify_all();
+    size_t local_written = 0, local_skipped = 0;
+    std::array<size_t,GameResultTypes> local_results = {0};
+    try {
+      for (const auto& record: local) {
+        work.clear();
+        try {
+          if (! bitpack::append_binary_record(record, work)) {
+            ++local_skipped;    // empty record
+            continue;
+          }
+        }
+        catch (std::domain_error&) {
+          ++local_skipped;
+          continue;
+        }
+        if (! os.is_open() || records_in_file >= records_per_file)
+          open_next();
+        os.write(reinterpret_cast<const char*>(work.data()), work.size()*sizeof(uint64_t));
+        ++records_in_file;
+        ++local_written;
+        ++local_results[record.result];
+      }
+      os.flush();
+      if (os.is_open() && ! os)
+        throw std::runtime_error("BitpackRecordWriter write error");
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(m);
+      failure = std::current_exception();
+    }
+    local.clear();
+    {
+      std::lock_guard<std::mutex> lock(m);
+      written += local_written;
+      skipped += local_skipped;
+      for (int i=0; i<GameResultTypes; ++i)
+        results[i] += local_results[i];
+      busy = false;
+    }
+    idle.notify_all();
+    space.notify_all();
+    if (failure)
+      break;
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef MINIOSL_RECORD_WRITER_H
+#define MINIOSL_RECORD_WRITER_H
+
+#include "record.h"
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+
+namespace osl {
+  /** destination of completed games, alternative to keep them in memory */
+  class GameRecordSink {
+  public:
+    virtual ~GameRecordSink();
+    virtual void add(MiniRecord&& record) = 0;
+    /** block until all records given have been stored */
+    virtual void flush() {}
+  };
+
+  /**
+   * write games in the bitpack binary format (`bitpack::append_binary_record`) on a background thread.
+   *
+   * Files are named `{prefix}-{index:06d}.bin` and rotated every `records_per_file` records.
+   * Each file is a plain sequence of uint64_t, the same as `compress-sfen` produces.
+   * `add` blocks while `max_pending` records are waiting, so that memory usage stays flat.
+   */
+  class BitpackRecordWriter : public GameRecordSink {
+  public:
+    explicit BitpackRecordWriter(std::string prefix, int records_per_file=100000, int max_pending=4096);
+    /** flush and stop the thread */
+    ~BitpackRecordWriter();
+    void add(MiniRecord&& record) override;
+    void flush() override;
+
+    size_t n_written() const;
+    /** number of records not written, e.g., empty or too long */
+    size_t n_skipped() const;
+    std::array<size_t,GameResultTypes> result_count() const;
+    /** names of the files opened so far */
+    std::vector<std::string> files() const;
+  private:
+    void run();
+    void open_next();
+    void rethrow_if_failed();
+
+    const std::string prefix;
+    const int records_per_file, max_pending;
+    mutable std::mutex m;
+    std::condition_variable ready, space, idle;
+    std::deque<MiniRecord> queue;
+    bool stop = false, busy = false;
+    std::exception_ptr failure;
+    size_t written = 0, skipped = 0;
+    std::array<size_t,GameResultTypes> results = {0};
+    std::vector<std::string> paths;
+    // touched only by the worker
+    std::ofstream os;
+    int records_in_file = 0;
+    std::thread worker;
+  };
+}
+
+#endif
+// MINIOSL_RECORD_WRITER_H
@@ -1,4 +1,5 @@
 #include "impl/rng.h"
+#include <cstdlib>
 
 osl::rng::rng_t osl::rng::make_rng() {
     static const auto env = std::getenv("MINIOSL_DETERMINISTIC");
@@ -17,3 +18,13 @@ osl::rng::rng_array_t osl::rng::make_rng_array() {
 namespace osl {
   rng::rng_array_t rng::rngs = rng::make_rng_array();
 }
+
+uint64_t osl::rng::default_seed() {
+  static const uint64_t seed = [] {
+    if (auto env = std::getenv("MINIOSL_DETERMINISTIC"))
+      return uint64_t(std::strtoull(env, nullptr, 10));
+    std::random_device rdev;
+    return (uint64_t(rdev()) << 32) | rdev();
+  }();
+  return seed;
+}
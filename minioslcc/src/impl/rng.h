@@ -3,6 +3,7 @@
 
 #include <random>
 #include <array>
+#include <cstdint>
 
 namespace osl {
   /** thread local random number generators.
@@ -17,6 +18,44 @@ namespace osl {
 
     rng_t make_rng();
     rng_array_t make_rng_array();
+
+    /** purposes of random numbers, each has an independent stream in CounterRNG */
+    enum class Purpose : uint32_t {
+      Gumbel = 1, RandomOpening, RandomMove, Shogi816K, TrainingSample, SearchRoot,
+    };
+    /** finalizer of splitmix64 */
+    constexpr uint64_t mix64(uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+    /** key of a game (or of any other unit of work) for CounterRNG */
+    constexpr uint64_t game_key(uint64_t seed, uint64_t game_id) {
+      return mix64(mix64(seed + 0x9e3779b97f4a7c15ull) ^ game_id);
+    }
+    /** seed for counter-based streams, the integer in MINIOSL_DETERMINISTIC (0 if not a number) if set,
+     * otherwise from the standard random device, drawn once per process */
+    uint64_t default_seed();
+
+    /**
+     * counter-based generator, a function of (game key, ply, purpose, counter) without state shared with
+     * others.  The numbers drawn for a game at a ply are therefore the same however the games are
+     * distributed over threads.  Satisfies UniformRandomBitGenerator for use with the standard distributions.
+     */
+    class CounterRNG {
+    public:
+      typedef uint64_t result_type;
+      CounterRNG(uint64_t key, uint32_t ply, Purpose purpose)
+        : base(mix64(key ^ mix64((uint64_t(ply) << 32) | uint32_t(purpose)))) {
+      }
+      result_type operator()() {
+        return mix64(base + (++counter) * 0x9e3779b97f4a7c15ull);
+      }
+      static constexpr result_type min() { return 0; }
+      static constexpr result_type max() { return UINT64_MAX; }
+    private:
+      uint64_t base, counter = 0;
+    };
   }
   using rng::rngs;
   using rng::rng_t;
@@ -0,0 +1,337 @@
+#include "impl/shm-inference.h"
+#include <stdexcept>
+#include <iostream>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#endif
+
+namespace osl {
+  namespace shm {
+    static_assert(std::atomic<uint32_t>::is_always_lock_free);
+    static_assert(std::atomic<pid_t>::is_always_lock_free);
+    constexpr uint64_t magic = 0x326c736f696e696dull; // "miniosl2"
+    enum SlotState : uint32_t { Free, Idle, Submitted, Running, Done };
+    constexpr size_t round64(size_t n) { return (n + 63) / 64 * 64; }
+
+    /** request slot, followed by input, policy and value areas of slot_capacity positions */
+    struct alignas(64) Slot {
+      std::atomic<uint32_t> state;
+      uint32_t n, need_policy, error;
+      /** process of the attached client, 0 while attaching or Free */
+      std::atomic<pid_t> owner;
+
+      char *data() { return reinterpret_cast<char*>(this) + sizeof(Slot); }
+      nn_input_element *input() { return reinterpret_cast<nn_input_element*>(data()); }
+      float *policy(int capacity) {
+        return reinterpret_cast<float*>(data() + round64(capacity*ml::input_unit));
+      }
+      float *value(int capacity) {
+        return reinterpret_cast<float*>(data() + round64(capacity*ml::input_unit)
+                                        + round64(capacity*sizeof(policy_logits_t)));
+      }
+      static size_t size(int capacity) {
+        return sizeof(Slot) + round64(capacity*ml::input_unit)
+          + round64(capacity*sizeof(policy_logits_t)) + round64(capacity*sizeof(value_vector_t));
+      }
+    };
+
+    struct alignas(64) Header {
+      uint64_t magic;
+      uint32_t n_slots, slot_capacity;
+      uint64_t slot_bytes;
+      /** incremented for each submission */
+      std::atomic<uint32_t> doorbell;
+      std::atomic<uint32_t> closed;
+
+      Slot& slot(int i) {
+        return *reinterpret_cast<Slot*>(reinterpret_cast<char*>(this) + sizeof(Header) + i*slot_bytes);
+      }
+    };
+
+    void wait_on(std::atomic<uint32_t>& word, uint32_t expected, int timeout_us) {
+#ifdef __linux__
+      timespec ts { timeout_us / 1000000, (timeout_us % 1000000) * 1000L };
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+      if (word.load() == expected)
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min(timeout_us, 50)));
+#endif
+    }
+    void wake_all(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+    std::string segment_name(std::string name) {
+      return name.starts_with("/") ? name : "/" + name;
+    }
+  }
+}
+
+osl::ShmInferenceServer::ShmInferenceServer(std::string name, InferenceModel& m,
+                                            int n_slots, int slot_capacity,
+                                            int mb, int mw)
+  : shm_name(shm::segment_name(name)), model(m), max_batch(mb), max_wait_us(mw) {
+  if (n_slots < 1 || slot_capacity < 1 || max_batch < 1 || max_wait_us < 0)
+    throw std::invalid_argument("ShmInferenceServer " + std::to_string(n_slots)
+                                + " " + std::to_string(slot_capacity)
+                                + " " + std::to_string(max_batch));
+  const size_t slot_bytes = shm::Slot::size(slot_capacity);
+  shm_size = sizeof(shm::Header) + n_slots * slot_bytes;
+  int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    throw std::runtime_error("ShmInferenceServer cannot create " + shm_name + " "
+                             + std::strerror(errno));
+  void *ptr = MAP_FAILED;
+  if (ftruncate(fd, shm_size) == 0)
+    ptr = mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    shm_unlink(shm_name.c_str());
+    throw std::runtime_error("ShmInferenceServer cannot map " + shm_name);
+  }
+  header = new (ptr) shm::Header;
+  header->n_slots = n_slots;
+  header->slot_capacity = slot_capacity;
+  header->slot_bytes = slot_bytes;
+  header->doorbell = 0;
+  header->closed = 0;
+  for (int i=0; i<n_slots; ++i)
+    new (&header->slot(i)) shm::Slot { shm::Free, 0, 0, 0, 0 };
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = shm::magic;
+}
+
+osl::ShmInferenceServer::~ShmInferenceServer() {
+  stop();
+  header->closed = 1;
+  for (uint32_t i=0; i<header->n_slots; ++i)
+    shm::wake_all(header->slot(i).state);
+  munmap(header, shm_size);
+  shm_unlink(shm_name.c_str());
+}
+
+void osl::ShmInferenceServer::start() {
+  if (running.exchange(true))
+    return;
+  worker = std::thread([this]() {
+    while (running) {
+      try {
+        serve_once(10000);
+      }
+      catch (std::exception& e) {
+        // already reported to the clients
+        std::cerr << "ShmInferenceServer " << e.what() << '\n';
+      }
+    }
+  });
+}
+
+void osl::ShmInferenceServer::stop() {
+  running = false;
+  if (worker.joinable())
+    worker.join();
+}
+
+void osl::ShmInferenceServer::reclaim_slots() {
+  for (uint32_t i=0; i<header->n_slots; ++i) {
+    auto& s = header->slot(i);
+    auto state = s.state.load(std::memory_order_acquire);
+    const pid_t owner = s.owner.load();
+    if (state == shm::Free || state == shm::Running || owner == 0)
+      continue;
+    if (kill(owner, 0) == 0 || errno != ESRCH)
+      continue;
+    std::cerr << "ShmInferenceServer reclaim slot " << i << " of exited process " << owner << '\n';
+    s.owner.store(0);
+    s.state.compare_exchange_strong(state, shm::Free);
+  }
+}
+
+int osl::ShmInferenceServer::n_clients() const {
+  int ret = 0;
+  for (uint32_t i=0; i<header->n_slots; ++i)
+    ret += header->slot(i).state.load() != shm::Free;
+  return ret;
+}
+
+int osl::ShmInferenceServer::serve_once(int timeout_us) {
+  std::lock_guard<std::mutex> lock(serving);
+  const int n_slots = header->n_slots, capacity = header->slot_capacity;
+  auto scan = [&]() {
+    int k = 0, total = 0;
+    for (int i=0; i<n_slots; ++i) {
+      auto& s = header->slot(i);
+      if (s.state.load(std::memory_order_acquire) == shm::Submitted)
+        ++k, total += s.n;
+    }
+    return std::make_pair(k, total);
+  };
+  reclaim_slots();
+  // (1) wait for the first request
+  auto bell = header->doorbell.load(std::memory_order_acquire);
+  auto [k, total] = scan();
+  if (k == 0) {
+    shm::wait_on(header->doorbell, bell, timeout_us);
+    std::tie(k, total) = scan();
+    if (k == 0)
+      return 0;
+  }
+  // (2) wait for the other clients to join the batch
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(max_wait_us);
+  while (total < max_batch && k < n_clients()) {
+    auto rest = std::chrono::duration_cast<std::chrono::microseconds>
+      (deadline - std::chrono::steady_clock::now()).count();
+    if (rest <= 0)
+      break;
+    bell = header->doorbell.load(std::memory_order_acquire);
+    auto [k2, total2] = scan();
+    if (k2 == k)
+      shm::wait_on(header->doorbell, bell, rest);
+    std::tie(k, total) = scan();
+  }
+  // (3) merge
+  taken.clear();
+  int n = 0;
+  bool need_policy = false;
+  for (int i=0; i<n_slots; ++i) {
+    auto& s = header->slot(i);
+    if (s.state.load(std::memory_order_acquire) != shm::Submitted)
+      continue;
+    if (! taken.empty() && n + s.n > max_batch)
+      continue;
+    s.state.store(shm::Running);
+    taken.push_back(i);
+    n += s.n;
+    need_policy |= (bool)s.need_policy;
+  }
+  input.resize(n * ml::input_unit);
+  policy.resize(need_policy ? n : 0);
+  value.resize(n);
+  int offset = 0;
+  for (int i: taken) {
+    auto& s = header->slot(i);
+    std::memcpy(&input[offset*ml::input_unit], s.input(), s.n*ml::input_unit);
+    offset += s.n;
+  }
+  // (4) infer and scatter
+  auto finish = [&](bool error) {
+    for (int i: taken) {
+      auto& s = header->slot(i);
+      s.error = error;
+      s.state.store(shm::Done, std::memory_order_release);
+      shm::wake_all(s.state);
+    }
+  };
+  try {
+    model.batch_infer(input, policy, value);
+  }
+  catch (...) {
+    finish(true);
+    throw;
+  }
+  offset = 0;
+  for (int i: taken) {
+    auto& s = header->slot(i);
+    if (s.need_policy)
+      std::memcpy(s.policy(capacity), &policy[offset], s.n*sizeof(policy_logits_t));
+    std::memcpy(s.value(capacity), &value[offset], s.n*sizeof(value_vector_t));
+    offset += s.n;
+  }
+  finish(false);
+  ++batches;
+  requests += taken.size();
+  positions += n;
+  return n;
+}
+
+osl::ShmInferenceStats osl::ShmInferenceServer::stats() const {
+  return { batches, requests, positions };
+}
+
+
+osl::ShmInferenceClient::ShmInferenceClient(std::string name) {
+  name = shm::segment_name(name);
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    throw std::runtime_error("ShmInferenceClient cannot open " + name + " " + std::strerror(errno));
+  struct stat st;
+  void *ptr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(shm::Header)) {
+    shm_size = st.st_size;
+    ptr = mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (ptr == MAP_FAILED)
+    throw std::runtime_error("ShmInferenceClient cannot map " + name);
+  header = static_cast<shm::Header*>(ptr);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header->magic != shm::magic) {
+    munmap(ptr, shm_size);
+    throw std::runtime_error("ShmInferenceClient server not ready " + name);
+  }
+  for (slot=0; slot<(int)header->n_slots; ++slot) {
+    uint32_t expected = shm::Free;
+    if (header->slot(slot).state.compare_exchange_strong(expected, shm::Idle)) {
+      header->slot(slot).owner.store(getpid());
+      return;
+    }
+  }
+  munmap(ptr, shm_size);
+  throw std::runtime_error("ShmInferenceClient no free slot in " + name);
+}
+
+osl::ShmInferenceClient::~ShmInferenceClient() {
+  header->slot(slot).owner.store(0);
+  header->slot(slot).state.store(shm::Free);
+  munmap(header, shm_size);
+}
+
+int osl::ShmInferenceClient::slot_capacity() const {
+  return header->slot_capacity;
+}
+
+void osl::ShmInferenceClient::batch_infer(std::vector<nn_input_element>& in,
+                                          std::vector<policy_logits_t>& policy_out,
+                                          std::vector<value_vector_t>& vout) {
+  const int N = in.size() / ml::input_unit, capacity = header->slot_capacity;
+  const bool need_policy = ! policy_out.empty();
+  if (vout.size() != N || (need_policy && policy_out.size() != N))
+    throw std::invalid_argument("ShmInferenceClient::batch_infer size mismatch");
+  auto& s = header->slot(slot);
+  for (int offset=0; offset<N; offset+=capacity) {
+    const int n = std::min(capacity, N - offset);
+    std::memcpy(s.input(), &in[offset*ml::input_unit], n*ml::input_unit);
+    s.n = n;
+    s.need_policy = need_policy;
+    s.error = 0;
+    s.state.store(shm::Submitted, std::memory_order_release);
+    header->doorbell.fetch_add(1, std::memory_order_release);
+    shm::wake_all(header->doorbell);
+    while (true) {
+      auto state = s.state.load(std::memory_order_acquire);
+      if (state == shm::Done)
+        break;
+      if (header->closed.load())
+        throw std::runtime_error("ShmInferenceClient server closed");
+      shm::wait_on(s.state, state, 100000);
+    }
+    s.state.store(shm::Idle);
+    if (s.error)
+      throw std::runtime_error("ShmInferenceClient inference failed in server");
+    if (need_policy)
+      std::memcpy(&policy_out[offset], s.policy(capacity), n*sizeof(policy_logits_t));
+    std::memcpy(&vout[offset], s.value(capacity), n*sizeof(value_vector_t));
+  }
+}
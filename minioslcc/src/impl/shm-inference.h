@@ -0,0 +1,99 @@
+#ifndef MINIOSL_SHM_INFERENCE_H
+#define MINIOSL_SHM_INFERENCE_H
+
+#include "infer.h"
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+namespace osl {
+  namespace shm { struct Header; struct Slot; }
+  /** counters of ShmInferenceServer */
+  struct ShmInferenceStats {
+    uint64_t batches = 0, requests = 0, positions = 0;
+    double mean_batch() const { return batches ? 1.0*positions/batches : 0.0; }
+  };
+
+  /**
+   * inference server shared by self-play processes on the same host.
+   *
+   * The server creates a POSIX shared memory segment `name` with `n_slots` request slots,
+   * each of which is attached by one ShmInferenceClient.
+   * Requests submitted at around the same time are merged into a single `model.batch_infer`,
+   * i.e., the server waits until every attached client has submitted, the batch reaches
+   * `max_batch`, or `max_wait_us` elapsed since the first request.
+   * Waiting is by futex on linux.
+   * A slot left by a client process exited without closing is freed at the next serve_once,
+   * once the process is reaped (clients must be in the same pid namespace).
+   */
+  class ShmInferenceServer {
+  public:
+    /** @param slot_capacity maximum number of positions sent by a client at once, larger requests are split */
+    ShmInferenceServer(std::string name, InferenceModel& model,
+                       int n_slots=16, int slot_capacity=1024,
+                       int max_batch=4096, int max_wait_us=1000);
+    /** stop, and remove the shared memory segment */
+    ~ShmInferenceServer();
+    ShmInferenceServer(const ShmInferenceServer&) = delete;
+    ShmInferenceServer& operator=(const ShmInferenceServer&) = delete;
+
+    /** start a background thread running serve_once */
+    void start();
+    void stop();
+    /**
+     * merge and process requests submitted so far
+     * @param timeout_us time to wait for the first request
+     * @return number of positions processed
+     */
+    int serve_once(int timeout_us=100000);
+
+    ShmInferenceStats stats() const;
+    const std::string& name() const { return shm_name; }
+    /** number of clients currently attached, including exited ones not yet reclaimed */
+    int n_clients() const;
+  private:
+    /** free slots whose owner process has gone */
+    void reclaim_slots();
+    std::string shm_name;
+    InferenceModel& model;
+    const int max_batch, max_wait_us;
+    size_t shm_size;
+    shm::Header *header;
+    std::thread worker;
+    std::atomic<bool> running = false;
+    std::atomic<uint64_t> batches = 0, requests = 0, positions = 0;
+    std::mutex serving;
+    // work area
+    std::vector<int> taken;
+    std::vector<nn_input_element> input;
+    std::vector<policy_logits_t> policy;
+    std::vector<value_vector_t> value;
+  };
+
+  /**
+   * InferenceModel forwarding `batch_infer` to ShmInferenceServer.
+   * Each instance occupies a slot of the server, so one instance per GameArray is expected.
+   */
+  class ShmInferenceClient : public InferenceModel {
+  public:
+    /** @throw std::runtime_error if the server does not exist or has no free slots */
+    explicit ShmInferenceClient(std::string name);
+    ~ShmInferenceClient();
+    ShmInferenceClient(const ShmInferenceClient&) = delete;
+    ShmInferenceClient& operator=(const ShmInferenceClient&) = delete;
+
+    void batch_infer(std::vector<nn_input_element>& in,
+                     std::vector<policy_logits_t>& policy_out,
+                     std::vector<value_vector_t>& vout) override;
+    int slot_capacity() const;
+    int slot_id() const { return slot; }
+  private:
+    size_t shm_size;
+    shm::Header *header;
+    int slot;
+  };
+}
+
+#endif
+// MINIOSL_SHM_INFERENCE_H
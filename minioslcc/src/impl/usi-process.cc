@@ -0,0 +1,154 @@
+#include "impl/usi-process.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <pthread.h>
+
+osl::UsiProcess::UsiProcess(const std::vector<std::string>& path_and_args,
+                            const std::vector<std::string>& setoptions,
+                            const std::string& cwd) {
+  if (path_and_args.empty())
+    throw std::invalid_argument("UsiProcess empty command");
+  int in[2], out[2];            // [0] read, [1] write
+  if (pipe2(in, O_CLOEXEC) != 0)
+    throw std::runtime_error("UsiProcess pipe " + std::string(std::strerror(errno)));
+  if (pipe2(out, O_CLOEXEC) != 0) {
+    close(in[0]); close(in[1]);
+    throw std::runtime_error("UsiProcess pipe " + std::string(std::strerror(errno)));
+  }
+  std::vector<char*> argv;
+  for (auto& s: path_and_args)
+    argv.push_back(const_cast<char*>(s.c_str()));
+  argv.push_back(nullptr);
+
+  pid = fork();
+  if (pid < 0) {
+    close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+    throw std::runtime_error("UsiProcess fork " + std::string(std::strerror(errno)));
+  }
+  if (pid == 0) {
+    // child: only async-signal-safe calls until exec
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    if (! cwd.empty() && chdir(cwd.c_str()) != 0)
+      _exit(127);
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  to_engine = in[1];
+  from_engine = fdopen(out[0], "r");
+
+  try {
+    writeline("usi");
+    for (auto line = readline(); line != "usiok"; line = readline()) {
+      if (line.starts_with("id name "))
+        id_name = line.substr(8);
+    }
+    for (auto& line: setoptions)
+      writeline(line);
+    writeline("isready");
+    auto ready = readline();
+    while (ready.starts_with("info"))
+      ready = readline();
+    if (! ready.starts_with("readyok"))
+      throw std::runtime_error("UsiProcess readyok != " + ready);
+  }
+  catch (...) {
+    // no quit, the engine may be gone
+    close(to_engine);
+    to_engine = -1;
+    kill(pid, SIGTERM);
+    shutdown();
+    throw;
+  }
+}
+
+osl::UsiProcess::~UsiProcess() {
+  shutdown();
+}
+
+void osl::UsiProcess::shutdown() {
+  if (to_engine >= 0) {
+    try {
+      writeline("quit");
+    }
+    catch (...) {
+    }
+    close(to_engine);
+    to_engine = -1;
+  }
+  if (from_engine) {
+    fclose(from_engine);
+    from_engine = nullptr;
+  }
+  if (pid > 0) {
+    int status;
+    waitpid(pid, &status, 0);
+    pid = -1;
+  }
+}
+
+void osl::UsiProcess::writeline(const std::string& line) {
+  std::string buf = line + "\n";
+  const char *p = buf.data();
+  size_t rest = buf.size();
+  // report a dead engine by EPIPE rather than being killed by SIGPIPE:
+  // block SIGPIPE in this thread during the write and consume the one it raised,
+  // leaving the process-wide disposition untouched
+  sigset_t sigpipe, old_mask, pending;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  sigpending(&pending);
+  const bool was_pending = sigismember(&pending, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+  int error = 0;
+  while (rest > 0) {
+    auto n = write(to_engine, p, rest);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      error = (n < 0) ? errno : EIO;
+      break;
+    }
+    p += n;
+    rest -= n;
+  }
+  if (error == EPIPE && ! was_pending) {
+    const timespec zero = {0, 0};
+    while (sigtimedwait(&sigpipe, nullptr, &zero) < 0 && errno == EINTR)
+      ;
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  if (error)
+    throw std::runtime_error("UsiProcess write " + std::string(std::strerror(error)));
+}
+
+std::string osl::UsiProcess::readline() {
+  std::string line;
+  int c;
+  while ((c = getc(from_engine)) != EOF && c != '\n')
+    line += c;
+  if (c == EOF && line.empty())
+    throw std::runtime_error("UsiProcess engine closed " + id_name);
+  while (! line.empty() && (line.back() == '\r' || line.back() == ' '))
+    line.pop_back();
+  return line;
+}
+
+std::string osl::UsiProcess::search(const std::string& position, const std::string& limit) {
+  writeline("position " + position);
+  writeline("go " + limit);
+  while (true) {
+    auto line = readline();
+    if (! line.starts_with("bestmove "))
+      continue;
+    auto move = line.substr(9);
+    return move.substr(0, move.find(' ')); // drop ponder
+  }
+}
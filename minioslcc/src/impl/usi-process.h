@@ -0,0 +1,49 @@
+#ifndef MINIOSL_USI_PROCESS_H
+#define MINIOSL_USI_PROCESS_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace osl {
+  /**
+   * external usi engine connected by pipes, counterpart of `miniosl.UsiProcess` in python.
+   *
+   * The constructor spawns the process and waits for `readyok`.
+   * An instance must not be used by more than one thread at a time.
+   */
+  class UsiProcess {
+  public:
+    UsiProcess(const std::vector<std::string>& path_and_args,
+               const std::vector<std::string>& setoptions,
+               const std::string& cwd="");
+    /** send quit and wait for the process */
+    ~UsiProcess();
+    UsiProcess(const UsiProcess&) = delete;
+    UsiProcess& operator=(const UsiProcess&) = delete;
+
+    /** @throw std::runtime_error if the engine has gone (SIGPIPE is blocked in the calling thread meanwhile) */
+    void writeline(const std::string& line);
+    /** @throw std::runtime_error if the engine closed its output */
+    std::string readline();
+    /**
+     * give position with go command, and wait `bestmove`
+     * @param position e.g., `startpos moves 7g7f`
+     * @param limit e.g., `byoyomi 1000`
+     * @return the move following `bestmove`, e.g., `3c3d` or `resign`
+     */
+    std::string search(const std::string& position, const std::string& limit);
+    /** name given by `id name`, or empty */
+    const std::string& name() const { return id_name; }
+  private:
+    void shutdown();
+
+    int pid = -1;
+    int to_engine = -1;
+    FILE *from_engine = nullptr;
+    std::string id_name;
+  };
+}
+
+#endif
+// MINIOSL_USI_PROCESS_H
@@ -4,8 +4,12 @@
 #include <cista/containers/hash_map.h>
 #include <cista/containers/pair.h>
 #include <cista/mode.h>
+#include <atomic>
 #include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <queue>
 
 namespace osl {
   namespace data = cista::offset;
@@ -19,7 +23,7 @@ struct osl::OpeningTree::Data {
   static key_t make(const BasicHash& key) { return key_t{key.first, key.second}; }
   typedef data::hash_map<key_t, Node> table_t;
   std::shared_ptr<cista::mmap> buf; // table is not writable if notnull
-  cista::mmap::protection protection_mode;
+  cista::mmap::protection protection_mode = cista::mmap::protection::MODIFY;
   std::optional<table_t> local_table; // table is editable notnull
   table_t *table;
 
@@ -53,7 +57,14 @@ osl::OpeningTree::read(BasicHash key) const {
   auto p = data->find(key);
   if (p == data->end())
     return std::nullopt;
-  return p->second;
+  auto& node = p->second;
+  Node ret;
+  for (int i=0; i<GameResultTypes; ++i)
+    ret.result_count[i] = std::atomic_ref<int>(node.result_count[i]).load(std::memory_order_relaxed);
+  ret.black_value_backup = node.black_value_backup;
+  ret.depth = node.depth;
+  ret.age = node.age;
+  return ret;
 }
 
 std::optional<osl::OpeningTree::Node*>
@@ -66,6 +77,18 @@ osl::OpeningTree::edit(BasicHash key) const {
   return &(p->second);
 }
 
+std::optional<osl::OpeningTree::Node*>
+osl::OpeningTree::add_visit(const BasicHash& key, GameResult result) const {
+  auto node = edit(key);
+  if (node)
+    add_visit(**node, result);
+  return node;
+}
+
+void osl::OpeningTree::add_visit(Node& node, GameResult result) {
+  std::atomic_ref<int>(node.result_count[result]).fetch_add(1, std::memory_order_relaxed);
+}
+
 std::shared_ptr<osl::OpeningTree> osl::OpeningTree::load_binary(std::string filename, int threshold, bool modify) {
   try {
     auto mode = modify ? cista::mmap::protection::MODIFY : cista::mmap::protection::READ;
@@ -106,6 +129,173 @@ void osl::OpeningTree::prune(int threshold, std::string output) const {
   cista::serialize<MODE>(mmap, pruned);  
 }
 
+namespace osl {
+  namespace opening_run {
+    void write(const std::string& path, const std::vector<Entry>& entries) {
+      std::ofstream os(path, std::ios::binary);
+      const uint64_t header[header_words] = { magic, version, entries.size(), sizeof(Entry) };
+      os.write(reinterpret_cast<const char*>(header), sizeof(header));
+      os.write(reinterpret_cast<const char*>(entries.data()), entries.size()*sizeof(Entry));
+      if (! os)
+        throw std::runtime_error("opening_run write error " + path);
+    }
+
+    /** sequential reader of a run with a fixed buffer */
+    class Reader {
+      std::ifstream is;
+      std::vector<Entry> buf;
+      size_t remaining = 0, pos = 0;
+      const std::string path;
+    public:
+      static constexpr size_t buffer_entries = 4096;
+      explicit Reader(const std::string& path) : is(path, std::ios::binary), path(path) {
+        uint64_t header[header_words];
+        if (! is.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != magic)
+          throw std::domain_error("opening_run not a run file " + path);
+        if (header[1] != version || header[3] != sizeof(Entry))
+          throw std::domain_error("opening_run unsupported version " + std::to_string(header[1]));
+        remaining = header[2];
+        fill();
+      }
+      bool empty() const { return pos == buf.size(); }
+      const Entry& front() const { return buf[pos]; }
+      void pop() {
+        if (++pos == buf.size())
+          fill();
+      }
+    private:
+      void fill() {
+        buf.resize(std::min(remaining, buffer_entries));
+        pos = 0;
+        if (buf.empty())
+          return;
+        if (! is.read(reinterpret_cast<char*>(buf.data()), buf.size()*sizeof(Entry)))
+          throw std::domain_error("opening_run truncated " + path);
+        remaining -= buf.size();
+      }
+    };
+  }
+}
+
+void osl::opening_run::accumulate(OpeningTree::Node& acc, const OpeningTree::Node& node) {
+  for (int i=0; i<GameResultTypes; ++i)
+    acc.result_count[i] += node.result_count[i];
+  acc.depth = std::min(acc.depth, node.depth);
+  if (node.age > acc.age) {
+    acc.age = node.age;
+    acc.black_value_backup = node.black_value_backup;
+  }
+}
+
+size_t osl::opening_run::merge(const std::vector<std::string>& inputs, const std::string& output,
+                               int threshold) {
+  std::vector<std::unique_ptr<Reader>> readers;
+  for (const auto& path: inputs)
+    readers.emplace_back(new Reader(path));
+  // entries of the same key are taken in the order of inputs
+  auto greater = [&](int l, int r) {
+    const auto& lf = readers[l]->front(), & rf = readers[r]->front();
+    return rf < lf || (! (lf < rf) && r < l);
+  };
+  std::priority_queue<int, std::vector<int>, decltype(greater)> heap(greater);
+  for (int i=0; i<readers.size(); ++i)
+    if (! readers[i]->empty())
+      heap.push(i);
+
+  std::ofstream os(output, std::ios::binary);
+  uint64_t header[header_words] = { magic, version, 0, sizeof(Entry) };
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+  std::vector<Entry> out;
+  out.reserve(Reader::buffer_entries);
+  auto flush = [&]() {
+    os.write(reinterpret_cast<const char*>(out.data()), out.size()*sizeof(Entry));
+    out.clear();
+  };
+  size_t count = 0;
+  auto pop = [&]() {
+    int i = heap.top();
+    heap.pop();
+    auto ret = readers[i]->front();
+    readers[i]->pop();
+    if (! readers[i]->empty())
+      heap.push(i);
+    return ret;
+  };
+  while (! heap.empty()) {
+    Entry acc = pop();
+    // the same key appears at most once in each run
+    while (! heap.empty() && readers[heap.top()]->front().key() == acc.key())
+      accumulate(acc.node, pop().node);
+    if (acc.node.count() < threshold)
+      continue;
+    out.push_back(acc);
+    ++count;
+    if (out.size() == Reader::buffer_entries)
+      flush();
+  }
+  flush();
+  header[2] = count;
+  os.seekp(0);
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+  if (! os)
+    throw std::runtime_error("opening_run write error " + output);
+  return count;
+}
+
+std::vector<std::string> osl::OpeningTree::save_sorted_runs(std::string prefix, size_t run_size) const {
+  if (run_size == 0)
+    throw std::invalid_argument("save_sorted_runs run_size");
+  std::vector<std::string> paths;
+  std::vector<opening_run::Entry> entries;
+  entries.reserve(std::min(run_size, size()));
+  auto flush = [&]() {
+    std::sort(entries.begin(), entries.end());
+    paths.push_back(prefix + "-" + std::to_string(paths.size()) + ".run");
+    opening_run::write(paths.back(), entries);
+    entries.clear();
+  };
+  for (const auto& [key, node]: *(data->table)) {
+    entries.push_back({key.first, key.second, 0, node});
+    if (entries.size() == run_size)
+      flush();
+  }
+  if (! entries.empty() || paths.empty())
+    flush();
+  return paths;
+}
+
+size_t osl::OpeningTree::build_binary(std::string run, std::string filename) {
+  opening_run::Reader reader(run);
+  Data::table_t table;
+  for (; ! reader.empty(); reader.pop()) {
+    const auto& e = reader.front();
+    table.insert({Data::make(e.key()), e.node});
+  }
+  cista::buf mmap{cista::mmap{filename.c_str()}};
+  cista::serialize<MODE>(mmap, table);
+  return table.size();
+}
+
+size_t osl::OpeningTree::merge_binary(const std::vector<std::string>& books, std::string output,
+                                      int threshold, std::string work_dir, size_t run_size) {
+  namespace fs = std::filesystem;
+  const bool cleanup = work_dir.empty();
+  if (cleanup)
+    work_dir = output + ".runs";
+  fs::create_directories(work_dir);
+  std::vector<std::string> runs;
+  for (size_t i=0; i<books.size(); ++i) {
+    auto book = load_binary(books[i], 1, false);
+    auto paths = book->save_sorted_runs((fs::path(work_dir) / std::to_string(i)).string(), run_size);
+    runs.insert(runs.end(), paths.begin(), paths.end());
+  }
+  auto merged = (fs::path(work_dir) / "merged.run").string();
+  opening_run::merge(runs, merged, threshold);
+  auto ret = build_binary(merged, output);
+  if (cleanup)
+    fs::remove_all(work_dir);
+  return ret;
+}
 
 osl::OpeningTree::tuple_t
 osl::OpeningTree::export_all() const {
@@ -9,6 +9,17 @@
 namespace osl {
   class SubRecord;
   class OpeningTreeEditable;
+  /**
+   * table of positions with game results, used as an opening book.
+   *
+   * Concurrency: add_visit(), read() and the methods built on read() may be called from
+   * multiple threads while the set of keys is fixed, e.g., by players sharing a book in
+   * run_range_parallel workers.  Each count in `Node::result_count` is then accessed as
+   * a relaxed atomic (std::atomic_ref), so no increment is lost and a reader sees a value
+   * in between, but there is no ordering among counts or nodes.  The counts are exact
+   * after the threads are joined.  Other fields and methods changing keys
+   * (OpeningTreeEditable) must not be used concurrently.
+   */
   class OpeningTree {
   protected:
     class Data;
@@ -48,6 +59,12 @@ namespace osl {
     size_t root_count() const;
 
     std::optional<Node*> edit(BasicHash key) const; // effective only mapping with modify
+    /** add a count of `result` to an existing node, safe for concurrent use (see above)
+     * @return the node, or nullopt if the key is absent or the table is mapped read-only
+     */
+    std::optional<Node*> add_visit(const BasicHash& key, GameResult result=InGame) const;
+    /** add a count to a node obtained by edit(), the same as add_visit() without lookup */
+    static void add_visit(Node& node, GameResult result=InGame);
 
     /** compute visit counts for each move, returning their sum */
     size_t count_visits(const BasicHash& key, const MoveVector& arms, std::vector<size_t>& out) const;
@@ -58,6 +75,22 @@ namespace osl {
     /** prune table entries by visit counts to save */
     void prune(int threshold, std::string output) const;
 
+    /** write all nodes as sorted runs (see `opening_run`) of at most `run_size` entries each
+     * @return paths of the runs, `prefix` followed by "-<i>.run"
+     */
+    std::vector<std::string> save_sorted_runs(std::string prefix, size_t run_size=(1ul << 24)) const;
+    /** save a book file built from a sorted run, holding only the nodes of the run in memory
+     * @return number of nodes
+     */
+    static size_t build_binary(std::string run, std::string filename);
+    /**
+     * merge book files into `output` by runs in `work_dir` (`output` + ".runs" if empty, removed afterwards).
+     * Each input is mapped read-only and only the merged book is held in memory.
+     * @return number of nodes in the output
+     */
+    static size_t merge_binary(const std::vector<std::string>& books, std::string output,
+                               int threshold=1, std::string work_dir="", size_t run_size=(1ul << 24));
+
     typedef std::tuple<
       std::vector<uint64_t>, std::vector<uint32_t>, std::vector<int>,
       std::vector<int>, std::vector<float>
@@ -88,6 +121,40 @@ namespace osl {
     static OpeningTreeEditable from_record_set(const RecordSet&, int minimum_count);
     static OpeningTreeEditable restore_from(const tuple_t&);
   };
+
+  /**
+   * sorted runs of OpeningTree nodes on disk, to combine books larger than memory.
+   *
+   * Layout: header of `header_words` uint64_t (magic, version, number of entries, sizeof(Entry)),
+   * followed by Entry in the ascending order of keys without duplicates.
+   */
+  namespace opening_run {
+    constexpr uint64_t magic = 0x314e524f4c534f4dull; // "MOSLORN1" in little endian
+    constexpr uint64_t version = 1;
+    constexpr int header_words = 4;
+    struct Entry {
+      uint64_t board;
+      uint32_t stand, reserved;
+      OpeningTree::Node node;
+
+      BasicHash key() const { return {board, stand}; }
+      bool operator<(const Entry& r) const {
+        return std::tie(board, stand) < std::tie(r.board, r.stand);
+      }
+    };
+    static_assert(sizeof(Entry) == 40);
+
+    /** combine nodes of the same key: sum of counts, minimum depth, and the latest age with its value
+     * (the earlier one is kept for a tie)
+     */
+    void accumulate(OpeningTree::Node& acc, const OpeningTree::Node& node);
+    /**
+     * k-way merge of sorted runs into a run, reading each input sequentially with a small buffer.
+     * Merged nodes with counts less than `threshold` are dropped.
+     * @return number of entries written
+     */
+    size_t merge(const std::vector<std::string>& inputs, const std::string& output, int threshold=1);
+  }
 }
 
 #endif
@@ -5,9 +5,13 @@
 #include <pybind11/stl_bind.h>
 #include <pybind11/operators.h>
 #include "game.h"
+#include "impl/shm-inference.h"
+#include "impl/cpu-inference.h"
+#include "impl/indexed-record.h"
 #include "infer.h"
 #include "feature.h"
 #include <iostream>
+#include <cstring>
 
 namespace pyosl {
   using namespace osl;
@@ -21,7 +25,12 @@ namespace pyosl {
   typedef std::tuple<np_float_t, np_float_t, np_float_t> infer_tuple_t;
   class InferenceModelStub : public InferenceModel {
   public:
-    using InferenceModel::InferenceModel;
+    /**
+     * @param inplace call `py_infer_inplace` with numpy views of the buffers given to `batch_infer`,
+     * instead of `py_infer` with copies
+     */
+    explicit InferenceModelStub(bool inplace=false) : inplace(inplace) {
+    }
     void test_run(std::vector<nn_input_element>& in,
                   std::vector<policy_logits_t>& policy_out,
                   std::vector<value_vector_t>& vout) override {
@@ -39,25 +48,57 @@ namespace pyosl {
                                     + " " + std::to_string(policy_out.size())
                                     + " " + std::to_string(vout.size())
                                     );
+      // GameArray.step runs without GIL so that python SingleCPUPlayers can work in parallel
+      py::gil_scoped_acquire gil;
+      if (inplace) {
+        py_infer_inplace(view(in.data(), {(py::ssize_t)in.size()}),
+                         view(policy_out.empty() ? nullptr : policy_out[0].data(),
+                              {(py::ssize_t)policy_out.size(), osl::ml::policy_unit}),
+                         view(vout.empty() ? nullptr : vout[0].data(),
+                              {sz, (py::ssize_t)std::tuple_size_v<value_vector_t>}));
+        return;
+      }
       nparray<int8_t> feature(in.size());
-      auto ptr = feature.ptr();
-      std::copy(in.begin(), in.end(), ptr);
-      auto [policy, value, aux] = py_infer(feature.array);
-      if (! policy_out.empty()) {
-        auto pb = policy.request();
-        auto pptr = static_cast<float*>(pb.ptr);
-        for (size_t i=0; i<sz; ++i)
-          for (size_t j=0; j<policy_out[0].size(); ++j)
-            policy_out[i][j] = pptr[i*policy_out[0].size() + j];
+      {
+        py::gil_scoped_release nogil;
+        std::copy(in.begin(), in.end(), feature.ptr());
       }
-      
-      auto vb = value.request();
-      auto vptr = static_cast<float*>(vb.ptr);
-      for (size_t i=0; i<sz; ++i)
-        for (size_t j=0; j<vout[0].size(); ++j)
-          vout[i][j] = vptr[i*vout[0].size() + j];
+      auto [policy, value, aux] = py_infer(feature.array);
+      if (! policy_out.empty())
+        copy_result(policy, policy_out[0].data(), sz*osl::ml::policy_unit);
+      if (sz > 0)
+        copy_result(value, vout[0].data(), sz*std::tuple_size_v<value_vector_t>);
     }
     virtual infer_tuple_t py_infer(py::array_t<int8_t>) =0;
+    /**
+     * write the results into `policy` and `value` of shape (N, 2187) and (N, 4).
+     * `policy` is empty if only value is needed.
+     * The arrays borrow the buffers of the caller, so do not keep them after return.
+     * The default implementation delegates to `py_infer`.
+     */
+    virtual void py_infer_inplace(py::array_t<int8_t> features,
+                                  py::array_t<float> policy, py::array_t<float> value) {
+      auto [p, v, aux] = py_infer(features);
+      if (policy.size() > 0)
+        copy_result(p, policy.mutable_data(), policy.size());
+      copy_result(v, value.mutable_data(), value.size());
+    }
+  private:
+    /** numpy array borrowing `ptr` */
+    template <class T>
+    py::array_t<T> view(T *ptr, std::vector<py::ssize_t> shape) {
+      static T empty[1];
+      return py::array_t<T>(shape, ptr ? ptr : empty, py::capsule(this, [](void *) {}));
+    }
+    static void copy_result(const np_float_t& src, float *dst, size_t count) {
+      if (src.size() < count)
+        throw std::length_error("batch_infer: short result " + std::to_string(src.size())
+                                + " < " + std::to_string(count));
+      auto ptr = src.data();
+      py::gil_scoped_release nogil;
+      std::memcpy(dst, ptr, count*sizeof(float));
+    }
+    bool inplace;
   };
 
   class PyInferenceModelStub : public InferenceModelStub {
@@ -72,6 +113,16 @@ namespace pyosl {
          inputs      /* Argument(s) */
         );
     }
+    void py_infer_inplace(py::array_t<int8_t> features,
+                          py::array_t<float> policy, py::array_t<float> value) override {
+      PYBIND11_OVERRIDE
+        (
+         void, /* Return type */
+         InferenceModelStub,      /* Parent class */
+         py_infer_inplace,          /* Name of function in C++ (must match Python name) */
+         features, policy, value      /* Argument(s) */
+        );
+    }
   };
 
   class PySingleCPUPlaer : public SingleCPUPlayer {
@@ -107,6 +158,7 @@ void pyosl::init_game(py::module_& m) {
     .def_readonly("record", &osl::GameManager::record)
     .def_readonly("state", &osl::GameManager::state)
     .def_readonly("legal_moves", &osl::GameManager::legal_moves)
+    .def_readonly("rng_key", &osl::GameManager::rng_key)
     .def("make_move", &osl::GameManager::make_move)
     .def("export_heuristic_feature8", &pyosl::export_heuristic_feature8)
     .def("export_heuristic_feature16", &pyosl::export_heuristic_feature16)
@@ -119,6 +171,8 @@ void pyosl::init_game(py::module_& m) {
     .def(py::init<int,std::optional<osl::GameConfig>>(), "N"_a, "config"_a=std::nullopt)
     .def_readonly("games", &osl::ParallelGameManager::games)
     .def_readonly("completed_games", &osl::ParallelGameManager::completed_games)
+    .def_readonly("completed_count", &osl::ParallelGameManager::completed_count)
+    .def_readwrite("sink", &osl::ParallelGameManager::sink)
     .def("make_move_parallel", &osl::ParallelGameManager::make_move_parallel)
     .def("export_heuristic_feature_parallel", &pyosl::export_heuristic_feature_parallel)
     .def("n_parallel", &osl::ParallelGameManager::n_parallel)
@@ -128,6 +182,7 @@ void pyosl::init_game(py::module_& m) {
     .def_readonly("greedy", &osl::PlayerArray::greedy)
     .def("n_parallel", &osl::PlayerArray::n_parallel)
     .def("new_series", &osl::PlayerArray::new_series)
+    .def("advance", &osl::PlayerArray::advance, "moves"_a)
     .def("decision", &osl::PlayerArray::decision)
     ;
 
@@ -148,6 +203,9 @@ void pyosl::init_game(py::module_& m) {
     .def_readwrite("book_path", &osl::GumbelPlayerConfig::book_path)
     .def_readwrite("book_weight_p", &osl::GumbelPlayerConfig::book_weight_p)
     .def_readwrite("book_weight_v", &osl::GumbelPlayerConfig::book_weight_v)
+    .def_readwrite("n_simulations", &osl::GumbelPlayerConfig::n_simulations)
+    .def_readwrite("child_width", &osl::GumbelPlayerConfig::child_width)
+    .def_readwrite("reuse_tree", &osl::GumbelPlayerConfig::reuse_tree)
     ;
 
   py::class_<osl::FlatGumbelPlayer, osl::PlayerArray>(m, "FlatGumbelPlayer", py::dynamic_attr())
@@ -155,12 +213,23 @@ void pyosl::init_game(py::module_& m) {
     .def("name", &osl::FlatGumbelPlayer::name)
     ;
 
+  py::class_<osl::SequentialHalvingPlayer, osl::PlayerArray>(m, "SequentialHalvingPlayer", py::dynamic_attr(),
+                                                             "Gumbel MuZero player with sequential halving\n\n"
+                                                             ":param config: `root_width` and `n_simulations` define the budget")
+    .def(py::init<osl::GumbelPlayerConfig>(), "config"_a)
+    .def("name", &osl::SequentialHalvingPlayer::name)
+    .def("simulation_schedule", &osl::SequentialHalvingPlayer::simulation_schedule)
+    ;
+
   py::class_<osl::CPUPlayer, osl::PlayerArray>(m, "CPUPlayer", py::dynamic_attr(), "adaptor for PlayerArray\n\n"
                                                ":param player: object descendant of `SingleCPUPlayer`\n"
                                                ":param greedy: indicating greedy behavior\n\n"
                                                ".. note:: if you give a `player` implemented in Python, please make sure its lifetime")
     .def(py::init<std::shared_ptr<osl::SingleCPUPlayer>, bool>(), "player"_a, "greedy"_a)
+    .def(py::init<std::vector<std::shared_ptr<osl::SingleCPUPlayer>>, bool>(), "pool"_a, "greedy"_a,
+         "dispatch games concurrently to players in `pool`, e.g., UsiEnginePlayers")
     .def("name", &osl::CPUPlayer::name)
+    .def("pool_size", &osl::CPUPlayer::pool_size)
     ;
 
   py::class_<osl::SingleCPUPlayer, pyosl::PySingleCPUPlaer, std::shared_ptr<osl::SingleCPUPlayer>>(m, "SingleCPUPlayer", py::dynamic_attr())
@@ -175,12 +244,53 @@ void pyosl::init_game(py::module_& m) {
     .def("think", &osl::RandomPlayer::think)
     ;
 
+  py::class_<osl::AlphaBetaPlayer, osl::SingleCPUPlayer, std::shared_ptr<osl::AlphaBetaPlayer>>
+    (m, "AlphaBetaPlayer", py::dynamic_attr(),
+     "alpha-beta search with material and piece-square evaluation, no neural networks\n\n"
+     ":param depth: maximum depth of iterative deepening\n"
+     ":param node_limit: nodes searched for a move\n"
+     ":param randomize: break ties of root moves randomly\n")
+    .def(py::init<int, uint64_t, bool>(), "depth"_a=3, "node_limit"_a=100000, "randomize"_a=true)
+    .def("name", &osl::AlphaBetaPlayer::name)
+    .def("think", &osl::AlphaBetaPlayer::think, py::call_guard<py::gil_scoped_release>())
+    .def("last_score", &osl::AlphaBetaPlayer::last_score)
+    .def("last_nodes", &osl::AlphaBetaPlayer::last_nodes)
+    ;
+
+  py::class_<osl::UsiEnginePlayer, osl::SingleCPUPlayer, std::shared_ptr<osl::UsiEnginePlayer>>
+    (m, "UsiEnginePlayer", py::dynamic_attr(),
+     "external usi engine run as a subprocess, an alternative to `UsiPlayer` implemented in C++\n\n"
+     ":param path_and_args: command to launch the engine\n"
+     ":param setoptions: lines sent before `isready`\n"
+     ":param go: arguments of `go` command, e.g., `byoyomi 1000`\n")
+    .def(py::init<std::vector<std::string>, std::vector<std::string>, std::string, std::string>(),
+         "path_and_args"_a,
+         "setoptions"_a=std::vector<std::string>{"setoption name Threads value 1",
+                                                 "setoption name USI_Hash value 16"},
+         "go"_a="byoyomi 1000", "cwd"_a="")
+    .def("name", &osl::UsiEnginePlayer::name)
+    .def("think", &osl::UsiEnginePlayer::think, py::call_guard<py::gil_scoped_release>())
+    ;
+
   py::class_<osl::GameConfig>(m, "GameConfig")
     .def(py::init<>())
     .def_readwrite("force_declare", &osl::GameConfig::force_declare)
     .def_readwrite("ignore_draw", &osl::GameConfig::ignore_draw)
     .def_readwrite("random_opening", &osl::GameConfig::random_opening)
     .def_readwrite("variant", &osl::GameConfig::variant)
+    .def_readwrite("eval_cache_size", &osl::GameConfig::eval_cache_size)
+    .def_readwrite("batch_sizes", &osl::GameConfig::batch_sizes)
+    .def_readwrite("batch_padding", &osl::GameConfig::batch_padding)
+    .def_readwrite("seed", &osl::GameConfig::seed)
+    ;
+
+  py::class_<osl::EvalCacheStats>(m, "EvalCacheStats", "counters of the evaluation cache in :py:class:`GameArray`")
+    .def_readonly("lookups", &osl::EvalCacheStats::lookups)
+    .def_readonly("hits", &osl::EvalCacheStats::hits)
+    .def_readonly("inserts", &osl::EvalCacheStats::inserts)
+    .def_readonly("evictions", &osl::EvalCacheStats::evictions)
+    .def_readonly("batch_duplicates", &osl::EvalCacheStats::batch_duplicates)
+    .def("hit_rate", &osl::EvalCacheStats::hit_rate)
     ;
   
   py::class_<osl::GameArray>(m, "GameArray", py::dynamic_attr())
@@ -188,17 +298,189 @@ void pyosl::init_game(py::module_& m) {
          InferenceModel&, InferenceModel&,
          std::optional<GameConfig>>(),
          "N"_a, "player_a"_a, "player_b"_a, "model_a"_a, "model_b"_a, "config"_a=std::nullopt)
-    .def("step", &osl::GameArray::step)
+    .def("step", &osl::GameArray::step, py::call_guard<py::gil_scoped_release>())
     .def("completed", &osl::GameArray::completed)
     .def("warmup", &osl::GameArray::warmup, "n"_a=4)
+    .def("eval_cache_stats", &osl::GameArray::eval_cache_stats, "id"_a=0)
+    .def("batch_stats", &osl::GameArray::batch_stats, "id"_a=0)
+    .def("stats", [](const osl::GameArray& a) {
+      const auto& s = a.stats();
+      py::list players;
+      for (const auto& p: s.player) {
+        py::dict d;
+        d["steps"] = p.steps;
+        d["phases"] = p.phases;
+        d["infer_calls"] = p.infer_calls;
+        d["positions"] = p.positions;
+        d["request_seconds"] = p.request_seconds;
+        d["infer_seconds"] = p.infer_seconds;
+        d["result_seconds"] = p.result_seconds;
+        d["decision_seconds"] = p.decision_seconds;
+        d["mean_batch"] = p.mean_batch();
+        d["occupancy"] = p.occupancy();
+        players.append(d);
+      }
+      py::dict ret;
+      ret["enabled"] = s.enabled;
+      ret["steps"] = s.steps;
+      ret["moves"] = s.moves;
+      ret["games"] = s.games;
+      ret["positions"] = s.positions();
+      ret["make_move_seconds"] = s.make_move_seconds;
+      ret["total_seconds"] = s.total_seconds;
+      ret["positions_per_second"] = s.positions_per_second();
+      ret["moves_per_second"] = s.moves_per_second();
+      ret["games_per_second"] = s.games_per_second();
+      ret["occupancy"] = s.occupancy();
+      ret["player"] = players;
+      return ret;
+    }, "timing counters of step as a dict, all zero unless built with ENABLE_GAME_STATS")
+    .def("reset_stats", &osl::GameArray::reset_stats)
+    .def("n_completed", &osl::GameArray::n_completed)
+    .def("set_record_sink", &osl::GameArray::set_record_sink, "sink"_a)
+    ;
+
+  py::class_<osl::GameRecordSink, std::shared_ptr<osl::GameRecordSink>>(m, "GameRecordSink")
+    .def("flush", &osl::GameRecordSink::flush, py::call_guard<py::gil_scoped_release>())
+    ;
+
+  py::class_<osl::BitpackRecordWriter, osl::GameRecordSink, std::shared_ptr<osl::BitpackRecordWriter>>
+    (m, "BitpackRecordWriter",
+     "write completed games in binary on a background thread\n\n"
+     ":param prefix: files are named `{prefix}-{index:06d}.bin`, readable by `np.fromfile(path, dtype=np.uint64)`\n"
+     ":param records_per_file: rotate files after this number of records\n"
+     ":param max_pending: block producers if so many records are waiting\n")
+    .def(py::init<std::string, int, int>(), "prefix"_a, "records_per_file"_a=100000, "max_pending"_a=4096)
+    .def("n_written", &osl::BitpackRecordWriter::n_written)
+    .def("n_skipped", &osl::BitpackRecordWriter::n_skipped)
+    .def("result_count", &osl::BitpackRecordWriter::result_count)
+    .def("files", &osl::BitpackRecordWriter::files)
+    ;
+
+  py::class_<osl::IndexedRecordWriter, osl::GameRecordSink, std::shared_ptr<osl::IndexedRecordWriter>>
+    (m, "IndexedRecordWriter",
+     "write games in binary with an index for random access by :py:class:`IndexedRecordFile`")
+    .def(py::init<std::string>(), "path"_a)
+    .def("add", py::overload_cast<const osl::MiniRecord&>(&osl::IndexedRecordWriter::add), "record"_a)
+    .def("close", &osl::IndexedRecordWriter::close, "write the index, no records can be added afterwards")
+    .def("n_written", &osl::IndexedRecordWriter::n_written)
+    .def("n_skipped", &osl::IndexedRecordWriter::n_skipped)
+    ;
+
+  py::class_<osl::IndexedRecordFile>(m, "IndexedRecordFile",
+                                     "memory-mapped reader of a file by :py:class:`IndexedRecordWriter`")
+    .def(py::init<std::string>(), "path"_a)
+    .def("__len__", &osl::IndexedRecordFile::size)
+    .def("__getitem__", &osl::IndexedRecordFile::record, "k"_a, "decode a record as :py:class:`MiniRecord`")
+    .def("result", &osl::IndexedRecordFile::result, "k"_a)
+    .def("variant", &osl::IndexedRecordFile::variant, "k"_a)
+    .def("move_size", &osl::IndexedRecordFile::move_size, "k"_a)
+    .def("moves", &osl::IndexedRecordFile::moves, "k"_a)
     ;
   
   py::class_<osl::InferenceModel>(m, "InferenceModel")
     ;
   
   py::class_<pyosl::InferenceModelStub, pyosl::PyInferenceModelStub, osl::InferenceModel>(m, "InferenceModelStub")
-    .def(py::init<>())
+    .def(py::init<bool>(), "inplace"_a=false)
     .def("py_infer", &pyosl::InferenceModelStub::py_infer)
+    .def("py_infer_inplace", &pyosl::InferenceModelStub::py_infer_inplace,
+         "features"_a, "policy"_a, "value"_a)
+    ;
+
+  py::class_<osl::CPUInferenceModel, osl::InferenceModel>(m, "CPUInferenceModel",
+                                                          "PVNetwork evaluated on CPU in C++\n\n"
+                                                          ":param path: file made by `miniosl.inference.export_native`\n"
+                                                          ":param chunk: positions processed at once by a thread\n"
+                                                          ":param n_threads: 0 for default\n")
+    .def(py::init<std::string, int, int>(), "path"_a, "chunk"_a=8, "n_threads"_a=0)
+    .def("infer", [](osl::CPUInferenceModel& model,
+                     py::array_t<int8_t, py::array::c_style | py::array::forcecast> features) {
+      const size_t n = features.size() / osl::ml::input_unit;
+      if (features.size() != n * osl::ml::input_unit)
+        throw std::invalid_argument("size " + std::to_string(features.size()));
+      std::vector<osl::nn_input_element> in(features.data(), features.data() + features.size());
+      std::vector<osl::policy_logits_t> policy(n);
+      std::vector<osl::value_vector_t> value(n);
+      {
+        py::gil_scoped_release nogil;
+        model.batch_infer(in, policy, value);
+      }
+      py::array_t<float> policy_array({(py::ssize_t)n, (py::ssize_t)osl::ml::policy_unit});
+      py::array_t<float> value_array({(py::ssize_t)n, (py::ssize_t)std::tuple_size_v<osl::value_vector_t>});
+      std::memcpy(policy_array.mutable_data(), policy.data(), n*sizeof(osl::policy_logits_t));
+      std::memcpy(value_array.mutable_data(), value.data(), n*sizeof(osl::value_vector_t));
+      return py::make_tuple(policy_array, value_array);
+    }, "features"_a, "return (policy, value) for int8 features of shape (N, C, 9, 9)")
+    .def("channels", &osl::CPUInferenceModel::channels)
+    .def("n_blocks", &osl::CPUInferenceModel::n_blocks)
+    ;
+
+  py::class_<osl::BatchSizeStats>(m, "BatchSizeStats", "counters of :py:class:`BatchScheduler` for a batch size")
+    .def_readonly("size", &osl::BatchSizeStats::size)
+    .def_readonly("calls", &osl::BatchSizeStats::calls)
+    .def_readonly("positions", &osl::BatchSizeStats::positions)
+    .def_readonly("padded", &osl::BatchSizeStats::padded)
+    .def_readonly("seconds", &osl::BatchSizeStats::seconds)
+    .def("occupancy", &osl::BatchSizeStats::occupancy)
+    .def("mean_latency_ms", &osl::BatchSizeStats::mean_latency_ms)
+    .def("positions_per_second", &osl::BatchSizeStats::positions_per_second)
+    .def("__repr__", [](const osl::BatchSizeStats& s) {
+      return "<BatchSizeStats size=" + std::to_string(s.size) + " calls=" + std::to_string(s.calls)
+        + " occupancy=" + std::to_string(s.occupancy())
+        + " latency_ms=" + std::to_string(s.mean_latency_ms()) + ">";
+    })
+    ;
+
+  py::class_<osl::BatchScheduler, osl::InferenceModel>(m, "BatchScheduler",
+                                                       "forward requests to `model` in preferred batch sizes\n\n"
+                                                       ":param model: backend model\n"
+                                                       ":param sizes: preferred batch sizes\n"
+                                                       ":param pad: pad small batches with zeros\n"
+                                                       ":param min_occupancy: ratio of real positions required to pad to a larger size\n")
+    .def(py::init<osl::InferenceModel&, std::vector<int>, bool, double>(),
+         "model"_a, "sizes"_a, "pad"_a=true, "min_occupancy"_a=0.5,
+         py::keep_alive<1, 2>())
+    .def("plan", &osl::BatchScheduler::plan, "n"_a)
+    .def("stats", &osl::BatchScheduler::stats)
+    .def("reset_stats", &osl::BatchScheduler::reset_stats)
+    .def("preferred_sizes", &osl::BatchScheduler::preferred_sizes)
+    ;
+
+  py::class_<osl::ShmInferenceStats>(m, "ShmInferenceStats")
+    .def_readonly("batches", &osl::ShmInferenceStats::batches)
+    .def_readonly("requests", &osl::ShmInferenceStats::requests)
+    .def_readonly("positions", &osl::ShmInferenceStats::positions)
+    .def("mean_batch", &osl::ShmInferenceStats::mean_batch)
+    ;
+
+  py::class_<osl::ShmInferenceServer>(m, "ShmInferenceServer",
+                                      "serve `model` to ShmInferenceClients in other processes\n\n"
+                                      ":param name: name of the shared memory segment\n"
+                                      ":param model: e.g., `InferenceForGameArray`\n"
+                                      ":param n_slots: maximum number of clients\n"
+                                      ":param slot_capacity: maximum positions in a request\n"
+                                      ":param max_batch: maximum positions in a merged batch\n"
+                                      ":param max_wait_us: time to wait for other clients\n")
+    .def(py::init<std::string, osl::InferenceModel&, int, int, int, int>(),
+         "name"_a, "model"_a, "n_slots"_a=16, "slot_capacity"_a=1024,
+         "max_batch"_a=4096, "max_wait_us"_a=1000,
+         py::keep_alive<1, 3>())
+    .def("start", &osl::ShmInferenceServer::start)
+    .def("stop", &osl::ShmInferenceServer::stop, py::call_guard<py::gil_scoped_release>())
+    .def("serve_once", &osl::ShmInferenceServer::serve_once, "timeout_us"_a=100000,
+         py::call_guard<py::gil_scoped_release>())
+    .def("stats", &osl::ShmInferenceServer::stats)
+    .def("n_clients", &osl::ShmInferenceServer::n_clients)
+    .def("name", &osl::ShmInferenceServer::name)
+    ;
+
+  py::class_<osl::ShmInferenceClient, osl::InferenceModel>(m, "ShmInferenceClient",
+                                                           "InferenceModel backed by ShmInferenceServer\n\n"
+                                                           ":param name: name given to the server\n")
+    .def(py::init<std::string>(), "name"_a)
+    .def("slot_capacity", &osl::ShmInferenceClient::slot_capacity)
+    .def("slot_id", &osl::ShmInferenceClient::slot_id)
     ;
 
   // function
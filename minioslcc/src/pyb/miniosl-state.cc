@@ -12,6 +12,8 @@
 #include "impl/more.h"
 #include "impl/checkmate.h"
 #include "impl/range-parallel.h"
+#include "impl/batch-prefetcher.h"
+#include "impl/position-shard.h"
 #include <sstream>
 #include <iostream>
 #include <fstream>
@@ -41,7 +43,9 @@ namespace pyosl {
                                    py::array_t<int8_t> inputs2,
                                    py::array_t<uint8_t> legalmove_label
                                    );
-  void collate_features(const std::vector<std::vector<SubRecord>>& block_vector,
+  /** @param Block std::vector<SubRecord> or CompactRecordBlock */
+  template <class Block>
+  void collate_features(const std::vector<Block>& block_vector,
                         const py::list& indices,
                         py::array_t<int8_t> inputs,
                         py::array_t<int32_t> policy_labels,
@@ -50,12 +54,28 @@ namespace pyosl {
                         std::optional<py::array_t<int8_t>> inputs2,
                         std::optional<py::array_t<uint8_t>> legalmove_labels,
                         std::optional<py::array_t<uint16_t>> sampled_id,
-                        std::optional<int> decay_power
+                        std::optional<int> decay_power,
+                        std::optional<uint64_t> seed
                         );
 
+  void collate_shard_features(const PositionShardFile& shard,
+                              py::array_t<int64_t> indices,
+                              py::array_t<int8_t> inputs,
+                              py::array_t<int32_t> policy_labels,
+                              py::array_t<float> value_labels,
+                              py::array_t<int8_t> aux_labels,
+                              std::optional<py::array_t<int8_t>> inputs2,
+                              std::optional<py::array_t<uint8_t>> legalmove_labels,
+                              std::optional<py::array_t<uint16_t>> sampled_id);
+
+  /** arrays viewing a batch of BatchPrefetcher, the slot is released when all of them are deleted */
+  py::tuple pop_batch(std::shared_ptr<BatchPrefetcher> prefetcher);
+
   /** pack into 256bits */
   py::array_t<uint64_t> to_np_pack(const BaseState& state);
   std::pair<MiniRecord, int> unpack_record(py::array_t<uint64_t> code_seq);
+  std::vector<SubRecord> unpack_sub_records(py::array_t<uint64_t, py::array::c_style | py::array::forcecast> code_seq,
+                                            int threads);
 
   py::array_t<float> export_features(BaseState initial, const MoveVector& moves);
   std::pair<py::array_t<float>,osl::GameResult> export_features_after_move(BaseState initial, const MoveVector& moves, Move);
@@ -279,6 +299,9 @@ void pyosl::init_state_np(py::module_& m) {
          "move"_a, "last_to"_a=Square(),
          "parse and return move")
     .def("is_legal", &state_t::isLegal, "move"_a)
+    .def("see", py::overload_cast<osl::Move>(&state_t::see, py::const_), "move"_a,
+         "static exchange evaluation, material gain by `move` and the recaptures on its destination (pawn=100)")
+    .def("see_ge", &state_t::seeGE, "move"_a, "threshold"_a=0, "test `see(move) >= threshold`")
     .def("to_np_cover", &pyosl::to_np_cover, "squares covered by pieces as numpy array")
     .def("encode_move", [](const state_t& s, osl::Move m) { return osl::bitpack::encode12(s, m); },
          "move"_a,
@@ -319,6 +342,15 @@ void pyosl::init_state_np(py::module_& m) {
          ":param legalmove_labels: legal moves to store.\n"
          )
     .def("make_state", &osl::SubRecord::make_state, "n"_a, "make a state after the first `n` moves")
+    .def_static("from_usi_trusted", &osl::SubRecord::from_usi_trusted,
+                "line"_a, "settle_repetition"_a=false,
+                "read a usi line of trusted origin without legality checks\n\n"
+                ":param settle_repetition: parse again with full checks if the line has no final move "
+                "to settle the result by checkmate or repetition\n")
+    .def_static("from_usi_file_trusted", &osl::SubRecord::from_usi_file_trusted,
+                "path"_a, "threads"_a=0, "settle_repetition"_a=false,
+                py::call_guard<py::gil_scoped_release>(),
+                "read usi lines by :py:meth:`from_usi_trusted` in parallel, keeping the order")
     ;
 
   // functions
@@ -335,12 +367,15 @@ void pyosl::init_state_np(py::module_& m) {
 
   // functions depending on np
   m.def("unpack_record", &pyosl::unpack_record, "read record from np.array encoded by MiniRecord.pack_record");
+  m.def("unpack_sub_records", &pyosl::unpack_sub_records, "code_seq"_a, "threads"_a=0,
+        "read all records in np.array encoded by MiniRecord.pack_record as :py:class:`GameRecordBlock`, "
+        "decoding moves only in parallel");
   m.def("collate_features",
-        &pyosl::collate_features,
+        &pyosl::collate_features<std::vector<osl::SubRecord>>,
         "block_vector"_a, "indices"_a, "inputs"_a,
         "policy_labels"_a, "value_labels"_a, "aux_labels"_a,
         "inputs2"_a=std::nullopt, "legalmove_labels"_a=std::nullopt, "sampled_id"_a=std::nullopt,
-        "decay_power"_a=std::nullopt,
+        "decay_power"_a=std::nullopt, "seed"_a=std::nullopt,
         "collate function for `GameDataset`\n\n"
         ":param block_vector: game record db\n"
         ":param indices: list of pairs each of which forms (block_id, record_id)\n"
@@ -350,12 +385,84 @@ void pyosl::init_state_np(py::module_& m) {
         ":param inputs2: afterstate features (optional)\n"
         ":param legalmoves: legal moves in bitset (optional)\n"
         ":param sampled_id: list of move_id sampled for each game (optional)\n"
-        ":param decay_power: increase to sample opening positions in lower frequency (optional)"
+        ":param decay_power: increase to sample opening positions in lower frequency (optional)\n"
+        ":param seed: sample positions reproducibly, as a function of seed, indices, and the offset in the batch (optional)"
         );
+  m.def("collate_features",
+        &pyosl::collate_features<osl::CompactRecordBlock>,
+        "block_vector"_a, "indices"_a, "inputs"_a,
+        "policy_labels"_a, "value_labels"_a, "aux_labels"_a,
+        "inputs2"_a=std::nullopt, "legalmove_labels"_a=std::nullopt, "sampled_id"_a=std::nullopt,
+        "decay_power"_a=std::nullopt, "seed"_a=std::nullopt,
+        "collate function for `GameDataset` with :py:class:`CompactBlockVector`");
   
   py::bind_vector<std::vector<osl::SubRecord>>(m, "GameRecordBlock");
   py::bind_vector<std::vector<std::vector<osl::SubRecord>>>(m, "GameBlockVector")
     .def("reserve",  &std::vector<std::vector<osl::SubRecord>>::reserve, "reserves storage");;
+
+  py::class_<osl::CompactRecordBlock>(m, "CompactRecordBlock",
+                                      "compact alternative to :py:class:`GameRecordBlock`,"
+                                      " moves of all records in a single array of 16-bit codes")
+    .def(py::init<>())
+    .def(py::init<const std::vector<osl::SubRecord>&>(), "records"_a)
+    .def("push_back", &osl::CompactRecordBlock::push_back, "record"_a)
+    .def("__len__", &osl::CompactRecordBlock::size)
+    .def("__getitem__", &osl::CompactRecordBlock::record, "k"_a, "decode a record as :py:class:`SubRecord`")
+    .def("move_size", &osl::CompactRecordBlock::move_size, "k"_a)
+    .def("result", &osl::CompactRecordBlock::result, "k"_a)
+    .def("memory_bytes", &osl::CompactRecordBlock::memory_bytes)
+    ;
+  py::bind_vector<std::vector<osl::CompactRecordBlock>>(m, "CompactBlockVector")
+    .def("reserve",  &std::vector<osl::CompactRecordBlock>::reserve, "reserves storage");
+
+  py::class_<osl::PositionShardWriter>(m, "PositionShardWriter",
+                                      "write sampled positions to a shard for :py:class:`PositionShardFile`")
+    .def(py::init<std::string>(), "path"_a)
+    .def("add", &osl::PositionShardWriter::add, "record"_a, "idx"_a)
+    .def("add_samples", &osl::PositionShardWriter::add_samples,
+         "records"_a, "samples"_a, "decay"_a=osl::SubRecord::default_decay, "seed"_a=0,
+         py::call_guard<py::gil_scoped_release>(),
+         "add `samples` positions of each record drawn by the weighted sampling of training")
+    .def("close", &osl::PositionShardWriter::close)
+    .def("__len__", &osl::PositionShardWriter::size)
+    ;
+  py::class_<osl::PositionShardFile>(m, "PositionShardFile",
+                                     "memory-mapped shard of positions, featurized without replaying games")
+    .def(py::init<std::string>(), "path"_a)
+    .def("__len__", &osl::PositionShardFile::size)
+    .def("collate", &pyosl::collate_shard_features,
+         "indices"_a, "inputs"_a, "policy_labels"_a, "value_labels"_a, "aux_labels"_a,
+         "inputs2"_a=std::nullopt, "legalmove_labels"_a=std::nullopt, "sampled_id"_a=std::nullopt,
+         "export entries of `indices` to buffers (must be zero-filled) as :py:func:`collate_features`")
+    ;
+
+  py::class_<osl::BatchPrefetcherConfig>(m, "BatchPrefetcherConfig")
+    .def(py::init<>())
+    .def_readwrite("batch_size", &osl::BatchPrefetcherConfig::batch_size)
+    .def_readwrite("ring_size", &osl::BatchPrefetcherConfig::ring_size)
+    .def_readwrite("n_threads", &osl::BatchPrefetcherConfig::n_threads)
+    .def_readwrite("window_size", &osl::BatchPrefetcherConfig::window_size)
+    .def_readwrite("decay", &osl::BatchPrefetcherConfig::decay)
+    .def_readwrite("with_inputs2", &osl::BatchPrefetcherConfig::with_inputs2)
+    .def_readwrite("with_legalmoves", &osl::BatchPrefetcherConfig::with_legalmoves)
+    .def_readwrite("seed", &osl::BatchPrefetcherConfig::seed)
+    ;
+  py::class_<osl::BatchPrefetcher, std::shared_ptr<osl::BatchPrefetcher>>
+    (m, "BatchPrefetcher", "training batches prepared by background threads")
+    .def(py::init<osl::BatchPrefetcherConfig>(), "config"_a=osl::BatchPrefetcherConfig())
+    .def("add", &osl::BatchPrefetcher::add, "block"_a,
+         "add a :py:class:`CompactRecordBlock`, or replace the oldest one when the window is full")
+    .def("add", [](osl::BatchPrefetcher& self, const std::vector<osl::SubRecord>& block) {
+      self.add(osl::CompactRecordBlock(block));
+    }, "block"_a)
+    .def("stored_records", &osl::BatchPrefetcher::stored_records)
+    .def("start", &osl::BatchPrefetcher::start)
+    .def("stop", &osl::BatchPrefetcher::stop, py::call_guard<py::gil_scoped_release>())
+    .def("pop", &pyosl::pop_batch,
+         "wait for the next batch\n\n"
+         ":returns: tuple of (inputs, policy_labels, value_labels, aux_labels, inputs2, legalmove_labels)"
+         " as views of the internal buffer, which is reused after all of them are released")
+    ;
 }
 
 osl::Move pyosl::read_japanese_move(const EffectState& state, std::u8string move, Square last_to) {
@@ -385,6 +492,24 @@ std::pair<osl::MiniRecord, int> pyosl::unpack_record(py::array_t<uint64_t> code_
   return {record, n};
 }
 
+std::vector<osl::SubRecord>
+pyosl::unpack_sub_records(py::array_t<uint64_t, py::array::c_style | py::array::forcecast> code_seq, int threads) {
+  auto buf = code_seq.request();
+  if (buf.ndim != 1)
+    throw std::invalid_argument("unpack_sub_records expects 1d array");
+  auto ptr = static_cast<const uint64_t*>(buf.ptr);
+  bitpack::MoveArena arena;
+  {
+    py::gil_scoped_release release;
+    arena = bitpack::read_binary_records_parallel(ptr, buf.shape[0], threads);
+  }
+  std::vector<SubRecord> ret;
+  ret.reserve(arena.size());
+  for (size_t k=0; k<arena.size(); ++k)
+    ret.push_back(arena.record(k));
+  return ret;
+}
+
 py::array_t<float> pyosl::to_np_44ch(const osl::BaseState& state) {
   /*  - 14 for white pieces: [ppawn, plance, pknight, psilver, pbishop, prook,
    *    king, gold, pawn, lance, knight, silver, bishop, rook]
@@ -466,7 +591,8 @@ void pyosl::sample_np_feature_labels_to(const SubRecord& record, int offset,
                                   );
 }
 
-void pyosl::collate_features(const std::vector<std::vector<SubRecord>>& block_vector,
+template <class Block>
+void pyosl::collate_features(const std::vector<Block>& block_vector,
                              const py::list& indices,
                              py::array_t<int8_t> inputs,
                              py::array_t<int32_t> policy_labels,
@@ -475,7 +601,8 @@ void pyosl::collate_features(const std::vector<std::vector<SubRecord>>& block_ve
                              std::optional<py::array_t<int8_t>> inputs2_opt,
                              std::optional<py::array_t<uint8_t>> legalmove_labels_opt,
                              std::optional<py::array_t<uint16_t>> sampled_id_opt,
-                             std::optional<int> decay_power
+                             std::optional<int> decay_power,
+                             std::optional<uint64_t> seed
                              )
 {
   const int N = indices.size();
@@ -500,14 +627,60 @@ void pyosl::collate_features(const std::vector<std::vector<SubRecord>>& block_ve
     for (int i=l; i<r; ++i) {
       py::tuple item = indices[i];
       int p = py::int_(item[0]), s = py::int_(item[1]);
-      const SubRecord& record = block_vector[p][s];
-      record.sample_feature_labels_to(i, iptr, pptr, vptr, aptr, i2ptr, lmptr, sidptr,
-                                      decay_power.value_or(SubRecord::default_decay), tid);
+      const int decay = decay_power.value_or(SubRecord::default_decay);
+      auto sample = [&](auto& rng_or_tid) {
+        if constexpr (std::is_same_v<Block, CompactRecordBlock>)
+          block_vector[p].sample_feature_labels_to(s, i, iptr, pptr, vptr, aptr, i2ptr, lmptr, sidptr,
+                                                   decay, rng_or_tid);
+        else
+          block_vector[p][s].sample_feature_labels_to(i, iptr, pptr, vptr, aptr, i2ptr, lmptr, sidptr,
+                                                      decay, rng_or_tid);
+      };
+      if (seed) {
+        rng::CounterRNG rng(rng::game_key(*seed, (uint64_t(p) << 32) | s), i, rng::Purpose::TrainingSample);
+        sample(rng);
+      }
+      else
+        sample(tid);
     }
   };
   run_range_parallel_tid(N, f);
 }
 
+void pyosl::collate_shard_features(const PositionShardFile& shard,
+                                   py::array_t<int64_t> indices,
+                                   py::array_t<int8_t> inputs,
+                                   py::array_t<int32_t> policy_labels,
+                                   py::array_t<float> value_labels,
+                                   py::array_t<int8_t> aux_labels,
+                                   std::optional<py::array_t<int8_t>> inputs2_opt,
+                                   std::optional<py::array_t<uint8_t>> legalmove_labels_opt,
+                                   std::optional<py::array_t<uint16_t>> sampled_id_opt)
+{
+  auto index = indices.unchecked<1>();
+  const int N = index.shape(0);
+  for (int i=0; i<N; ++i)
+    if (index(i) < 0 || index(i) >= shard.size())
+      throw std::out_of_range("collate_shard_features " + std::to_string(index(i)));
+  auto inputs2 = inputs2_opt.value_or(py::array_t<int8_t>());
+  auto legalmove_labels = legalmove_labels_opt.value_or(py::array_t<uint8_t>());
+  auto sampled_id = sampled_id_opt.value_or(py::array_t<uint16_t>());
+
+  auto *iptr = static_cast<nn_input_element*>(inputs.request().ptr);
+  auto *pptr = static_cast<int32_t*>(policy_labels.request().ptr);
+  auto *vptr = static_cast<float*>(value_labels.request().ptr);
+  auto *aptr = static_cast<nn_input_element*>(aux_labels.request().ptr);
+  auto *i2ptr = inputs2_opt ? static_cast<nn_input_element*>(inputs2.request().ptr) : nullptr;
+  auto *lmptr = legalmove_labels_opt ? static_cast<uint8_t*>(legalmove_labels.request().ptr) : nullptr;
+  auto *sidptr = sampled_id_opt ? static_cast<uint16_t*>(sampled_id.request().ptr) : nullptr;
+
+  py::gil_scoped_release release;
+  // a broken entry is rethrown here after the workers finish, rather than terminating the process
+  run_dynamic_parallel(N, [&](size_t i) {
+    shard.export_feature_labels_to(index(i), i, iptr, pptr, vptr, aptr, i2ptr, lmptr, sidptr);
+  }, 0, 16);
+}
+
 py::array_t<float> pyosl::export_features(BaseState initial, const MoveVector& moves) {
   nparray<float> feature(ml::input_unit);
   ml::write_float_feature([&](auto *out){ ml::export_features(initial, moves, out); },
@@ -529,3 +702,31 @@ pyosl::export_features_after_move(BaseState initial, const MoveVector& moves, Mo
       feature.ptr());
   return {feature.array.reshape({-1, 9, 9}), ret};
 }
+
+py::tuple pyosl::pop_batch(std::shared_ptr<BatchPrefetcher> prefetcher) {
+  int slot;
+  {
+    py::gil_scoped_release nogil;
+    slot = prefetcher->pop();
+  }
+  auto *handle = new std::pair<std::shared_ptr<BatchPrefetcher>,int>(prefetcher, slot);
+  py::capsule owner(handle, [](void *ptr) {
+    auto *handle = static_cast<std::pair<std::shared_ptr<BatchPrefetcher>,int>*>(ptr);
+    handle->first->release(handle->second);
+    delete handle;
+  });
+  const auto& batch = prefetcher->batch(slot);
+  const py::ssize_t N = prefetcher->config().batch_size;
+  auto view = [&](const auto& vec, std::vector<py::ssize_t> shape) {
+    typedef typename std::remove_cvref_t<decltype(vec)>::value_type T;
+    return py::array_t<T>(shape, vec.data(), owner);
+  };
+  return py::make_tuple(view(batch.inputs, {N, ml::input_channels, 9, 9}),
+                        view(batch.policy_labels, {N}),
+                        view(batch.value_labels, {N}),
+                        view(batch.aux_labels, {N, ml::aux_unit}),
+                        view(batch.inputs2, {batch.inputs2.empty() ? 0 : N, ml::input_channels, 9, 9}),
+                        view(batch.legalmove_labels, {batch.legalmove_labels.empty() ? 0 : N,
+                            ml::legalmove_bs_sz}));
+}
+
@@ -9,6 +9,8 @@
 #include "opening.h"
 #include "feature.h"
 #include "impl/bitpack.h"
+#include "impl/record-writer.h"
+#include "impl/rank-coder.h"
 #include "impl/more.h"
 #include <sstream>
 #include <iostream>
@@ -385,6 +387,30 @@ void pyosl::init_basic(py::module_& m) {
     .def(py::init<const std::vector<osl::MiniRecord>&>())
     .def_readonly("records", &osl::RecordSet::records, "list of :py:class:`MiniRecord` s")
     .def_static("from_usi_file", &osl::RecordSet::from_usi_file, "path"_a, "read usi lines")
+    .def_static("from_usi_file_parallel", &osl::RecordSet::from_usi_file_parallel,
+                "path"_a, "threads"_a=0, py::call_guard<py::gil_scoped_release>(),
+                "read usi lines by parsing chunks of a memory-mapped file in parallel, keeping the order")
+    .def_static("from_path_parallel",
+                [](std::string path, int threads, std::shared_ptr<osl::GameRecordSink> sink) {
+                  std::vector<osl::RecordSet::FileError> errors;
+                  auto records = osl::RecordSet::from_path_parallel(path, threads, &errors, sink.get());
+                  std::vector<std::pair<std::string,std::string>> failed;
+                  for (auto& e: errors)
+                    failed.emplace_back(e.path, e.message);
+                  return std::make_pair(records, failed);
+                },
+                "path"_a, "threads"_a=0, "sink"_a=nullptr, py::call_guard<py::gil_scoped_release>(),
+                "read csa and kif files in folder in parallel\n\n"
+                ":param sink: :py:class:`GameRecordSink` to receive records instead of the result, "
+                "e.g., :py:class:`BitpackRecordWriter`\n"
+                ":returns: tuple of (:py:class:`RecordSet`, list of (path, message) of files failed)\n")
+    .def("save_rankcode", [](const osl::RecordSet& r, std::string path) {
+      return osl::rankcode::save(path, r.records);
+    }, "path"_a, py::call_guard<py::gil_scoped_release>(),
+      "save records by entropy coding of move ranks, denser than npz, returning the number of records written")
+    .def_static("from_rankcode", [](std::string path) {
+      return osl::RecordSet(osl::rankcode::load(path));
+    }, "path"_a, py::call_guard<py::gil_scoped_release>(), "load records saved by save_rankcode")
     .def("__len__", [](const osl::RecordSet& r) { return r.records.size(); })
     ;
   py::class_<osl::BasicHash>(m, "BasicHash", py::dynamic_attr(), "hash code for a state")
@@ -408,6 +434,18 @@ void pyosl::init_basic(py::module_& m) {
     .def("export_all", &tree_t::export_all)
     .def("save_binary", &tree_t::save_binary, "filename"_a, "save to file")
     .def("prune", &tree_t::prune, "threshold"_a, "filename"_a, "prune entries by visit counts")
+    .def("save_sorted_runs", &tree_t::save_sorted_runs, "prefix"_a, "run_size"_a=(1ul << 24),
+         "save nodes as sorted runs for :py:meth:`merge_runs`, returning their paths")
+    .def_static("build_binary", &tree_t::build_binary, "run"_a, "filename"_a,
+                py::call_guard<py::gil_scoped_release>(),
+                "save a book file from a sorted run")
+    .def_static("merge_binary", &tree_t::merge_binary,
+                "books"_a, "output"_a, "threshold"_a=1, "work_dir"_a="", "run_size"_a=(1ul << 24),
+                py::call_guard<py::gil_scoped_release>(),
+                "merge book files by external sorting, summing counts and dropping nodes below threshold")
+    .def_static("merge_runs", &osl::opening_run::merge, "runs"_a, "output"_a, "threshold"_a=1,
+                py::call_guard<py::gil_scoped_release>(),
+                "k-way merge of sorted runs into a run, returning the number of nodes")
     .def("retrieve_children", &tree_t::retrieve_children, "inspect moves from a given state")
     .def("mutable_clone", &tree_t::mutable_clone, "make an editable clone")
     .def("mutable_view", &tree_t::mutable_view, "try to get an editable view")
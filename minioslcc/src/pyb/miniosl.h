@@ -20,6 +20,7 @@ PYBIND11_MAKE_OPAQUE(std::vector<osl::HashStatus>);
 PYBIND11_MAKE_OPAQUE(std::vector<osl::MiniRecord>);
 PYBIND11_MAKE_OPAQUE(std::vector<osl::SubRecord>);
 PYBIND11_MAKE_OPAQUE(std::vector<std::vector<osl::SubRecord>>);
+PYBIND11_MAKE_OPAQUE(std::vector<osl::CompactRecordBlock>);
 PYBIND11_MAKE_OPAQUE(std::vector<osl::GameManager>);
 
 #endif
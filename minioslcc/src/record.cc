@@ -2,11 +2,15 @@
 #include "impl/more.h"
 #include "impl/checkmate.h"
 #include "impl/bitpack.h"
+#include "impl/record-writer.h"
+#include "impl/mapped-file.h"
+#include "impl/range-parallel.h"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <algorithm>
 #include <deque>
+#include <exception>
 
 /* ------------------------------------------------------------------------- */
 
@@ -18,7 +22,7 @@ osl::Player osl::csa::to_player(char c) {
   throw ParseError("not a csa PlayerCharacter "+std::string(1,c));
 }
 
-osl::Square osl::csa::to_square(const std::string& s) {
+osl::Square osl::csa::to_square(std::string_view s) {
   int x=s.at(0)-'0';
   int y=s.at(1)-'0';
   if(x==0 && y==0) 
@@ -26,14 +30,14 @@ osl::Square osl::csa::to_square(const std::string& s) {
   return Square(x,y);
 }
 
-osl::Ptype osl::csa::to_ptype(const std::string& s) {
+osl::Ptype osl::csa::to_ptype(std::string_view s) {
   auto p = std::ranges::find(ptype_csa_names, s);
   if (p == ptype_csa_names.end())
-    throw ParseError("unknown std::string in csa::to_ptype "+s);
+    throw ParseError("unknown std::string in csa::to_ptype "+std::string(s));
   return Ptype(p-ptype_csa_names.begin());    
 }
 
-osl::Move osl::csa::to_move_light(const std::string& s,const BaseState& state) {
+osl::Move osl::csa::to_move_light(std::string_view s,const BaseState& state) {
   if (s == "%KACHI")
     return Move::DeclareWin();
   if (s == "%TORYO" || s == "%ILLEGAL_MOVE")
@@ -57,16 +61,16 @@ osl::Move osl::csa::to_move_light(const std::string& s,const BaseState& state) {
     move = Move(fromPos,toPos,ptype, capturePtype,isPromote,pl);
   }
   if (! move.is_ordinary_valid())
-    throw ParseError("move composition error in csa::to_move "+s);
+    throw ParseError("move composition error in csa::to_move "+std::string(s));
   if (! state.move_is_consistent(move))
-    throw ParseError("move inconsistent with state in csa::to_move "+s);
+    throw ParseError("move inconsistent with state in csa::to_move "+std::string(s));
   return move;
 }
 
-osl::Move osl::csa::to_move(const std::string& s,const EffectState& state) {
+osl::Move osl::csa::to_move(std::string_view s,const EffectState& state) {
   auto move = to_move_light(s, state);
   if (! state.isLegal(move))
-    throw ParseError("illegal move in csa::to_move "+s);
+    throw ParseError("illegal move in csa::to_move "+std::string(s));
   return move;
 }
 
@@ -316,6 +320,64 @@ osl::RecordSet osl::RecordSet::from_path(std::string path, int limit) {
   return result;
 }
 
+osl::RecordSet osl::RecordSet::from_path_parallel(std::string path, int threads,
+                                                  std::vector<FileError> *errors, GameRecordSink *sink) {
+  std::vector<std::filesystem::path> files;
+  for (auto& file: std::filesystem::directory_iterator{std::filesystem::path(path)}) {
+    auto ext = file.path().extension();
+    if (file.is_regular_file() && (ext == ".csa" || ext == ".kif" || ext == ".kifu"))
+      files.push_back(file.path());
+  }
+  std::ranges::sort(files);
+
+  RecordSet result;
+  if (! sink)
+    result.records.reserve(files.size());
+  // files are read by batches so that records are passed to sink in order with bounded memory
+  const size_t batch_size = std::max(threads, range_parallel_threads) * 64;
+  std::vector<MiniRecord> records;
+  std::vector<std::exception_ptr> failures;
+  for (size_t begin=0; begin<files.size(); begin+=batch_size) {
+    const size_t N = std::min(batch_size, files.size()-begin);
+    records.assign(N, MiniRecord());
+    failures.assign(N, nullptr);
+    run_dynamic_parallel(N, [&](size_t i) {
+      try {
+        const auto& file = files[begin+i];
+        records[i] = (file.extension() == ".csa")
+          ? csa::read_record(file) : kifu::read_record(file);
+      }
+      catch (...) {
+        failures[i] = std::current_exception();
+      }
+    }, threads);
+
+    for (size_t i=0; i<N; ++i) {
+      if (failures[i]) {
+        if (! errors)
+          std::rethrow_exception(failures[i]);
+        try {
+          std::rethrow_exception(failures[i]);
+        }
+        catch (std::exception& e) {
+          errors->push_back({files[begin+i].string(), e.what()});
+        }
+        catch (...) {
+          errors->push_back({files[begin+i].string(), "unknown error"});
+        }
+        continue;
+      }
+      if (sink)
+        sink->add(std::move(records[i]));
+      else
+        result.records.push_back(std::move(records[i]));
+    }
+  }
+  if (sink)
+    sink->flush();
+  return result;
+}
+
 osl::RecordSet osl::RecordSet::from_usi_lines(std::istream& is) {
   RecordSet result;
   std::string line;
@@ -331,6 +393,70 @@ osl::RecordSet osl::RecordSet::from_usi_file(std::string path) {
   return from_usi_lines(is);
 }
 
+void osl::usi::parse_lines_parallel(const std::string& path, int threads,
+                                   const std::function<void(size_t)>& prepare,
+                                   const std::function<void(size_t, std::string_view)>& parse) {
+  MappedFile file(path);
+  const auto text = file.view();
+
+  // chunks start at line heads, more chunks than threads for load balancing
+  const size_t n_chunks = std::max<size_t>(1, std::min<size_t>(std::max(threads, range_parallel_threads)*8,
+                                                               text.size()/4096));
+  std::vector<size_t> bounds = {0};
+  for (size_t c=1; c<n_chunks; ++c) {
+    size_t pos = std::max(bounds.back(), text.size()*c/n_chunks);
+    pos = text.find('\n', pos);
+    if (pos == text.npos)
+      break;
+    if (pos+1 > bounds.back())
+      bounds.push_back(pos+1);
+  }
+  bounds.push_back(text.size());
+
+  const size_t N = bounds.size()-1;
+  prepare(N);
+  std::vector<std::exception_ptr> errors(N);
+  // errors are kept for each chunk to report the first one in the file
+  run_dynamic_parallel(N, [&](size_t c) {
+    try {
+      auto chunk = text.substr(bounds[c], bounds[c+1]-bounds[c]);
+      while (! chunk.empty()) {
+        auto eol = chunk.find('\n');
+        auto line = chunk.substr(0, eol);
+        chunk.remove_prefix(eol == chunk.npos ? chunk.size() : eol+1);
+        while (! line.empty() && isspace(line.back()))
+          line.remove_suffix(1);
+        if (line.find_first_not_of(" \t") == line.npos)
+          continue;
+        parse(c, line);
+      }
+    }
+    catch (...) {
+      errors[c] = std::current_exception();
+    }
+  }, threads);
+  for (auto& e: errors)
+    if (e)
+      std::rethrow_exception(e);
+}
+
+osl::RecordSet osl::RecordSet::from_usi_file_parallel(std::string path, int threads) {
+  std::vector<std::vector<MiniRecord>> chunks;
+  usi::parse_lines_parallel(path, threads,
+                            [&](size_t n) { chunks.resize(n); },
+                            [&](size_t c, std::string_view line) {
+                              chunks[c].push_back(usi::read_record(line));
+                            });
+  RecordSet result;
+  size_t total = 0;
+  for (const auto& chunk: chunks)
+    total += chunk.size();
+  result.records.reserve(total);
+  for (auto& chunk: chunks)
+    std::ranges::move(chunk, std::back_inserter(result.records));
+  return result;
+}
+
 
 
 
@@ -512,9 +638,9 @@ std::string osl::to_psn_extended(Move m) {
   return result;
 }
 
-osl::Move osl::psn::to_move_light(const std::string& str, const BaseState& state) {
+osl::Move osl::psn::to_move_light(std::string_view str, const BaseState& state) {
   if (str.size() < 4)
-    throw ParseError("move syntax error in usi::to_move " + str);
+    throw ParseError("move syntax error in usi::to_move " + std::string(str));
 
   const Square to = to_square(str.substr(2,2));
   Move move;
@@ -527,31 +653,32 @@ osl::Move osl::psn::to_move_light(const std::string& str, const BaseState& state
     const Ptype captured = state.pieceOnBoard(to).ptype();
     bool promotion = false;
     if (str.size() > 4) {
-      assert(str[4] == '+');
+      if (str.size() > 5 || str[4] != '+')
+        throw ParseError("move syntax error in usi::to_move " + std::string(str));
       promotion = true;
     }
     move = Move(from, to, (promotion ? promote(ptype) : ptype), 
                 captured, promotion, state.turn());
   }
   if (! move.is_ordinary_valid())
-    throw ParseError("move composition error in usi::to_move " + str);
+    throw ParseError("move composition error in usi::to_move " + std::string(str));
   if (! state.move_is_consistent(move))
-    throw ParseError("move inconsistent with state in usi::to_move "+str);
+    throw ParseError("move inconsistent with state in usi::to_move "+std::string(str));
   return move;
 }
-osl::Move osl::psn::to_move(const std::string& str, const EffectState& s) {
+osl::Move osl::psn::to_move(std::string_view str, const EffectState& s) {
   auto move = to_move_light(str, s);
   if (! s.isLegal(move))
-    throw ParseError("illegal move " + str);    
+    throw ParseError("illegal move " + std::string(str));
   return move;
 }
 
-osl::Square osl::psn::to_square(const std::string& str) {
+osl::Square osl::psn::to_square(std::string_view str) {
   assert(str.size() == 2);
   const int x = str[0] - '0';
   const int y = str[1] - 'a' + 1;
   if (x <= 0 || x > 9 || y <= 0 || y > 9)
-    throw ParseError("Invalid square character: " + str);
+    throw ParseError("Invalid square character: " + std::string(str));
   return Square(x, y);
 }
 
@@ -653,7 +780,7 @@ std::string osl::to_usi(const MiniRecord& record) {
   return ret;
 }
 
-osl::Move osl::usi::to_move(const std::string& str, const EffectState& s) {
+osl::Move osl::usi::to_move(std::string_view str, const EffectState& s) {
   if (str == "win")
     return Move::DeclareWin();
   if (str == "pass")
@@ -664,10 +791,10 @@ osl::Move osl::usi::to_move(const std::string& str, const EffectState& s) {
     return psn::to_move(str, s);
   }
   catch (std::exception& e) {
-    throw ParseError("usi::to_move failed for " + str + " by "+ e.what());
+    throw ParseError("usi::to_move failed for " + std::string(str) + " by "+ e.what());
   }
   catch (...) {
-    throw ParseError("usi::to_move failed for " + str);
+    throw ParseError("usi::to_move failed for " + std::string(str));
   }
 }
 
@@ -679,9 +806,9 @@ osl::PtypeO osl::usi::to_ptypeo(char c) {
   return newPtypeO(pl, ptype);
 }
 
-void osl::usi::parse_board(const std::string& word, BaseState& state) {
+void osl::usi::parse_board(std::string_view word, BaseState& state) {
   if (word.empty())
-    throw ParseError(word);
+    throw ParseError("empty board");
 
   state.initEmpty();
   int x=9, y=1;
@@ -693,102 +820,144 @@ void osl::usi::parse_board(const std::string& word, BaseState& state) {
       --x;
     } else if (c == '+') {
       if ( (i+1) >= word.size() )
-        throw ParseError(word);
+        throw ParseError(std::string(word));
       const char next = word[i+1];
       if (!isalpha(next))
-        throw ParseError(word);
+        throw ParseError(std::string(word));
       const PtypeO ptypeo = to_ptypeo(next);
       if (!can_promote(ptypeo))
-        throw ParseError(word);
+        throw ParseError(std::string(word));
       const PtypeO promoted = promote(ptypeo);
       state.setPiece(owner(promoted), Square(x,y), ptype(promoted));
       --x;
       ++i;
     } else if (c == '/') {
       if (x != 0)
-        throw ParseError(word);
+        throw ParseError(std::string(word));
       x = 9;
       ++y;
     } else if (isdigit(c)) {
       const int n = c - '0';
       if (n == 0)
-        throw ParseError(word);
+        throw ParseError(std::string(word));
       x -= n;
     } else {
       throw ParseError("usi: unknown input " + std::string(1,c));
     }
     if (x < 0 || x > 9 || y < 0 || y > 9)
-      throw ParseError(word);
+      throw ParseError(std::string(word));
   }
   state.initFinalize();
 }
 
-void osl::usi::parse(const std::string& line, EffectState& state) {
+void osl::usi::parse(std::string_view line, EffectState& state) {
   MiniRecord record = read_record(line);
   state.copyFrom(record.initial_state);
   for (Move move: record.moves) 
     state.makeMove(move);
 }
 
-osl::EffectState osl::usi::to_state(const std::string& line) {
+osl::EffectState osl::usi::to_state(std::string_view line) {
   EffectState state;
   parse(line,state);
   return state;
 }
 
-osl::MiniRecord osl::usi::read_record(std::string line) {
-  MiniRecord record;
-  std::istringstream is(line);
-  std::string word;
-  {
-    BaseState state;
-    is >> word;
-    if (word == "position")
-      is >> word;
-    if (word == "startpos") 
-      state.init(HIRATE);
-    else {
-      if (word != "sfen")
-        throw ParseError("sfen not found "+word);
-      is >> word;
-      parse_board(word, state);
-      is >> word;
-      if (word != "b" && word != "w")
-        throw ParseError(" turn error "+word);
-      state.setTurn((word == "b") ? BLACK : WHITE);
-      is >> word;
-      if (word != "-") {
-        int prefix = 0;
-        for (char c: word) {
-          if (isalpha(c)) {
-            PtypeO ptypeo = to_ptypeo(c);
-            for (int j=0; j<std::max(1, prefix); ++j)
-              state.setPiece(owner(ptypeo), Square::STAND(), ptype(ptypeo));
-            prefix = 0;
-          }
-          else {
-            if (!isdigit(c))
-              throw ParseError(word);
-            prefix = (c - '0') + prefix*10;
-            if (prefix == 0)
-              throw ParseError(word);
-          }
+namespace osl {
+  namespace {
+    /** whitespace separated words of a line without copy */
+    class Words {
+      std::string_view rest;
+      static constexpr const char *space = " \t\r\n";
+    public:
+      explicit Words(std::string_view line) : rest(line) {}
+      /** @return false if no more words, leaving `word` empty */
+      bool next(std::string_view& word) {
+        auto head = rest.find_first_not_of(space);
+        if (head == rest.npos) {
+          rest = word = {};
+          return false;
+        }
+        rest.remove_prefix(head);
+        word = rest.substr(0, rest.find_first_of(space));
+        rest.remove_prefix(word.size());
+        return true;
+      }
+      std::string_view peek() const {
+        Words copy(*this);
+        std::string_view word;
+        copy.next(word);
+        return word;
+      }
+      std::string_view unread() const { return rest; }
+    };
+  }
+}
+
+std::pair<osl::BaseState, std::string_view> osl::usi::parse_initial_state(std::string_view line) {
+  Words is(line);
+  std::string_view word;
+  BaseState state;
+  is.next(word);
+  if (word == "position")
+    is.next(word);
+  if (word == "startpos") 
+    state.init(HIRATE);
+  else {
+    if (word != "sfen")
+      throw ParseError("sfen not found "+std::string(word));
+    is.next(word);
+    parse_board(word, state);
+    is.next(word);
+    if (word != "b" && word != "w")
+      throw ParseError(" turn error "+std::string(word));
+    state.setTurn((word == "b") ? BLACK : WHITE);
+    is.next(word);
+    if (word != "-") {
+      int prefix = 0;
+      for (char c: word) {
+        if (isalpha(c)) {
+          PtypeO ptypeo = to_ptypeo(c);
+          for (int j=0; j<std::max(1, prefix); ++j)
+            state.setPiece(owner(ptypeo), Square::STAND(), ptype(ptypeo));
+          prefix = 0;
+        }
+        else {
+          if (!isdigit(c))
+            throw ParseError(std::string(word));
+          prefix = (c - '0') + prefix*10;
+          if (prefix == 0)
+            throw ParseError(std::string(word));
         }
       }
-      int move_number; // will not be used
-      is >> move_number;
     }
-    state.initFinalize();
+    // move number, will not be used, and words after a malformed one are ignored
+    auto number = is.peek();
+    if (! number.empty() && std::ranges::all_of(number, [](char c) { return isdigit(c); }))
+      is.next(word);
+    else if (number != "moves")
+      is = Words({});
+  }
+  state.initFinalize();
+  return {state, is.unread()};
+}
+
+osl::MiniRecord osl::usi::read_record(std::string_view line) {
+  MiniRecord record;
+  auto [state, rest] = parse_initial_state(line);
+  {
     // classify variants
     auto [variant, opt_id] = state.guess_variant();
     record.set_initial_state(state, variant, opt_id);
   }
-  if (! (is >> word))
+  Words is(rest);
+  std::string_view word;
+  if (! is.next(word))
     return record;
   if (word != "moves")
-    throw ParseError("moves not found "+word);
+    throw ParseError("moves not found "+std::string(word));
   EffectState uptodate(record.initial_state);
-  while (is >> word) {
+  while (is.next(word)) {
     Move m = to_move(word, uptodate);
     if (! m.isNormal()) {
       record.moves.push_back(m); // typically poped back later
@@ -3,7 +3,9 @@
 #include "impl/hash.h"
 #include "impl/more.h"
 #include <filesystem>
+#include <functional>
 #include <sstream>
+#include <string_view>
 #include <tuple>
 #include <optional>
 
@@ -94,6 +96,7 @@ namespace osl
 
     static constexpr int draw_limit = 320;
   };
+  class GameRecordSink;
   /** a set of `MiniRecord` s */
   struct RecordSet {
     RecordSet() {}
@@ -106,6 +109,28 @@ namespace osl
     /** read usi lines */
     static RecordSet from_usi_lines(std::istream&);
     static RecordSet from_usi_file(std::string);
+    /** read usi lines of a file mapped into memory, parsing chunks of lines in parallel.
+     * The order of records is kept and empty lines are skipped.
+     * @param threads number of workers, `range_parallel_threads` if 0 (see run_dynamic_parallel)
+     */
+    static RecordSet from_usi_file_parallel(std::string path, int threads=0);
+
+    /** a file failed to be read by from_path_parallel() */
+    struct FileError {
+      std::string path, message;
+    };
+    /**
+     * read csa (`.csa`) and kif (`.kif` or `.kifu`, in utf-8) files in folder by a pool of workers.
+     * Files are read in the order of their names, and the order is kept in the result.
+     * @param threads number of workers, `range_parallel_threads` if 0 (see run_dynamic_parallel)
+     * @param errors if given, files failing to be read are skipped and reported there,
+     * otherwise the first error is rethrown
+     * @param sink if given, records are passed to it in order (e.g., BitpackRecordWriter)
+     * instead of being kept in the result
+     */
+    static RecordSet from_path_parallel(std::string folder_path, int threads=0,
+                                        std::vector<FileError> *errors=nullptr,
+                                        GameRecordSink *sink=nullptr);
   };
 
   std::string to_csa(const BaseState&);
@@ -126,11 +151,11 @@ namespace osl
    * CSA形式の定義 http://www.computer-shogi.org/wcsc12/record.html
    */
   namespace csa {
-    Move to_move_light(const std::string& s,const BaseState& st);
-    Move to_move(const std::string& s,const EffectState& st);
+    Move to_move_light(std::string_view s,const BaseState& st);
+    Move to_move(std::string_view s,const EffectState& st);
     Player to_player(char c);
-    Square to_square(const std::string& s);
-    Ptype to_ptype(const std::string& s);
+    Square to_square(std::string_view s);
+    Ptype to_ptype(std::string_view s);
 
     MiniRecord read_record(const std::filesystem::path& filename);
     /** read record from csa file */
@@ -160,7 +185,7 @@ namespace osl
   std::string to_usi(const BaseState&);
   std::string to_usi(const MiniRecord&);
   namespace usi {
-    Move to_move(const std::string&, const EffectState&);
+    Move to_move(std::string_view, const EffectState&);
     PtypeO to_ptypeo(char);
     
     /**
@@ -170,14 +195,31 @@ namespace osl
      * @param board USIの文字列
      * @param state boardの解析結果が出力される
      */
-    void parse_board(const std::string& board, BaseState& state);
+    void parse_board(std::string_view board, BaseState& state);
     /**  parse string with usi syntax `[sfen <sfenstring> | startpos ] moves <move1> ... <movei>` */
-    void parse(const std::string& line, EffectState&);
+    void parse(std::string_view line, EffectState&);
 
-    /** read usi record */
-    MiniRecord read_record(std::string line);
+    /** read usi record, words are separated by spaces, tabs, or line breaks */
+    MiniRecord read_record(std::string_view line);
+    /**
+     * @internal
+     * parse the initial state `[position] (startpos | sfen ...)` at the head of `line`
+     * @return the state and the rest of the line, i.e., `moves ...` if any
+     */
+    std::pair<BaseState, std::string_view> parse_initial_state(std::string_view line);
+    /**
+     * @internal
+     * call `parse(c, line)` for each non-empty line of a memory-mapped file in parallel,
+     * where lines in chunk `c` precede those in chunk `c+1`.
+     * `prepare(n)` is called with the number of chunks before parsing,
+     * and the first exception thrown by `parse` is rethrown after all workers finish.
+     * @param threads number of workers, `range_parallel_threads` if 0 (see run_dynamic_parallel)
+     */
+    void parse_lines_parallel(const std::string& path, int threads,
+                              const std::function<void(size_t)>& prepare,
+                              const std::function<void(size_t, std::string_view)>& parse);
     /** read state in usi */
-    EffectState to_state(const std::string& line);
+    EffectState to_state(std::string_view line);
 
     class ParseError : public std::domain_error {
     public:
@@ -190,9 +232,9 @@ namespace osl
    * 何種類かある．
    */
   namespace psn {
-    Move to_move_light(const std::string&, const BaseState&);
-    Move to_move(const std::string&, const EffectState&);
-    Square to_square(const std::string&);
+    Move to_move_light(std::string_view, const BaseState&);
+    Move to_move(std::string_view, const EffectState&);
+    Square to_square(std::string_view);
     Ptype to_ptype(char);
 
     class ParseError : public std::domain_error {
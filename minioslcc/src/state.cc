@@ -108,6 +108,77 @@ EffectState::selectCheapPiece(PieceMask effect) const
   return pieceOf(std::min(num, nump));
 }
 
+namespace osl {
+  namespace {
+    constexpr CArray<int,Ptype_SIZE> see_value_table = {
+      0, 0,                     // empty, edge
+      520, 500, 500, 520, 1050, 1250, // PPAWN, PLANCE, PKNIGHT, PSILVER, PBISHOP, PROOK
+      15000, 550, 100, 300, 350, 500, 800, 950, // KING, GOLD, PAWN, LANCE, KNIGHT, SILVER, BISHOP, ROOK
+    };
+    int see_initial_gain(Move move) {
+      int gain = move.isCapture() ? see_value_table[idx(move.capturePtype())] : 0;
+      if (move.isPromotion())
+        gain += see_value_table[idx(move.ptype())] - see_value_table[idx(move.oldPtype())];
+      return gain;
+    }
+  }
+}
+
+int osl::EffectState::seeValue(Ptype ptype) {
+  return see_value_table[idx(ptype)];
+}
+
+int osl::EffectState::see(Move move) const {
+  const Player P = move.player();
+  const Square to = move.to();
+  CArray<PieceMask,2> attackers = { effectAt(BLACK, to), effectAt(WHITE, to) };
+  // a long piece whose effect reaches `to` once `p` leaves
+  auto add_xray = [&](Piece p) {
+    const Direction long_d = to_long_direction<BLACK>(to_offset32(to, p.square()));
+    if (! is_long(long_d))
+      return;
+    const int num = ppLongState()[p.id()][long_to_base8(long_d)];
+    if (Piece::isPieceNum(num))
+      attackers[pieceOf(num).owner()].set(num);
+  };
+  if (! move.isDrop()) {
+    const Piece moved = pieceAt(move.from());
+    attackers[P].reset(moved.id());
+    add_xray(moved);
+  }
+  CArray<int,Piece::SIZE+1> gain;
+  gain[0] = see_initial_gain(move);
+  int depth = 0, on_square = see_value_table[idx(move.ptype())];
+  for (Player side = alt(P);; side = alt(side)) {
+    const Piece a = selectCheapPiece(attackers[side]);
+    if (a.isEmpty() || (a.ptype() == KING && attackers[alt(side)].any()))
+      break;
+    ++depth;
+    gain[depth] = on_square - gain[depth-1];
+    on_square = see_value_table[idx(a.ptype())];
+    attackers[side].reset(a.id());
+    add_xray(a);
+  }
+  for (; depth > 0; --depth)
+    gain[depth-1] = -std::max(-gain[depth-1], gain[depth]);
+  return gain[0];
+}
+
+bool osl::EffectState::seeGE(Move move, int threshold) const {
+  const int gain = see_initial_gain(move);
+  if (gain < threshold)
+    return false;
+  // opponent's recaptures gain at most the value of the moved piece
+  if (gain - see_value_table[idx(move.ptype())] >= threshold)
+    return true;
+  return see(move) >= threshold;
+}
+
+void osl::EffectState::see(const MoveVector& moves, std::vector<int>& out) const {
+  out.resize(moves.size());
+  std::ranges::transform(moves, out.begin(), [this](Move move) { return see(move); });
+}
+
 inline int bsr64(uint64_t val) 
 {
   return 63-std::countl_zero(val);
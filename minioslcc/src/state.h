@@ -421,6 +421,20 @@ namespace osl
       return pieceOf(pieces.takeOneBit());
     }
 
+    /** piece values used by see(), PAWN=100 */
+    static int seeValue(Ptype ptype);
+    /**
+     * static exchange evaluation (SEE).
+     * @return material gain of the player to move by `move` followed by the best sequence of
+     * recaptures on move.to(), each by the cheapest piece, including x-ray attackers hidden
+     * behind the pieces already used.  Pins and promotions in recaptures are not considered.
+     */
+    int see(Move move) const;
+    /** test see(move) >= threshold, often decided without the full exchange */
+    bool seeGE(Move move, int threshold) const;
+    /** see() for each move */
+    void see(const MoveVector& moves, std::vector<int>& out) const;
+
     // ----------------------------------------------------------------------
     // 4. 指手の検査・生成・適用
     // ----------------------------------------------------------------------
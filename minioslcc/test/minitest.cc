@@ -3,16 +3,32 @@
 #include "record.h"
 #include "feature.h"
 #include "game.h"
+#include "opening.h"
 #include "impl/more.h"
 #include "impl/checkmate.h"
 #include "impl/bitpack.h"
+#include "impl/shm-inference.h"
+#include "impl/cpu-inference.h"
+#include "impl/alphabeta.h"
+#include "impl/range-parallel.h"
+#include "impl/batch-prefetcher.h"
+#include "impl/indexed-record.h"
+#include "impl/rank-coder.h"
+#include "impl/position-shard.h"
+#include "impl/usi-process.h"
 #include <iostream>
 #include <bitset>
 #include <algorithm>
 #include <filesystem>
+#include <iomanip>
 #include <fstream>
 #include <set>
+#include <map>
 #include <random>
+#include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <csignal>
 
 #define TEST_CHECK_EQUAL(a,b) TEST_CHECK((a) == (b))
 #define TEST_ASSERT_EQUAL(a,b) TEST_ASSERT((a) == (b))
@@ -854,6 +870,75 @@ void test_king8()
   }
 }
 
+void test_see() {
+  {
+    EffectState state(csa::read_board(
+      "P1 *  *  *  * -HI *  *  * -OU \n"
+      "P2 *  *  *  *  *  *  *  *  * \n"
+      "P3 *  *  *  *  *  *  *  *  * \n"
+      "P4 *  *  *  * -GI *  *  *  * \n"
+      "P5 *  *  *  *  *  *  *  *  * \n"
+      "P6 *  *  *  *  *  *  *  *  * \n"
+      "P7 *  *  *  * +KY *  *  *  * \n"
+      "P8 *  *  *  * +HI *  *  *  * \n"
+      "P9+OU *  *  *  *  *  *  *  * \n"
+      "P-00AL\n"
+      "+\n"));
+    const auto capture = Move(Square(5, 7), Square(5, 4), LANCE, SILVER, false, BLACK);
+    const auto promote = Move(Square(5, 7), Square(5, 4), PLANCE, SILVER, true, BLACK);
+    // white does not recapture, as the rook behind the lance would take the rook
+    TEST_CHECK_EQUAL(state.see(capture), EffectState::seeValue(SILVER));
+    TEST_CHECK_EQUAL(state.see(promote),
+                     EffectState::seeValue(SILVER) + EffectState::seeValue(PLANCE) - EffectState::seeValue(LANCE));
+    TEST_CHECK(state.seeGE(capture, 0));
+    TEST_CHECK(state.seeGE(capture, EffectState::seeValue(SILVER)));
+    TEST_CHECK(! state.seeGE(capture, EffectState::seeValue(SILVER)+1));
+    const auto quiet = Move(Square(5, 7), Square(5, 6), LANCE, Ptype_EMPTY, false, BLACK);
+    TEST_CHECK_EQUAL(state.see(quiet), 0);
+
+    MoveVector moves = {capture, quiet};
+    std::vector<int> values;
+    state.see(moves, values);
+    TEST_CHECK(values == (std::vector<int>{EffectState::seeValue(SILVER), 0}));
+  }
+  {
+    EffectState state(csa::read_board(
+      "P1 *  *  *  * -HI *  *  * -OU \n"
+      "P2 *  *  *  *  *  *  *  *  * \n"
+      "P3 *  *  *  *  *  *  *  *  * \n"
+      "P4 *  *  *  * -GI *  *  *  * \n"
+      "P5 *  *  *  *  *  *  *  *  * \n"
+      "P6 *  *  *  *  *  *  *  *  * \n"
+      "P7 *  *  *  * +KY *  *  *  * \n"
+      "P8 *  *  *  *  *  *  *  *  * \n"
+      "P9+OU *  *  *  *  *  *  *  * \n"
+      "P-00AL\n"
+      "+\n"));
+    const auto capture = Move(Square(5, 7), Square(5, 4), LANCE, SILVER, false, BLACK);
+    TEST_CHECK_EQUAL(state.see(capture), EffectState::seeValue(SILVER) - EffectState::seeValue(LANCE));
+    TEST_CHECK(state.seeGE(capture, 0));
+    TEST_CHECK(! state.seeGE(capture, EffectState::seeValue(SILVER)));
+  }
+  {
+    // white rook behind the moving silver
+    EffectState state(csa::read_board(
+      "P1 *  *  *  *  *  *  *  * -OU \n"
+      "P2 *  *  *  *  *  *  *  *  * \n"
+      "P3 *  *  *  *  *  *  *  *  * \n"
+      "P4 *  *  *  * -FU *  *  *  * \n"
+      "P5 *  *  *  * +GI *  *  *  * \n"
+      "P6 *  *  *  *  *  *  *  *  * \n"
+      "P7 *  *  *  * -HI *  *  *  * \n"
+      "P8 *  *  *  *  *  *  *  *  * \n"
+      "P9+OU *  *  *  *  *  *  *  * \n"
+      "P-00AL\n"
+      "+\n"));
+    const auto capture = Move(Square(5, 5), Square(5, 4), SILVER, PAWN, false, BLACK);
+    TEST_CHECK_EQUAL(state.see(capture), EffectState::seeValue(PAWN) - EffectState::seeValue(SILVER));
+    TEST_CHECK(! state.seeGE(capture, 0));
+  }
+}
+
 void test_state() {
   {
     BaseState state;
@@ -2100,6 +2185,23 @@ void test_usi() {
   }
 }
 
+void test_usi_string_view() {
+  const std::string buffer = "xx startpos moves 7g7f\t3c3d  8h2b+ yy";
+  std::string_view line(buffer);
+  auto record = usi::read_record(line.substr(3, line.size()-6));
+  TEST_CHECK(record.moves.size() == 3);
+  TEST_CHECK(record == usi::read_record(std::string("startpos moves 7g7f 3c3d 8h2b+")));
+  TEST_CHECK(usi::to_move(line.substr(18, 4), EffectState()) == record.moves[0]);
+  TEST_CHECK(psn::to_move_light(line.substr(18, 4), BaseState(HIRATE)) == record.moves[0]);
+  TEST_CHECK(csa::to_move(std::string_view("+7776FU"), EffectState()) == record.moves[0]);
+
+  // the move number is optional
+  auto sfen = "sfen lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b -";
+  TEST_CHECK(usi::read_record(std::string(sfen) + " moves 7g7f").moves.size() == 1);
+  TEST_CHECK(usi::read_record(std::string(sfen) + " 1 moves 7g7f").moves.size() == 1);
+  TEST_EXCEPTION(usi::read_record("startpos moves 7g7f+x"), usi::ParseError);
+}
+
 void test_classify()
 {
   // check
@@ -5328,6 +5430,647 @@ void test_parallel_game_manager() {
   }
 }
 
+void test_usi_file_parallel() {
+  auto dir = std::filesystem::temp_directory_path() / "minitest-usi-file";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  auto record = usi::read_record("startpos moves 7g7f 8c8d 2g2f 4a3b 2f2e 8d8e 8h7g 3c3d 7i8h 2b7g+ 8h7g 3a2b 3i4h 2b3c 1g1f 1c1d 4i5h 7a7b");
+  std::vector<MiniRecord> expected;
+  {
+    std::ofstream os(dir / "games.usi");
+    for (int i=0; i<3000; ++i) {
+      MiniRecord prefix;
+      prefix.set_initial_state(record.initial_state);
+      EffectState state(record.initial_state);
+      for (int j=0; j<i % (record.moves.size()+1); ++j) {
+        state.makeMove(record.moves[j]);
+        prefix.append_move(record.moves[j], state.inCheck());
+      }
+      expected.push_back(usi::read_record(to_usi(prefix)));
+      os << to_usi(prefix) << (i % 7 ? "\n" : "\r\n");
+      if (i % 500 == 0)
+        os << "\n";
+    }
+  }
+  for (int threads: {1, 3}) {
+    auto parallel = RecordSet::from_usi_file_parallel((dir / "games.usi").string(), threads);
+    TEST_CHECK(parallel.records.size() == expected.size());
+    TEST_CHECK(parallel.records == expected);
+  }
+  {
+    std::ofstream os(dir / "broken.usi");
+    os << to_usi(record) << "\n" << "startpos moves 7g7f 7g7f\n";
+  }
+  TEST_EXCEPTION(RecordSet::from_usi_file_parallel((dir / "broken.usi").string(), 2), std::exception);
+  TEST_EXCEPTION(RecordSet::from_usi_file_parallel((dir / "none.usi").string()), std::domain_error);
+  std::filesystem::remove_all(dir);
+}
+
+void test_usi_trusted() {
+  auto moves = std::string("startpos moves 7g7f 8c8d 2g2f 4a3b 2f2e 8d8e 8h7g 3c3d 7i8h 2b7g+ 8h7g");
+  for (auto line: {moves + " resign", moves + " 3a2b resign", moves + " win"}) {
+    auto record = SubRecord(usi::read_record(line));
+    auto trusted = SubRecord::from_usi_trusted(line);
+    TEST_CHECK(trusted.moves == record.moves);
+    TEST_CHECK(trusted.final_move == record.final_move);
+    TEST_CHECK(trusted.variant == record.variant);
+    if (record.final_move == Move::Resign())
+      TEST_CHECK(trusted.result == record.result);
+  }
+  // declaration is trusted
+  TEST_CHECK(SubRecord::from_usi_trusted(moves + " win").result == WhiteWin);
+  {
+    auto sfen = to_usi(BaseState(Shogi816K, 123));
+    auto record = SubRecord(usi::read_record(sfen + " moves 5g5f resign"));
+    auto trusted = SubRecord::from_usi_trusted(sfen + " moves 5g5f resign");
+    TEST_CHECK(trusted.variant == Shogi816K && trusted.shogi816k_id == 123);
+    TEST_CHECK(trusted.moves == record.moves && trusted.result == record.result);
+  }
+  // repetition is settled only on request
+  std::string repetition = "startpos moves";
+  for (int i=0; i<3; ++i)
+    repetition += " 5i5h 5a5b 5h5i 5b5a";
+  TEST_CHECK(SubRecord::from_usi_trusted(repetition).result == InGame);
+  TEST_CHECK(SubRecord::from_usi_trusted(repetition).moves.size() == 12);
+  TEST_CHECK(SubRecord::from_usi_trusted(repetition, true).result == Draw);
+  TEST_CHECK(SubRecord::from_usi_trusted(repetition, true).result == usi::read_record(repetition).result);
+  TEST_EXCEPTION(SubRecord::from_usi_trusted("startpos moves 7g7f 7g7f"), psn::ParseError);
+  TEST_EXCEPTION(SubRecord::from_usi_trusted("startpos 7g7f"), usi::ParseError);
+
+  auto dir = std::filesystem::temp_directory_path() / "minitest-usi-trusted";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  {
+    std::ofstream os(dir / "games.usi");
+    for (int i=0; i<2000; ++i)
+      os << (i % 3 ? moves + " resign" : repetition) << "\n";
+  }
+  for (bool settle: {false, true}) {
+    auto records = SubRecord::from_usi_file_trusted((dir / "games.usi").string(), 3, settle);
+    TEST_CHECK(records.size() == 2000);
+    TEST_CHECK(records[1].result == BlackWin);
+    TEST_CHECK(records[3].result == (settle ? Draw : InGame));
+    TEST_CHECK(records[1].moves == records[1999].moves);
+  }
+  std::filesystem::remove_all(dir);
+}
+
+void test_path_parallel() {
+  auto dir = std::filesystem::temp_directory_path() / "minitest-path-parallel";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  const char *moves[] = { "+7776FU\n", "-3334FU\n", "+2726FU\n", "-8384FU\n" };
+  for (int i=0; i<300; ++i) {
+    std::ostringstream name;
+    name << std::setw(4) << std::setfill('0') << i;
+    if (i % 10 == 9) {
+      std::ofstream os(dir / (name.str() + ".kif"));
+      os << "手数----指手---------消費時間--\n"
+         << "1   ２六歩(27)   (0:3/0:0:3)\n"
+         << "2   ３四歩(33)   (0:1/0:0:1)\n";
+      continue;
+    }
+    std::ofstream os(dir / (name.str() + ".csa"));
+    os << "PI\n+\n";
+    for (int j=0; j<i % 5; ++j)
+      os << moves[j % 4];
+    if (i % 50 == 7)
+      os << moves[0];           // illegal
+    os << "%TORYO\n";
+  }
+  { std::ofstream os(dir / "note.txt"); os << "not a record\n"; }
+
+  std::vector<RecordSet::FileError> errors;
+  auto records = RecordSet::from_path_parallel(dir.string(), 3, &errors);
+  TEST_CHECK(errors.size() == 6);
+  TEST_CHECK(records.records.size() == 294);
+  if (! errors.empty())
+    TEST_CHECK(std::filesystem::path(errors[0].path).filename() == "0007.csa");
+  TEST_CHECK(records.records[1].moves.size() == 1);
+  TEST_CHECK(records.records[4].moves.size() == 4);
+  TEST_CHECK(records.records[8].moves.size() == 2); // 0009.kif
+  TEST_CHECK(records.records[8].moves[1] == records.records[2].moves[1]);
+  TEST_EXCEPTION(RecordSet::from_path_parallel(dir.string(), 2), std::exception);
+
+  auto writer = std::make_shared<BitpackRecordWriter>((dir / "bin").string(), 100);
+  errors.clear();
+  auto none = RecordSet::from_path_parallel(dir.string(), 2, &errors, writer.get());
+  TEST_CHECK(none.records.empty());
+  TEST_CHECK(errors.size() == 6);
+  TEST_CHECK(writer->n_written() + writer->n_skipped() == 294);
+  TEST_CHECK(writer->n_skipped() == 60);  // empty records of i % 5 == 0
+  std::filesystem::remove_all(dir);
+}
+
+/**
+ * at least `count` completed games of `variant` played by `choose(game, legal_moves)`,
+ * a uniformly random move if not given
+ */
+std::vector<MiniRecord> random_completed_games(GameVariant variant, size_t count, std::default_random_engine& rsrc,
+                                               std::function<Move(const GameManager&, MoveVector&)> choose={}) {
+  const int N = 4;
+  GameConfig cfg;
+  cfg.variant = variant;
+  ParallelGameManager mgrs(N, cfg);
+  while (mgrs.completed_games.size() < count) {
+    std::vector<Move> moves_chosen(N);
+    for (int g=0; g<N; ++g) {
+      MoveVector moves;
+      mgrs.games[g].state.generateLegal(moves);
+      if (choose)
+        moves_chosen[g] = choose(mgrs.games[g], moves);
+      else {
+        std::shuffle(moves.begin(), moves.end(), rsrc);
+        moves_chosen[g] = moves[0];
+      }
+    }
+    mgrs.make_move_parallel(moves_chosen);
+  }
+  return mgrs.completed_games;
+}
+
+void test_indexed_record() {
+  auto dir = std::filesystem::temp_directory_path() / "minitest-indexed-record";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  auto path = (dir / "games.idx").string();
+  std::vector<MiniRecord> records;
+  {
+    std::default_random_engine rsrc;
+    IndexedRecordWriter writer(path);
+    writer.add(MiniRecord());   // empty, skipped
+    records = random_completed_games(Shogi816K, 20, rsrc);
+    records.resize(20);
+    for (const auto& record: records)
+      writer.add(record);
+    TEST_CHECK(writer.n_written() == 20);
+    TEST_CHECK(writer.n_skipped() == 1);
+  }
+  IndexedRecordFile file(path);
+  TEST_ASSERT(file.size() == records.size());
+  for (size_t k: {19, 0, 7, 3}) {
+    TEST_CHECK(file.result(k) == records[k].result);
+    TEST_CHECK(file.variant(k) == Shogi816K);
+    TEST_CHECK(file.move_size(k) == records[k].moves.size());
+    TEST_CHECK(file.moves(k) == records[k].moves);
+    auto record = file.record(k);
+    TEST_CHECK(record.initial_state == records[k].initial_state);
+    TEST_CHECK(record.moves == records[k].moves);
+  }
+  TEST_EXCEPTION(file.result(20), std::out_of_range);
+  {
+    std::ofstream os(dir / "broken.idx");
+    os << "not an indexed record file";
+  }
+  TEST_EXCEPTION(IndexedRecordFile((dir / "broken.idx").string()), std::domain_error);
+  {
+    // entries pointing outside of the records
+    auto corrupt = (dir / "corrupt.idx").string();
+    std::filesystem::copy_file(path, corrupt);
+    std::fstream fs(corrupt, std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t header[indexed_record::header_words];
+    fs.read(reinterpret_cast<char*>(header), sizeof(header));
+    auto entry_pos = [&](int k) { return header[3]*sizeof(uint64_t) + k*sizeof(indexed_record::Entry); };
+    indexed_record::Entry e;
+    fs.seekg(entry_pos(3));
+    fs.read(reinterpret_cast<char*>(&e), sizeof(e));
+    e.offset = header[3];
+    fs.seekp(entry_pos(3));
+    fs.write(reinterpret_cast<const char*>(&e), sizeof(e));
+    fs.seekg(entry_pos(5));
+    fs.read(reinterpret_cast<char*>(&e), sizeof(e));
+    e.words -= 1;
+    fs.seekp(entry_pos(5));
+    fs.write(reinterpret_cast<const char*>(&e), sizeof(e));
+    fs.seekg(entry_pos(6));
+    fs.read(reinterpret_cast<char*>(&e), sizeof(e));
+    e.offset = UINT64_MAX - 1;  // offset + words wraps around
+    fs.seekp(entry_pos(6));
+    fs.write(reinterpret_cast<const char*>(&e), sizeof(e));
+    fs.close();
+    IndexedRecordFile file(corrupt);
+    TEST_EXCEPTION(file.record(3), std::domain_error);
+    TEST_EXCEPTION(file.move_size(3), std::domain_error);
+    TEST_EXCEPTION(file.sub_record(5), std::domain_error);
+    TEST_EXCEPTION(file.moves(6), std::domain_error);
+    TEST_CHECK(file.moves(4) == records[4].moves);
+  }
+  {
+    // a number of records whose index size wraps around
+    auto huge = (dir / "huge.idx").string();
+    std::filesystem::copy_file(path, huge);
+    std::fstream fs(huge, std::ios::in | std::ios::out | std::ios::binary);
+    const uint64_t n_records = uint64_t(1) << 60;
+    fs.seekp(2*sizeof(uint64_t));
+    fs.write(reinterpret_cast<const char*>(&n_records), sizeof(n_records));
+    fs.close();
+    TEST_EXCEPTION(IndexedRecordFile{huge}, std::domain_error);
+  }
+  if (std::filesystem::exists("/dev/full")) {
+    // write errors at destruction are reported, not thrown
+    IndexedRecordWriter writer("/dev/full");
+    writer.add(records[0]);
+  }
+  std::filesystem::remove_all(dir);
+}
+
+void test_binary_moves() {
+  std::default_random_engine rsrc;
+  std::vector<MiniRecord> records;
+  for (auto variant: {HIRATE, Shogi816K})
+    std::ranges::copy(random_completed_games(variant, 150, rsrc), std::back_inserter(records));
+  std::ranges::shuffle(records, rsrc);
+  std::vector<uint64_t> code;
+  for (const auto& record: records) {
+    const auto before = code.size();
+    bitpack::append_binary_record(record, code);
+    TEST_CHECK(bitpack::binary_record_words(&code[before]) == code.size() - before);
+  }
+
+  const uint64_t *ptr = code.data();
+  std::vector<SubRecord> decoded;
+  for (const auto& record: records) {
+    SubRecord light;
+    const uint64_t *copy = ptr;
+    MiniRecord full;
+    auto n = bitpack::read_binary_record(ptr, light);
+    TEST_CHECK(bitpack::read_binary_record(copy, full) == n);
+    SubRecord expected(full);
+    TEST_CHECK(light.moves == expected.moves);
+    TEST_CHECK(light.variant == expected.variant && light.shogi816k_id == expected.shogi816k_id);
+    TEST_CHECK(light.result == expected.result && light.final_move == expected.final_move);
+    TEST_CHECK(light.moves == record.moves);
+    decoded.push_back(expected);
+  }
+  TEST_CHECK(ptr == code.data() + code.size());
+
+  for (int threads: {1, 3}) {
+    auto arena = bitpack::read_binary_records_parallel(code.data(), code.size(), threads);
+    TEST_ASSERT(arena.size() == records.size());
+    TEST_CHECK(arena.moves.size() == arena.offsets.back());
+    for (size_t k=0; k<records.size(); ++k) {
+      auto record = arena.record(k);
+      TEST_CHECK(record.moves == decoded[k].moves);
+      TEST_CHECK(record.result == decoded[k].result);
+      TEST_CHECK(record.final_move == decoded[k].final_move);
+      TEST_CHECK(record.initial_state() == BaseState(records[k].initial_state));
+    }
+  }
+  TEST_EXCEPTION(bitpack::read_binary_records_parallel(code.data(), code.size()-1), std::domain_error);
+
+  // draw_limit is applied to records stored in game
+  auto draw = std::ranges::find_if(records, [](const auto& r) {
+    return r.result == Draw && r.move_size() >= MiniRecord::draw_limit;
+  });
+  TEST_ASSERT(draw != records.end());
+  {
+    auto record = *draw;
+    record.result = InGame;
+    std::vector<uint64_t> code;
+    bitpack::append_binary_record(record, code);
+    const uint64_t *ptr = code.data();
+    SubRecord light;
+    bitpack::read_binary_record(ptr, light);
+    TEST_CHECK_EQUAL(light.result, Draw);
+    TEST_CHECK_EQUAL(bitpack::read_binary_records_parallel(code.data(), code.size()).results[0], Draw);
+  }
+}
+
+void test_dynamic_parallel() {
+  for (int threads: {0, 1, 3}) {
+    std::vector<int> hit(1000, 0);
+    run_dynamic_parallel(hit.size(), [&](size_t i) { hit[i] += 1; }, threads, 7);
+    TEST_CHECK(std::ranges::count(hit, 1) == hit.size());
+    TEST_EXCEPTION(run_dynamic_parallel(hit.size(), [&](size_t i) {
+      if (i == 500)
+        throw std::runtime_error("stop");
+    }, threads), std::runtime_error);
+  }
+  run_dynamic_parallel(0, [](size_t) { TEST_CHECK(false); });
+}
+
+void test_rank_coder() {
+  std::default_random_engine rsrc;
+  std::vector<MiniRecord> records;
+  // plausible games prefer higher ranks
+  auto choose = [&](const GameManager& game, MoveVector& moves) {
+    rankcode::order_moves(game.state, game.record.moves.empty() ? Move() : game.record.moves.back(), moves);
+    return moves[std::min<int>(moves.size()-1, std::geometric_distribution<int>(0.3)(rsrc))];
+  };
+  for (auto variant: {HIRATE, Shogi816K, Aozora})
+    std::ranges::copy(random_completed_games(variant, 20, rsrc, choose), std::back_inserter(records));
+  std::ranges::shuffle(records, rsrc);
+
+  std::ostringstream os;
+  {
+    rankcode::RecordEncoder encoder(os);
+    for (const auto& record: records)
+      encoder.add(record);
+    auto broken = records[0];
+    broken.moves.push_back(broken.moves.back());
+    TEST_EXCEPTION(encoder.add(broken), std::domain_error);
+    encoder.add(records[0]);
+  }
+  const auto code = os.str();
+
+  std::istringstream is(code);
+  rankcode::RecordDecoder decoder(is);
+  MiniRecord record;
+  for (size_t k=0; k<=records.size(); ++k) {
+    TEST_ASSERT(decoder.next(record));
+    const auto& expected = records[k % records.size()];
+    TEST_CHECK(record.moves == expected.moves);
+    TEST_CHECK(record.initial_state == expected.initial_state);
+    TEST_CHECK(record.variant == expected.variant);
+    TEST_CHECK(record.result == expected.result);
+    if (expected.has_winner())
+      TEST_CHECK(record.final_move == expected.final_move);
+    TEST_CHECK(record.history == expected.history);
+  }
+  TEST_CHECK(! decoder.next(record));
+  TEST_CHECK(! decoder.next(record));
+
+  std::istringstream none("MOSL");
+  TEST_EXCEPTION(rankcode::RecordDecoder decoder(none), std::domain_error);
+  auto path = (std::filesystem::temp_directory_path() / "minitest-rank-coder.bin").string();
+  TEST_CHECK(rankcode::save(path, records) == records.size());
+  TEST_CHECK(rankcode::load(path).size() == records.size());
+  std::filesystem::remove(path);
+
+  // golden bytes of a real game, a failure here means the format is changed (see order_moves)
+  {
+    const auto sample = usi::read_record("startpos moves 7g7f 8c8d 2g2f 4a3b 2f2e 8d8e 8h7g 1c1d 7i7h 1d1e 6g6f 7a7b 3i4h 5a5b 5i6h 7c7d 4i5h 9c9d 9g9f 8a7c 3g3f 3c3d 4h3g 2b3c 3g4f 4c4d 3f3e 3d3e 4f3e 3a4b 2e2d 2c2d 3e2d P*2g 2h2g 3c2d 2g2d P*2c 2d4d 3b4c 4d7d 2a3c P*3d 3c4e 6h7i 8e8f 8g8f 5c5d B*3b 4e5g+ 5h5g P*8g 7h8g 9d9e 3b2c+ 9e9f 3d3c+ 4c3c 2c2b 9f9g+ 9i9g 9a9g+ 8i9g P*9f 8g9f P*9e 9f8g S*9f 8g9f 9e9f N*4e 3c4c 7d9d 9f9g+ 9d9g N*8e 8f8e 7c8e P*5c 5b6b N*7d 6b7c 7d8b+ 8e9g+ R*9c 7c8b S*7c 8b9c 7c7b 6a7b L*8e P*8d 7i6h R*2h 5g5h L*5f P*9d 9c8b 9d9c+ 8b9c P*9d 9c8b P*8c 7b8c 9d9c+ 8c9c P*8c 9c8c 2b1a 5f5h+ 6i5h N*5f 6h6g R*6i 6g5f 2h5h+ N*5g G*5e 1a5e 5d5e 5f5e S*5d 5e4f B*2h L*3g 2h3g+ 2i3g 5h2h 8e8d 8c8d L*8e 2h2f G*3f G*3e 4f5f 2f3f B*4f");
+    std::ostringstream os;
+    {
+      rankcode::RecordEncoder encoder(os);
+      encoder.add(sample);
+    }
+    const std::vector<uint8_t> golden = {
+      0x4d, 0x4f, 0x53, 0x4c, 0x52, 0x43, 0x30, 0x32, 0x00, 0x84, 0x4f, 0x63,
+      0x06, 0xe9, 0x0d, 0x20, 0x0c, 0x4b, 0x68, 0xbc, 0xa1, 0x02, 0x08, 0x97,
+      0x70, 0x3f, 0x0e, 0xb6, 0xf4, 0x51, 0xf5, 0xb8, 0x3f, 0x06, 0x0b, 0x5e,
+      0x0e, 0xfb, 0xda, 0x6e, 0x6e, 0x8d, 0xf6, 0x4c, 0x8f, 0x78, 0xb6, 0x57,
+      0x74, 0x7a, 0xbd, 0x31, 0xee, 0x1b, 0x5c, 0x9c, 0x32, 0x69, 0xd8, 0x78,
+      0xa1, 0x43, 0xb7, 0x53, 0x51, 0x00, 0x87, 0xff, 0xd0, 0x73, 0x9a, 0x36,
+      0xbc, 0x22, 0x47, 0x84, 0x23, 0xcd, 0x0f, 0xb0, 0x9d, 0xd5, 0xd2, 0x1f,
+      0xd5, 0x5f, 0x68, 0x7e, 0xb4, 0x77, 0x64, 0x5b, 0x1b, 0xe7, 0x93, 0x5b,
+      0x4e, 0x67, 0xf6, 0x02, 0xf6, 0x50, 0x92, 0x00,
+    };
+    const auto code = os.str();
+    TEST_CHECK(std::vector<uint8_t>(code.begin(), code.end()) == golden);
+    // fewer than 8 bits per move after the header, while bitpack takes 12
+    TEST_CHECK((code.size() - 8) * 8 < sample.moves.size() * 8);
+    std::vector<uint64_t> words;
+    TEST_CHECK((code.size() - 8) * 3 < bitpack::append_binary_record(sample, words) * sizeof(uint64_t) * 2);
+    TEST_MSG("%zu bytes for %zu moves", code.size(), sample.moves.size());
+
+    std::istringstream is(std::string(golden.begin(), golden.end()));
+    rankcode::RecordDecoder decoder(is);
+    MiniRecord record;
+    TEST_ASSERT(decoder.next(record));
+    TEST_CHECK(record.moves == sample.moves);
+    TEST_CHECK(record.result == sample.result);
+    TEST_CHECK(! decoder.next(record));
+  }
+}
+
+void test_position_shard() {
+  std::default_random_engine rsrc;
+  std::vector<SubRecord> records;
+  for (auto variant: {HIRATE, Shogi816K, Aozora}) {
+    for (const auto& record: random_completed_games(variant, 4, rsrc)) {
+      // packed states
+      EffectState state(record.initial_state);
+      for (auto move: record.moves) {
+        TEST_CHECK(position_shard::unpack_state(position_shard::pack_state(state)) == BaseState(state));
+        state.makeMove(move);
+      }
+      records.emplace_back(record);
+    }
+  }
+  auto path = (std::filesystem::temp_directory_path() / "minitest-position-shard.bin").string();
+  std::vector<std::pair<int,int>> positions;
+  {
+    PositionShardWriter writer(path);
+    for (size_t k=0; k<records.size(); ++k)
+      for (int idx: {0, 1, 2, 6, 7, 8, int(records[k].moves.size())-1}) {
+        writer.add(records[k], idx);
+        positions.emplace_back(k, idx);
+      }
+    TEST_EXCEPTION(writer.add(records[0], records[0].moves.size()), std::range_error);
+    writer.add_samples(records, 2, SubRecord::default_decay, 1);
+    TEST_CHECK(writer.size() == positions.size() + records.size()*2);
+  }
+  PositionShardFile shard(path);
+  TEST_ASSERT(shard.size() == positions.size() + records.size()*2);
+  TEST_CHECK(shard.entry(positions.size()).sampled_id < records[0].moves.size());
+
+  const int N = positions.size();
+  std::vector<nn_input_element> inputs(N*ml::input_unit), inputs2(N*ml::input_unit),
+    aux(N*ml::aux_unit);
+  std::vector<int32_t> policy(N);
+  std::vector<float> value(N);
+  std::vector<uint8_t> legal(N*ml::legalmove_bs_sz);
+  std::vector<uint16_t> sampled(N);
+  auto expected = std::make_tuple(inputs, inputs2, aux, policy, value, legal, sampled);
+  for (int i=0; i<N; ++i) {
+    auto& [x, x2, a, p, v, l, s] = expected;
+    records[positions[i].first].export_feature_labels_to(positions[i].second, i, x.data(), p.data(), v.data(),
+                                                         a.data(), x2.data(), l.data(), s.data());
+    shard.export_feature_labels_to(i, i, inputs.data(), policy.data(), value.data(),
+                                   aux.data(), inputs2.data(), legal.data(), sampled.data());
+  }
+  TEST_CHECK(inputs == std::get<0>(expected));
+  TEST_CHECK(inputs2 == std::get<1>(expected));
+  TEST_CHECK(aux == std::get<2>(expected));
+  TEST_CHECK(policy == std::get<3>(expected));
+  TEST_CHECK(value == std::get<4>(expected));
+  TEST_CHECK(legal == std::get<5>(expected));
+  TEST_CHECK(sampled == std::get<6>(expected));
+  TEST_EXCEPTION(shard.entry(shard.size()), std::out_of_range);
+  {
+    // a number of entries whose size wraps around
+    auto huge = path + ".huge";
+    std::filesystem::copy_file(path, huge, std::filesystem::copy_options::overwrite_existing);
+    std::fstream fs(huge, std::ios::in | std::ios::out | std::ios::binary);
+    const uint64_t n_entries = UINT64_MAX / sizeof(position_shard::Entry) + 1;
+    fs.seekp(2*sizeof(uint64_t));
+    fs.write(reinterpret_cast<const char*>(&n_entries), sizeof(n_entries));
+    fs.close();
+    TEST_EXCEPTION(PositionShardFile{huge}, std::domain_error);
+    std::filesystem::remove(huge);
+  }
+  std::filesystem::remove(path);
+  if (std::filesystem::exists("/dev/full")) {
+    // write errors at destruction are reported, not thrown
+    PositionShardWriter writer("/dev/full");
+    writer.add(records[0], 0);
+  }
+}
+
+void test_opening_concurrent_visit() {
+  OpeningTreeEditable tree;
+  EffectState state;
+  MoveVector moves;
+  state.generateLegal(moves);
+  const auto root = HashStatus(state).basic();
+  tree[root].depth = 0;
+  for (auto move: moves)
+    tree[make_move(root, move)].depth = 1;
+  {
+    EffectState child(state);
+    child.makeMove(moves[0]);
+    MoveVector replies;
+    child.generateLegal(replies);
+    TEST_CHECK(! tree.add_visit(make_move(HashStatus(child).basic(), replies[0])));
+  }
+
+  auto root_node = tree.edit(root);
+  TEST_ASSERT(root_node.has_value());
+  const int n_threads = 4, rounds = 20000;
+  std::vector<std::thread> threads;
+  for (int t=0; t<n_threads; ++t)
+    threads.emplace_back([&, t]() {
+      std::vector<size_t> visits;
+      for (int i=0; i<rounds; ++i) {
+        if (i % 2)
+          tree.add_visit(root);
+        else
+          OpeningTree::add_visit(**root_node);
+        tree.add_visit(make_move(root, moves[(i+t) % moves.size()]), (i % 2) ? BlackWin : InGame);
+        tree.count_visits(root, moves, visits);
+      }
+    });
+  for (auto& t: threads)
+    t.join();
+  TEST_CHECK_EQUAL(tree.read(root)->count(), n_threads*rounds);
+  TEST_CHECK_EQUAL((*tree.read(root))[InGame], n_threads*rounds);
+  TEST_CHECK_EQUAL(tree.read(root)->depth, 0);
+  std::vector<size_t> visits;
+  TEST_CHECK_EQUAL(tree.count_visits(root, moves, visits), n_threads*rounds);
+  int black_win = 0;
+  for (auto move: moves)
+    black_win += (*tree.read(make_move(root, move)))[BlackWin];
+  TEST_CHECK_EQUAL(black_win, n_threads*rounds/2);
+}
+
+void test_opening_merge() {
+  auto dir = std::filesystem::temp_directory_path() / "minitest-opening-merge";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  std::mt19937 rng(1);
+  const int n_books = 3, n_keys = 50, threshold = 3;
+  std::map<BasicHash, OpeningTree::Node> expected;
+  std::vector<std::string> books;
+  for (int b=0; b<n_books; ++b) {
+    OpeningTreeEditable tree;
+    for (int k=0; k<n_keys; ++k) {
+      if (rng() % 3 == 0)
+        continue;
+      BasicHash key = {uint64_t(k) * 0x9e3779b97f4a7c15ull, uint32_t(k % 5)};
+      OpeningTree::Node node;
+      for (auto& c: node.result_count)
+        c = rng() % 3;
+      node.depth = rng() % 10;
+      node.age = rng() % 4;
+      node.black_value_backup = node.age * .25 + b * .01;
+      tree[key] = node;
+      if (expected.contains(key))
+        opening_run::accumulate(expected[key], node);
+      else
+        expected[key] = node;
+    }
+    books.push_back((dir / ("book" + std::to_string(b) + ".bin")).string());
+    tree.save_binary(books.back());
+  }
+  std::erase_if(expected, [&](const auto& e) { return e.second.count() < threshold; });
+
+  auto output = (dir / "merged.bin").string();
+  // small runs to merge more than one run per book
+  auto n = OpeningTree::merge_binary(books, output, threshold, "", 7);
+  TEST_CHECK_EQUAL(n, expected.size());
+  TEST_CHECK(! std::filesystem::exists(output + ".runs"));
+  auto merged = OpeningTree::load_binary(output);
+  TEST_CHECK_EQUAL(merged->size(), expected.size());
+  for (const auto& [key, node]: expected) {
+    auto q = merged->read(key);
+    TEST_ASSERT(q.has_value());
+    TEST_CHECK(q->result_count == node.result_count);
+    TEST_CHECK_EQUAL(q->depth, node.depth);
+    TEST_CHECK_EQUAL(q->age, node.age);
+    TEST_CHECK_EQUAL(q->black_value_backup, node.black_value_backup);
+  }
+
+  auto runs = merged->save_sorted_runs((dir / "again").string(), 4);
+  TEST_CHECK_EQUAL(runs.size(), (expected.size()+3)/4);
+  auto run = (dir / "again.run").string();
+  TEST_CHECK_EQUAL(opening_run::merge(runs, run), expected.size());
+  TEST_CHECK_EQUAL(opening_run::merge({run}, (dir / "pruned.run").string(), 1000), 0);
+  TEST_EXCEPTION(opening_run::merge({books[0]}, run), std::domain_error);
+  std::filesystem::remove_all(dir);
+}
+
+void test_record_writer() {
+  auto dir = std::filesystem::temp_directory_path() / "minitest-record-writer";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  std::default_random_engine rsrc;
+  const int N = 4, N_TARGET = 10;
+  GameConfig cfg;
+  cfg.variant = Shogi816K;
+  ParallelGameManager mgrs(N, cfg);
+  auto writer = std::make_shared<BitpackRecordWriter>((dir / "games").string(), 3);
+  mgrs.sink = writer;
+  std::vector<MiniRecord> expected;
+  while (mgrs.completed_count < N_TARGET) {
+    std::vector<Move> moves_chosen(N);
+    for (int g=0; g<N; ++g) {
+      MoveVector moves;
+      mgrs.games[g].state.generateLegal(moves);
+      std::shuffle(moves.begin(), moves.end(), rsrc);
+      moves_chosen[g] = moves[0];
+    }
+    auto copy = mgrs.games;
+    auto ret = mgrs.make_move_parallel(moves_chosen);
+    for (int g=0; g<N; ++g)
+      if (ret[g] != InGame) {
+        copy[g].make_move(moves_chosen[g]);
+        if (cfg.force_declare && copy[g].record.result == InGame)
+          copy[g].record.guess_result(copy[g].state);
+        expected.push_back(copy[g].record);
+      }
+  }
+  TEST_CHECK(mgrs.completed_games.empty());
+  writer->flush();
+  TEST_CHECK_EQUAL(writer->n_written(), expected.size());
+  auto counts = writer->result_count();
+  TEST_CHECK_EQUAL(std::accumulate(counts.begin(), counts.end(), size_t(0)), expected.size());
+  auto files = writer->files();
+  TEST_CHECK_EQUAL(files.size(), (expected.size()+2)/3);
+
+  std::vector<MiniRecord> loaded;
+  for (const auto& file: files) {
+    std::ifstream is(file, std::ios::binary);
+    std::vector<uint64_t> code;
+    uint64_t c;
+    while (is.read(reinterpret_cast<char*>(&c), sizeof(c)))
+      code.push_back(c);
+    const uint64_t *ptr = code.data();
+    while (ptr < code.data() + code.size()) {
+      MiniRecord record;
+      bitpack::read_binary_record(ptr, record);
+      loaded.push_back(record);
+    }
+  }
+  TEST_ASSERT(loaded.size() == expected.size());
+  for (size_t i=0; i<loaded.size(); ++i) {
+    TEST_CHECK(loaded[i].moves == expected[i].moves);
+    TEST_CHECK(loaded[i].result == expected[i].result);
+    TEST_CHECK(loaded[i].shogi816k_id == expected[i].shogi816k_id);
+  }
+  std::filesystem::remove_all(dir);
+}
+
 void test_make_move_unsafe() {
   auto record = usi::read_record(long_sfen);
   EffectState state = record.initial_state;
@@ -5428,6 +6171,131 @@ void test_subrecord_sample() {
   }
 }
 
+void test_compact_record_block() {
+  auto sfen = "startpos moves 7g7f 8c8d 2g2f 4a3b 2f2e 8d8e 8h7g 1c1d 7i7h 1d1e 6g6f 7a7b 3i4h 5a5b 5i6h 7c7d 4i5h 9c9d 9g9f 8a7c 3g3f 3c3d 4h3g 2b3c 3g4f 4c4d 3f3e 3d3e 4f3e 3a4b 2e2d 2c2d 3e2d P*2g 2h2g 3c2d 2g2d P*2c 2d4d 3b4c 4d7d 2a3c P*3d 3c4e 6h7i 8e8f 8g8f 5c5d B*3b 4e5g+ 5h5g P*8g 7h8g 9d9e 3b2c+ 9e9f 3d3c+ 4c3c 2c2b 9f9g+ 9i9g 9a9g+ 8i9g P*9f 8g9f P*9e 9f8g S*9f 8g9f 9e9f N*4e 3c4c 7d9d 9f9g+ 9d9g N*8e 8f8e 7c8e P*5c 5b6b N*7d 6b7c 7d8b+ 8e9g+ R*9c 7c8b S*7c 8b9c 7c7b 6a7b L*8e P*8d 7i6h R*2h 5g5h L*5f P*9d 9c8b 9d9c+ 8b9c P*9d 9c8b P*8c 7b8c 9d9c+ 8c9c P*8c 9c8c 2b1a 5f5h+ 6i5h N*5f 6h6g R*6i 6g5f 2h5h+ resign";
+  std::vector<SubRecord> records = { SubRecord(usi::read_record(sfen)) };
+  {
+    GameManager game(Shogi816K, 1234);
+    for (int i=0; i<8; ++i)
+      game.make_move(game.legal_moves[i % game.legal_moves.size()]);
+    game.record.result = BlackWin;
+    game.record.final_move = Move::DeclareWin();
+    records.emplace_back(game.record);
+  }
+  {
+    // a draw keeps the default final move of MiniRecord, also through the light binary decoding
+    GameManager game;
+    for (int i=0; i<8; ++i)
+      game.make_move(game.legal_moves[i % game.legal_moves.size()]);
+    game.record.result = Draw;
+    records.emplace_back(game.record);
+    TEST_CHECK(records.back().final_move == Move::PASS(BLACK));
+    std::vector<uint64_t> code;
+    bitpack::append_binary_record(game.record, code);
+    const uint64_t *ptr = code.data();
+    SubRecord light;
+    bitpack::read_binary_record(ptr, light);
+    TEST_CHECK(light.final_move == Move::PASS(BLACK));
+    records.push_back(light);
+  }
+  CompactRecordBlock block(records);
+  TEST_CHECK(block.size() == records.size());
+  size_t plain = records.size() * sizeof(SubRecord);
+  for (size_t k=0; k<records.size(); ++k) {
+    plain += records[k].moves.size() * sizeof(Move);
+    TEST_CHECK(block.move_size(k) == records[k].moves.size());
+    TEST_CHECK(block.result(k) == records[k].result);
+    auto decoded = block.record(k);
+    TEST_CHECK(decoded.moves == records[k].moves);
+    TEST_CHECK(decoded.variant == records[k].variant);
+    TEST_CHECK(decoded.shogi816k_id == records[k].shogi816k_id);
+    TEST_CHECK(decoded.final_move == records[k].final_move);
+    TEST_CHECK(block.moves(k, 5) == MoveVector(records[k].moves.begin(), records[k].moves.begin()+5));
+  }
+  TEST_CHECK(block.memory_bytes() < plain);
+
+  // sampled features are identical to those of SubRecord
+  std::vector<nn_input_element> in_a(ml::input_unit, 0), in_b(ml::input_unit, 0),
+    aux_a(ml::aux_unit, 0), aux_b(ml::aux_unit, 0);
+  for (int i=0; i<16; ++i) {
+    std::ranges::fill(in_a, 0), std::ranges::fill(in_b, 0), std::ranges::fill(aux_a, 0), std::ranges::fill(aux_b, 0);
+    int32_t policy_a, policy_b;
+    float value_a, value_b;
+    uint16_t id_a, id_b;
+    rng::CounterRNG rng_a(rng::game_key(1, i), 0, rng::Purpose::TrainingSample), rng_b = rng_a;
+    records[i%records.size()].sample_feature_labels_to(0, &in_a[0], &policy_a, &value_a, &aux_a[0], nullptr, nullptr, &id_a,
+                                                       SubRecord::default_decay, rng_a);
+    block.sample_feature_labels_to(i%records.size(), 0, &in_b[0], &policy_b, &value_b, &aux_b[0], nullptr, nullptr, &id_b,
+                                   SubRecord::default_decay, rng_b);
+    TEST_CHECK(id_a == id_b);
+    TEST_CHECK(policy_a == policy_b && value_a == value_b);
+    TEST_CHECK(in_a == in_b && aux_a == aux_b);
+  }
+}
+
+void test_batch_prefetcher() {
+  auto sfen = "startpos moves 7g7f 8c8d 2g2f 4a3b 2f2e 8d8e 8h7g 1c1d 7i7h 1d1e 6g6f 7a7b 3i4h 5a5b 5i6h 7c7d 4i5h 9c9d 9g9f 8a7c 3g3f 3c3d 4h3g 2b3c 3g4f 4c4d 3f3e 3d3e 4f3e 3a4b 2e2d 2c2d 3e2d P*2g 2h2g 3c2d 2g2d P*2c 2d4d 3b4c 4d7d 2a3c P*3d 3c4e 6h7i 8e8f 8g8f 5c5d B*3b 4e5g+ 5h5g P*8g 7h8g 9d9e 3b2c+ 9e9f 3d3c+ 4c3c 2c2b 9f9g+ 9i9g 9a9g+ 8i9g P*9f 8g9f P*9e 9f8g S*9f 8g9f 9e9f N*4e 3c4c 7d9d 9f9g+ 9d9g N*8e 8f8e 7c8e P*5c 5b6b N*7d 6b7c 7d8b+ 8e9g+ R*9c 7c8b S*7c 8b9c 7c7b 6a7b L*8e P*8d 7i6h R*2h 5g5h L*5f P*9d 9c8b 9d9c+ 8b9c P*9d 9c8b P*8c 7b8c 9d9c+ 8c9c P*8c 9c8c 2b1a 5f5h+ 6i5h N*5f 6h6g R*6i 6g5f 2h5h+ resign";
+  std::vector<SubRecord> records;
+  for (int i=0; i<2; ++i)
+    records.emplace_back(usi::read_record(sfen));
+  {
+    // a drawn game, as it is and decoded through MoveArena
+    GameManager game;
+    for (int i=0; i<24; ++i)
+      game.make_move(game.legal_moves[i % game.legal_moves.size()]);
+    game.record.result = Draw;
+    records.emplace_back(game.record);
+    std::vector<uint64_t> code;
+    bitpack::append_binary_record(game.record, code);
+    auto arena = bitpack::read_binary_records_parallel(code.data(), code.size(), 1);
+    records.push_back(arena.record(0));
+  }
+  auto policy_label = [](const SubRecord& record, int idx) {
+    auto move = record.moves[idx];
+    return ml::policy_move_label(idx % 2 ? move.rotate180() : move);
+  };
+  BatchPrefetcherConfig config;
+  config.batch_size = 8;
+  config.ring_size = 3;
+  config.window_size = 8;
+  config.seed = 1;
+  std::vector<TrainingBatch> batches;
+  // the same batches for the seed however many threads fill them
+  for (int run=0; run<2; ++run) {
+    config.n_threads = run == 0 ? 2 : 1;
+    BatchPrefetcher prefetcher(config);
+    TEST_EXCEPTION(prefetcher.pop(), std::logic_error);
+    for (int i=0; i<3; ++i)
+      prefetcher.add(CompactRecordBlock(records));
+    TEST_CHECK(prefetcher.stored_records() == 8); // the oldest block is dropped
+    prefetcher.start();
+    for (uint64_t id=0; id<5; ++id) {
+      int slot = prefetcher.pop();
+      const auto& batch = prefetcher.batch(slot);
+      TEST_CHECK(batch.id == id);
+      for (int i=0; i<config.batch_size; ++i) {
+        const int idx = batch.sampled_ids[i];
+        TEST_CHECK(std::ranges::any_of(records, [&](const SubRecord& record) {
+          return idx < record.moves.size() && batch.policy_labels[i] == policy_label(record, idx);
+        }));
+      }
+      if (run == 0)
+        batches.push_back(batch);
+      else {
+        TEST_CHECK(batches[id].policy_labels == batch.policy_labels);
+        TEST_CHECK(batches[id].value_labels == batch.value_labels);
+        TEST_CHECK(batches[id].inputs == batch.inputs);
+        TEST_CHECK(batches[id].inputs2 == batch.inputs2);
+        TEST_CHECK(batches[id].aux_labels == batch.aux_labels);
+        TEST_CHECK(batches[id].legalmove_labels == batch.legalmove_labels);
+        TEST_CHECK(batches[id].sampled_ids == batch.sampled_ids);
+      }
+      prefetcher.release(slot);
+    }
+    prefetcher.stop();
+  }
+}
+
 void test_win_loss_after_move() {
   std::string sfen = "sfen ln1gk3l/2s3g2/p1p1psnp1/3p1p2p/6rP1/5P3/PPPPP1P1P/1BG1K+sR2/LNS4NL b Bg2p 1";
   {
@@ -5497,6 +6365,166 @@ void test_gamearray() {
     mgrs.step();
 }
 
+void test_usi_engine_pool() {
+  // fake engine answering 7g7f after a short delay
+  auto path = std::filesystem::temp_directory_path() / "miniosl-fake-usi.sh";
+  {
+    std::ofstream os(path);
+    os << "#!/bin/sh\n"
+       << "while read line; do\n"
+       << "  case \"$line\" in\n"
+       << "    usi) echo 'id name fake engine'; echo usiok;;\n"
+       << "    isready) echo readyok;;\n"
+       << "    go*) sleep 0.2; echo 'info depth 1 score cp 0 pv 7g7f'; echo 'bestmove 7g7f ponder 3c3d';;\n"
+       << "    quit) exit 0;;\n"
+       << "  esac\n"
+       << "done\n";
+  }
+  std::filesystem::permissions(path, std::filesystem::perms::owner_all);
+  const int N = 4;
+  std::vector<std::shared_ptr<SingleCPUPlayer>> pool;
+  for (int i=0; i<N; ++i)
+    pool.emplace_back(std::make_shared<UsiEnginePlayer>(std::vector<std::string>{path.string()},
+                                                        std::vector<std::string>{}));
+  CPUPlayer player(pool, false);
+  TEST_CHECK_EQUAL(player.name(), "fake_engine"s);
+  TEST_CHECK_EQUAL(player.pool_size(), N);
+  std::vector<GameManager> games(N*2);
+  player.new_series(games);
+  auto start = std::chrono::steady_clock::now();
+  player.make_request(0, nullptr);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const auto m76fu = Move(Square(7, 7), Square(7, 6), PAWN, Ptype_EMPTY, false, BLACK);
+  for (auto move: player.decision())
+    TEST_CHECK_EQUAL(move, m76fu);
+  // two rounds of 0.2s, instead of eight in serial
+  TEST_CHECK(elapsed < 1.2);
+  TEST_MSG("elapsed %.2f", elapsed);
+
+  TEST_EXCEPTION(UsiEnginePlayer({"/nonexistent/usi-engine"}, {}), std::runtime_error);
+  std::filesystem::remove(path);
+
+  // an engine gone after readyok is reported by an exception, not by SIGPIPE,
+  // and the disposition of SIGPIPE is left as it was
+  auto dying = std::filesystem::temp_directory_path() / "miniosl-dying-usi.sh";
+  {
+    std::ofstream os(dying);
+    os << "#!/bin/sh\n"
+       << "echo usiok\n"
+       << "read line; read line; echo readyok\n";
+  }
+  std::filesystem::permissions(dying, std::filesystem::perms::owner_all);
+  struct sigaction before, after;
+  sigaction(SIGPIPE, nullptr, &before);
+  {
+    UsiProcess process({dying.string()}, {});
+    bool thrown = false;
+    for (int i=0; i<1000 && ! thrown; ++i) {
+      try {
+        process.writeline("isready");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      catch (std::runtime_error&) {
+        thrown = true;
+      }
+    }
+    TEST_CHECK(thrown);
+  }
+  sigaction(SIGPIPE, nullptr, &after);
+  TEST_CHECK(before.sa_handler == after.sa_handler);
+  std::filesystem::remove(dying);
+}
+
+void test_alphabeta_player() {
+  {
+    EffectState state;
+    TEST_CHECK_EQUAL(alphabeta::evaluate(state), 0);
+  }
+  {
+    EffectState state(csa::read_board(
+      "P1 *  *  *  * -OU *  *  *  * \n"
+      "P2 *  *  *  *  *  *  *  *  * \n"
+      "P3 *  *  *  * +FU *  *  *  * \n"
+      "P4 *  *  *  *  *  *  *  *  * \n"
+      "P5 *  *  *  *  *  *  *  *  * \n"
+      "P6 *  *  *  *  *  *  *  *  * \n"
+      "P7 *  *  *  * -FU *  *  *  * \n"
+      "P8 *  *  *  *  *  *  *  *  * \n"
+      "P9 *  *  *  * +OU *  *  *  * \n"
+      "P+00KI\n"
+      "P-00AL\n"
+      "+\n"));
+    AlphaBetaSearch search;
+    auto move = search.search(state);
+    TEST_CHECK_EQUAL(move, Move(Square(5, 2), GOLD, BLACK));
+    TEST_CHECK_EQUAL(search.score(), alphabeta::MateValue - 1);
+    // mate distance is kept with entries of the previous search
+    TEST_CHECK_EQUAL(search.search(state), move);
+    TEST_CHECK_EQUAL(search.score(), alphabeta::MateValue - 1);
+    AlphaBetaConfig deeper;
+    deeper.depth = 5;
+    AlphaBetaSearch search5(deeper);
+    TEST_CHECK_EQUAL(search5.search(state), move);
+    TEST_CHECK_EQUAL(search5.score(), alphabeta::MateValue - 1);
+  }
+  {
+    EffectState state(csa::read_board(
+      "P1 *  *  *  * -OU *  *  *  * \n"
+      "P2 *  *  *  *  *  *  *  *  * \n"
+      "P3 *  *  *  *  *  *  *  *  * \n"
+      "P4 *  *  *  *  *  *  *  *  * \n"
+      "P5 *  *  *  * -HI *  *  *  * \n"
+      "P6 *  *  *  *  *  *  *  *  * \n"
+      "P7 *  *  *  *  *  *  *  *  * \n"
+      "P8 *  *  *  * +HI *  *  *  * \n"
+      "P9 *  *  *  * +OU *  *  *  * \n"
+      "P-00AL\n"
+      "+\n"));
+    const auto capture = Move(Square(5, 8), Square(5, 5), ROOK, ROOK, false, BLACK);
+    TEST_CHECK(state.see(capture) >= EffectState::seeValue(ROOK));
+    AlphaBetaPlayer player(3, 100000, false);
+    TEST_CHECK_EQUAL(player.think(to_usi(state)), capture);
+    TEST_CHECK(player.last_score() > alphabeta::evaluate(state)); // white has the rest in hand
+  }
+  {
+    // baseline match against random moves
+    auto game_config = GameConfig();
+    CPUPlayer player_a(std::make_shared<AlphaBetaPlayer>(2, 4000), false);
+    CPUPlayer player_b(std::make_shared<RandomPlayer>(), false);
+    MockModel model;
+    GameArray mgrs(2, player_a, player_b, model, model, game_config);
+    for (int i=0; i<MiniRecord::draw_limit && mgrs.n_completed() < 2; ++i)
+      mgrs.step();
+    TEST_ASSERT(mgrs.completed().size() >= 2);
+    for (const auto& record: mgrs.completed())
+      TEST_CHECK(record.result == BlackWin);
+  }
+  {
+    // moves do not depend on the players in a pool taking the games
+    auto game_config = GameConfig();
+    game_config.seed = 7;
+    auto play = [&](int pool_size) {
+      std::vector<std::shared_ptr<SingleCPUPlayer>> pool_a, pool_b;
+      for (int i=0; i<pool_size; ++i) {
+        pool_a.emplace_back(std::make_shared<AlphaBetaPlayer>(2, 2000));
+        pool_b.emplace_back(std::make_shared<AlphaBetaPlayer>(1, 2000));
+      }
+      CPUPlayer player_a(pool_a, false), player_b(pool_b, false);
+      MockModel model;
+      GameArray mgrs(6, player_a, player_b, model, model, game_config);
+      for (int i=0; i<8; ++i)
+        mgrs.step();
+      return std::vector<GameManager>(mgrs.games().begin(), mgrs.games().end());
+    };
+    auto single = play(1), pooled = play(3);
+    for (int g=0; g<6; ++g) {
+      TEST_CHECK(single[g].record.moves.size() >= 8);
+      TEST_CHECK(single[g].record.moves == pooled[g].record.moves);
+    }
+    TEST_CHECK(single[0].record.moves != single[1].record.moves);
+  }
+}
+
 void test_gumbelplayer() {
   auto game_config = GameConfig();
   game_config.ignore_draw = true;
@@ -5526,6 +6554,615 @@ void test_gumbelplayer() {
   }
 }
 
+void test_counter_rng() {
+  {
+    const auto key = rng::game_key(1, 2);
+    rng::CounterRNG a(key, 3, rng::Purpose::Gumbel), b(key, 3, rng::Purpose::Gumbel),
+      c(key, 3, rng::Purpose::RandomOpening), d(rng::game_key(1, 3), 3, rng::Purpose::Gumbel),
+      e(key, 4, rng::Purpose::Gumbel), f(rng::game_key(2, 2), 3, rng::Purpose::Gumbel);
+    const auto x = a();
+    TEST_CHECK(x == b());
+    TEST_CHECK(x != c() && x != d() && x != e() && x != f());
+    TEST_CHECK(a() != x);
+    TEST_CHECK(a() == (b(), b()));
+
+    std::array<int,24> count = {0};
+    for (int i=0; i<4096; ++i) {
+      rng::CounterRNG r(key, i, rng::Purpose::TrainingSample), s(key, i, rng::Purpose::TrainingSample);
+      int idx = SubRecord::weighted_sampling(count.size(), SubRecord::default_decay, r);
+      TEST_CHECK(idx == SubRecord::weighted_sampling(count.size(), SubRecord::default_decay, s));
+      count[idx] += 1;
+    }
+    TEST_CHECK(count.back() > count[3] && count[3] > count[0]);
+  }
+  // self-play depends on (seed, game id), not on the number of games in parallel (and threads)
+  auto game_config = GameConfig();
+  game_config.ignore_draw = true;
+  game_config.variant = Shogi816K;
+  game_config.random_opening = 0.5;
+  game_config.seed = 12345;
+  GumbelPlayerConfig config;
+  config.root_width = 4;
+  auto play = [&](int N) {
+    FlatGumbelPlayer player_a(config), player_b(config);
+    MockModel model;
+    GameArray mgrs(N, player_a, player_b, model, model, game_config);
+    for (int i=0; i<24; ++i)
+      mgrs.step();
+    return std::vector<GameManager>(mgrs.games().begin(), mgrs.games().begin()+4);
+  };
+  auto small = play(4), large = play(80), again = play(4);
+  for (int g=0; g<4; ++g) {
+    TEST_CHECK(small[g].rng_key == large[g].rng_key);
+    TEST_CHECK(small[g].record.shogi816k_id == large[g].record.shogi816k_id);
+    TEST_CHECK(small[g].record.moves.size() >= 12);
+    TEST_CHECK(small[g].record.moves == large[g].record.moves);
+    TEST_CHECK(small[g].record.moves == again[g].record.moves);
+  }
+  TEST_CHECK(small[0].record.moves != small[1].record.moves);
+}
+
+void test_sequential_halving() {
+  {
+    auto schedule = SequentialHalvingPlayer::make_schedule(8, 32);
+    TEST_CHECK((schedule == std::vector<int>{8, 4, 4, 2, 2, 2, 2, 2}));
+    TEST_CHECK((SequentialHalvingPlayer::make_schedule(1, 4) == std::vector<int>{1, 1, 1, 1}));
+    TEST_CHECK((SequentialHalvingPlayer::make_schedule(6, 8) == std::vector<int>{6, 3, 2}));
+    TEST_EXCEPTION(SequentialHalvingPlayer::make_schedule(0, 8), std::invalid_argument);
+  }
+  auto game_config = GameConfig();
+  game_config.ignore_draw = true;
+  game_config.variant = Shogi816K;
+  GumbelPlayerConfig config;
+  config.root_width = 4;
+  config.n_simulations = 16;
+  config.child_width = 4;
+  config.reuse_tree = false;
+
+  SequentialHalvingPlayer player_a(config), player_b(config);
+  TEST_CHECK(player_a.width(0) == 1);
+  TEST_CHECK(player_a.width(1) == 4);
+  TEST_CHECK(player_a.max_phases() == 1 + player_a.simulation_schedule().size());
+  MockModel model;
+  GameArray mgrs(8, player_a, player_b,
+                 model, model,
+                 game_config);
+  const auto& schedule = player_a.simulation_schedule();
+  const int total = std::accumulate(schedule.begin(), schedule.end(), 0);
+  for (int i=0; i<256; ++i) {
+    mgrs.step();
+    if (i % 2)
+      continue;
+    for (const auto& tree: player_a.search_trees()) {
+      int visits = 0;
+      bool expanded = false, terminal = true;
+      for (int c: tree.order) {
+        visits += tree.nodes[c].visit;
+        expanded |= tree.nodes[c].n_children > 0;
+        terminal &= tree.nodes[c].terminal != InGame;
+      }
+      TEST_CHECK_EQUAL(visits, total);
+      // subtree below root children unless all of them end the game
+      TEST_CHECK(expanded || terminal);
+    }
+  }
+}
+
+void test_tree_reuse() {
+  auto game_config = GameConfig();
+  game_config.ignore_draw = true;
+  GumbelPlayerConfig config;
+  config.root_width = 4;
+  config.n_simulations = 32;
+  config.child_width = 8;
+  config.noise_scale = 0;
+
+  SequentialHalvingPlayer player_a(config), player_b(config);
+  MockModel model;
+  GameArray mgrs(8, player_a, player_b,
+                 model, model,
+                 game_config);
+  const auto& schedule = player_a.simulation_schedule();
+  const int total = std::accumulate(schedule.begin(), schedule.end(), 0);
+  const size_t limit = config.root_width + config.n_simulations * config.child_width;
+  int reused = 0;
+  for (int i=0; i<64; ++i) {
+    mgrs.step();
+    if (i % 2)
+      continue;
+    for (const auto& tree: player_a.search_trees()) {
+      if (tree.nodes.empty())
+        continue;               // discarded by advance() after a terminal move
+      int visits = 0;
+      for (int c: tree.order)
+        visits += tree.nodes[c].visit;
+      TEST_CHECK(visits >= total);
+      reused += visits > total;
+      TEST_CHECK(tree.nodes.size() <= 2*limit);
+    }
+  }
+  TEST_CHECK(reused > 0);
+
+  // trees are discarded unless the moves follow the searched position
+  std::vector<Move> moves(8, Move());
+  player_a.advance(moves);
+  for (const auto& tree: player_a.search_trees())
+    TEST_CHECK(tree.nodes.empty());
+}
+
+class CountingModel : public osl::InferenceModel {
+public:
+  int calls = 0, positions = 0;
+  void batch_infer(std::vector<nn_input_element>& in,
+                   std::vector<policy_logits_t>& policy_out,
+                   std::vector<value_vector_t>& vout) {
+    ++calls;
+    const int N = in.size() / ml::input_unit;
+    positions += N;
+    for (int i=0; i<N; ++i) {
+      auto sum = std::accumulate(&in[i*ml::input_unit], &in[(i+1)*ml::input_unit], 0);
+      vout[i] = {sum % 7 / 7.0f, 0, 0, 0};
+      if (! policy_out.empty())
+        policy_out[i].fill(sum % 11);
+    }
+  }
+};
+
+void test_eval_cache() {
+  {
+    EvalCache cache(4, 1);
+    std::vector<nn_input_element> in(ml::input_unit*3, 0);
+    in[ml::input_unit] = 1;
+    in[ml::input_unit*2] = 2;
+    auto k0 = EvalCache::make_key(&in[0]), k1 = EvalCache::make_key(&in[ml::input_unit]);
+    TEST_CHECK(! (k0 == k1));
+    TEST_CHECK(EvalCache::make_key(&in[0]) == k0);
+
+    value_vector_t v;
+    policy_logits_t p;
+    TEST_CHECK(! cache.lookup(k0, nullptr, v));
+    cache.insert(k0, nullptr, {0.5, 0, 0, 0});
+    TEST_CHECK(cache.lookup(k0, nullptr, v));
+    TEST_CHECK(v[0] == 0.5);
+    TEST_CHECK(! cache.lookup(k0, &p, v)); // value only
+    p.fill(1);
+    cache.insert(k0, &p, {0.25, 0, 0, 0});
+    p.fill(0);
+    TEST_CHECK(cache.lookup(k0, &p, v));
+    TEST_CHECK(v[0] == 0.25 && p[0] == 1);
+    // keep the policy for value-only updates
+    cache.insert(k0, nullptr, {0.125, 0, 0, 0});
+    TEST_CHECK(cache.lookup(k0, &p, v));
+    TEST_CHECK(v[0] == 0.125);
+
+    for (int i=1; i<8; ++i)
+      cache.insert({(uint64_t)i, (uint64_t)i}, nullptr, v);
+    TEST_CHECK_EQUAL(cache.size(), 4);
+    TEST_CHECK(! cache.lookup(k0, nullptr, v)); // evicted
+    TEST_CHECK(cache.stats().evictions == 4);
+  }
+  {
+    // batch with duplicates
+    EvalCache cache(64);
+    CountingModel model;
+    const int N = 6;
+    std::vector<nn_input_element> in(ml::input_unit*N, 0);
+    for (int i=0; i<N; ++i)
+      in[i*ml::input_unit + 5] = i % 3;
+    std::vector<policy_logits_t> policy(N), expected_policy(N);
+    std::vector<value_vector_t> value(N), expected_value(N);
+    CountingModel direct;
+    direct.batch_infer(in, expected_policy, expected_value);
+
+    cache.batch_infer(model, in, policy, value);
+    TEST_CHECK_EQUAL(model.positions, 3);
+    TEST_CHECK(policy == expected_policy);
+    TEST_CHECK(value == expected_value);
+    TEST_CHECK_EQUAL(cache.stats().batch_duplicates, 3);
+
+    std::ranges::fill(value, value_vector_t());
+    cache.batch_infer(model, in, policy, value);
+    TEST_CHECK_EQUAL(model.calls, 1);
+    TEST_CHECK(value == expected_value);
+    TEST_CHECK_EQUAL(cache.stats().hits, N);
+    TEST_CHECK_EQUAL(cache.stats().lookups, 2*N);
+  }
+  {
+    auto game_config = GameConfig();
+    game_config.ignore_draw = true;
+    game_config.eval_cache_size = 1024;
+    GumbelPlayerConfig config;
+    config.root_width = 4;
+    FlatGumbelPlayer player_a(config), player_b(config);
+    CountingModel model;
+    GameArray mgrs(8, player_a, player_b,
+                   model, model,
+                   game_config);
+    mgrs.step();
+    // identical initial positions
+    auto stats = mgrs.eval_cache_stats();
+    TEST_CHECK(stats.lookups == 8 + 8*4);
+    TEST_CHECK(stats.hits + stats.batch_duplicates >= 7);
+    TEST_CHECK(model.positions < 8 + 8*4);
+    for (int i=0; i<64; ++i)
+      mgrs.step();
+    TEST_CHECK(mgrs.eval_cache_stats(1).lookups == mgrs.eval_cache_stats(0).lookups);
+  }
+}
+
+void test_gamearray_stats() {
+  auto game_config = GameConfig();
+  game_config.ignore_draw = true;
+  GumbelPlayerConfig config;
+  config.root_width = 4;
+  FlatGumbelPlayer player_a(config);
+  PolicyPlayer player_b;
+  CountingModel model;
+  const int N = 8;
+  GameArray mgrs(N, player_a, player_b, model, model, game_config);
+  for (int i=0; i<10; ++i)
+    mgrs.step();
+  const auto& stats = mgrs.stats();
+  if (! stats.enabled) {
+    TEST_CHECK_EQUAL(stats.steps, 0);
+    TEST_CHECK(stats.total_seconds == 0);
+    return;
+  }
+  TEST_CHECK_EQUAL(stats.steps, 10);
+  TEST_CHECK_EQUAL(stats.moves, 10*N);
+  TEST_CHECK_EQUAL(stats.player[0].steps, 5);
+  TEST_CHECK_EQUAL(stats.player[1].steps, 5);
+  TEST_CHECK_EQUAL(stats.player[0].infer_calls, 5*2); // root and children
+  TEST_CHECK_EQUAL(stats.player[0].positions, 5*(N + N*4));
+  TEST_CHECK_EQUAL(stats.player[1].positions, 5*N);
+  TEST_CHECK_EQUAL(stats.positions(), (uint64_t)model.positions);
+  TEST_CHECK(stats.player[1].occupancy() < 1.0);
+  TEST_CHECK(stats.total_seconds > 0);
+  TEST_CHECK(stats.total_seconds >= stats.make_move_seconds + stats.player[0].infer_seconds);
+  TEST_CHECK(stats.positions_per_second() > 0);
+  mgrs.reset_stats();
+  TEST_CHECK_EQUAL(mgrs.stats().steps, 0);
+  TEST_CHECK(mgrs.stats().enabled);
+}
+
+void test_batch_scheduler() {
+  {
+    CountingModel model;
+    BatchScheduler scheduler(model, {64, 16, 256});
+    using plan_t = std::vector<std::pair<int,int>>;
+    TEST_CHECK(scheduler.plan(256) == (plan_t{{256, 256}}));
+    TEST_CHECK(scheduler.plan(5) == (plan_t{{5, 16}}));
+    TEST_CHECK(scheduler.plan(40) == (plan_t{{40, 64}}));
+    TEST_CHECK(scheduler.plan(24) == (plan_t{{16, 16}, {8, 16}}));
+    TEST_CHECK(scheduler.plan(600) == (plan_t{{256, 256}, {256, 256}, {64, 64}, {16, 16}, {8, 16}}));
+    BatchScheduler exact(model, {16, 64}, false);
+    TEST_CHECK(exact.plan(40) == (plan_t{{16, 16}, {16, 16}, {8, 8}}));
+    TEST_CHECK(exact.plan(100) == (plan_t{{64, 64}, {16, 16}, {16, 16}, {4, 4}}));
+  }
+  {
+    const int N = 90;
+    std::vector<nn_input_element> in(ml::input_unit*N, 0);
+    for (int i=0; i<N; ++i)
+      in[i*ml::input_unit + 3] = i;
+    std::vector<policy_logits_t> policy(N), expected_policy(N);
+    std::vector<value_vector_t> value(N), expected_value(N);
+    CountingModel direct, model;
+    direct.batch_infer(in, expected_policy, expected_value);
+
+    BatchScheduler scheduler(model, {16, 64});
+    scheduler.batch_infer(in, policy, value);
+    TEST_CHECK(policy == expected_policy);
+    TEST_CHECK(value == expected_value);
+    TEST_CHECK_EQUAL(model.calls, 3);           // 64 + 16 + 10 padded to 16
+    TEST_CHECK_EQUAL(model.positions, 64+16*2);
+    auto stats = scheduler.stats();
+    TEST_ASSERT(stats.size() == 2);
+    TEST_CHECK_EQUAL(stats[0].size, 16);
+    TEST_CHECK_EQUAL(stats[0].calls, 2);
+    TEST_CHECK_EQUAL(stats[0].padded, 6);
+    TEST_CHECK_EQUAL(stats[1].positions, 64);
+    TEST_CHECK(stats[1].occupancy() == 1.0);
+
+    std::vector<policy_logits_t> no_policy;
+    std::ranges::fill(value, value_vector_t());
+    scheduler.batch_infer(in, no_policy, value);
+    TEST_CHECK(value == expected_value);
+    scheduler.reset_stats();
+    TEST_CHECK(scheduler.stats().empty());
+  }
+  {
+    auto game_config = GameConfig();
+    game_config.ignore_draw = true;
+    game_config.batch_sizes = {16};
+    GumbelPlayerConfig config;
+    config.root_width = 4;
+    FlatGumbelPlayer player_a(config), player_b(config);
+    CountingModel model;
+    GameArray mgrs(8, player_a, player_b,
+                   model, model,
+                   game_config);
+    mgrs.warmup(1);
+    TEST_CHECK_EQUAL(model.positions, 16);
+    TEST_CHECK(mgrs.batch_stats().empty());
+    mgrs.step();
+    // 8 root positions padded to 16, then 8*4 children in two batches
+    auto stats = mgrs.batch_stats();
+    TEST_ASSERT(stats.size() == 1);
+    TEST_CHECK_EQUAL(stats[0].calls, 3);
+    TEST_CHECK_EQUAL(stats[0].positions, 8 + 8*4);
+    TEST_CHECK_EQUAL(stats[0].padded, 8);
+    TEST_CHECK(mgrs.batch_stats(1).size() == 1);
+  }
+}
+
+void test_shm_inference() {
+  const std::string name = "/miniosl-test-" + std::to_string(getpid());
+  CountingModel model, direct;
+  const int n_clients = 3, rounds = 4, N = 5;
+  ShmInferenceServer server(name, model, 4, 4, 4096, 2000000);
+  TEST_EXCEPTION(ShmInferenceServer(name, model), std::runtime_error); // already exists
+  {
+    std::vector<std::unique_ptr<ShmInferenceClient>> clients;
+    for (int c=0; c<n_clients; ++c)
+      clients.emplace_back(new ShmInferenceClient(name));
+    TEST_CHECK_EQUAL(server.n_clients(), n_clients);
+    TEST_CHECK_EQUAL(clients[0]->slot_capacity(), 4);
+    server.start();
+    std::vector<int> failures(n_clients, 0);
+    auto work = [&](int c) {
+      std::mt19937 rng(c);
+      for (int r=0; r<rounds; ++r) {
+        // N > slot_capacity, so each call is split into two requests
+        std::vector<nn_input_element> in(N*ml::input_unit);
+        for (auto& e: in)
+          e = rng() % 3;
+        std::vector<policy_logits_t> policy(r % 2 ? 0 : N);
+        std::vector<value_vector_t> value(N);
+        clients[c]->batch_infer(in, policy, value);
+        for (int i=0; i<N; ++i) {
+          auto sum = std::accumulate(&in[i*ml::input_unit], &in[(i+1)*ml::input_unit], 0);
+          failures[c] += value[i][0] != sum % 7 / 7.0f;
+          if (! policy.empty())
+            failures[c] += policy[i][0] != sum % 11;
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int c=0; c<n_clients; ++c)
+      threads.emplace_back(work, c);
+    for (auto& t: threads)
+      t.join();
+    server.stop();
+    for (int c=0; c<n_clients; ++c)
+      TEST_CHECK_EQUAL(failures[c], 0);
+    auto stats = server.stats();
+    TEST_CHECK_EQUAL(stats.positions, n_clients*rounds*N);
+    TEST_CHECK_EQUAL(stats.requests, n_clients*rounds*2);
+    TEST_CHECK(stats.batches < stats.requests);
+    TEST_MSG("batches %lu requests %lu", stats.batches, stats.requests);
+    TEST_CHECK_EQUAL(model.calls, stats.batches);
+    clients.pop_back();
+    TEST_CHECK_EQUAL(server.n_clients(), n_clients-1);
+  }
+  TEST_CHECK_EQUAL(server.n_clients(), 0);
+  {
+    // slots of clients exited without closing are reclaimed
+    for (int c=0; c<4; ++c) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        new ShmInferenceClient(name);
+        _exit(0);
+      }
+      TEST_ASSERT(pid > 0);
+      waitpid(pid, nullptr, 0);
+    }
+    TEST_CHECK_EQUAL(server.n_clients(), 4);
+    TEST_EXCEPTION(ShmInferenceClient{name}, std::runtime_error);
+    TEST_CHECK_EQUAL(server.serve_once(0), 0);
+    TEST_CHECK_EQUAL(server.n_clients(), 0);
+    ShmInferenceClient client(name);
+    TEST_CHECK_EQUAL(server.n_clients(), 1);
+  }
+  TEST_EXCEPTION(ShmInferenceClient("/miniosl-test-nonexistent"), std::runtime_error);
+}
+
+namespace nn_reference {
+  /** PVNetwork of network.py written plainly in [channel][y][x] order */
+  struct Net {
+    std::map<std::string, std::pair<std::vector<int>, std::vector<float>>> tensors;
+    std::mt19937 rng{1};
+    std::vector<float> random(int n, float lo, float hi) {
+      std::uniform_real_distribution<float> dist(lo, hi);
+      std::vector<float> ret(n);
+      for (auto& v: ret)
+        v = dist(rng);
+      return ret;
+    }
+    void add_conv(std::string prefix, int out, int in, int kh, int kw) {
+      const float scale = 1.0 / std::sqrt(in*kh*kw);
+      tensors[prefix + ".conv.weight"] = {{out, in, kh, kw}, random(out*in*kh*kw, -scale, scale)};
+      tensors[prefix + ".bn.weight"] = {{out}, random(out, 0.5, 1.5)};
+      tensors[prefix + ".bn.bias"] = {{out}, random(out, -0.2, 0.2)};
+      tensors[prefix + ".bn.running_mean"] = {{out}, random(out, -0.2, 0.2)};
+      tensors[prefix + ".bn.running_var"] = {{out}, random(out, 0.5, 1.5)};
+    }
+    void add_linear(std::string prefix, int out, int in) {
+      const float scale = 1.0 / std::sqrt(in);
+      tensors[prefix + ".weight"] = {{out, in}, random(out*in, -scale, scale)};
+      tensors[prefix + ".bias"] = {{out}, random(out, -0.2, 0.2)};
+    }
+    void save(std::string path) {
+      std::ofstream os(path, std::ios::binary);
+      os.write("MOSLNN01", 8);
+      auto u32 = [&](uint32_t v) { os.write(reinterpret_cast<char*>(&v), 4); };
+      u32(tensors.size());
+      for (auto& [name, t]: tensors) {
+        u32(name.size());
+        os.write(name.data(), name.size());
+        u32(t.first.size());
+        for (auto d: t.first)
+          u32(d);
+        os.write(reinterpret_cast<const char*>(t.second.data()), t.second.size()*4);
+      }
+    }
+    /** Conv2d with BatchNorm2d, output is [out][oh][ow] */
+    std::vector<float> conv(std::string prefix, const std::vector<float>& x, int pad) {
+      auto& [shape, w] = tensors[prefix + ".conv.weight"];
+      const int out = shape[0], in = shape[1], kh = shape[2], kw = shape[3];
+      const int oh = 9 + 2*pad - kh + 1, ow = 9 + 2*pad - kw + 1;
+      std::vector<float> ret(out*oh*ow);
+      for (int o=0; o<out; ++o) {
+        const float gamma = tensors[prefix + ".bn.weight"].second[o],
+          beta = tensors[prefix + ".bn.bias"].second[o],
+          mean = tensors[prefix + ".bn.running_mean"].second[o],
+          var = tensors[prefix + ".bn.running_var"].second[o];
+        for (int y=0; y<oh; ++y)
+          for (int xx=0; xx<ow; ++xx) {
+            double sum = 0;
+            for (int i=0; i<in; ++i)
+              for (int dy=0; dy<kh; ++dy)
+                for (int dx=0; dx<kw; ++dx) {
+                  int sy = y + dy - pad, sx = xx + dx - pad;
+                  if (sy >= 0 && sy < 9 && sx >= 0 && sx < 9)
+                    sum += w[((o*in + i)*kh + dy)*kw + dx] * x[(i*9 + sy)*9 + sx];
+                }
+            ret[(o*oh + y)*ow + xx] = (sum - mean) / std::sqrt(var + 1e-3) * gamma + beta;
+          }
+      }
+      return ret;
+    }
+    std::vector<float> linear(std::string prefix, const std::vector<float>& x) {
+      auto& [shape, w] = tensors[prefix + ".weight"];
+      std::vector<float> ret = tensors[prefix + ".bias"].second;
+      for (int o=0; o<shape[0]; ++o)
+        for (int i=0; i<shape[1]; ++i)
+          ret[o] += w[o*shape[1] + i] * x[i];
+      return ret;
+    }
+    static float silu(float v) { return v / (1 + std::exp(-v)); }
+    static void relu(std::vector<float>& v) { for (auto& e: v) e = std::max(e, 0.0f); }
+
+    std::pair<std::vector<float>, std::vector<float>> forward(const std::vector<float>& input, int n_blocks) {
+      auto x = conv("body.conv1", input, 1);
+      relu(x);
+      for (int i=0; i<n_blocks; ++i) {
+        const std::string prefix = "body.body." + std::to_string(i);
+        std::vector<float> f;
+        if (tensors.contains(prefix + ".convin.conv.weight")) {
+          auto a = conv(prefix + ".convin", x, 0);
+          relu(a);
+          auto b = conv(prefix + ".block1.0", a, 1);
+          relu(b);
+          b = conv(prefix + ".block1.2", b, 1);
+          std::vector<float> c(a.size());
+          for (size_t j=0; j<c.size(); ++j)
+            c[j] = silu(a[j] + b[j]);
+          auto d = conv(prefix + ".block2.0", c, 1);
+          relu(d);
+          d = conv(prefix + ".block2.2", d, 1);
+          auto files = conv(prefix + ".conv_filea", a, 0); // [b][1][9]
+          for (size_t j=0; j<c.size(); ++j)
+            c[j] = silu(c[j] + d[j] + files[j/81*9 + j%9]);
+          f = conv(prefix + ".convout", c, 0);
+        }
+        else {
+          auto a = conv(prefix + ".block.conv1x1a", x, 0), b = conv(prefix + ".block.conv1x1b", x, 0);
+          relu(a);
+          relu(b);
+          const int C = a.size() / 81;
+          std::vector<float> pooled(2*C);
+          for (int ch=0; ch<C; ++ch) {
+            pooled[ch] = *std::max_element(&b[ch*81], &b[ch*81+81]);
+            pooled[C+ch] = std::accumulate(&b[ch*81], &b[ch*81+81], 0.0) / 81;
+          }
+          auto bias = linear(prefix + ".block.linear", pooled);
+          for (size_t j=0; j<a.size(); ++j)
+            a[j] += bias[j/81];
+          f = conv(prefix + ".block.conv1x1out", a, 0);
+        }
+        for (size_t j=0; j<x.size(); ++j)
+          x[j] = silu(x[j] + f[j]);
+      }
+      auto p = conv("head.head.0", x, 0);
+      relu(p);
+      p = conv("head.head.2", p, 0);
+      auto v = conv("value_head.head.0", x, 0);
+      relu(v);
+      v = linear("value_head.head.3", v);
+      relu(v);
+      v = linear("value_head.head.5", v);
+      for (auto& e: v)
+        e = std::tanh(e);
+      return {p, v};
+    }
+  };
+}
+
+void test_cpu_inference() {
+  nn_reference::Net net;
+  const int C = 64, B = C/4, hidden = 5, n_blocks = 3; // B >= 16 to cover simd tiles
+  net.add_conv("body.conv1", C, ml::input_channels, 3, 3);
+  for (int i=0; i<n_blocks; ++i) {
+    const std::string prefix = "body.body." + std::to_string(i);
+    if ((i+1) % 3) {
+      net.add_conv(prefix + ".convin", B, C, 1, 1);
+      net.add_conv(prefix + ".block1.0", B, B, 3, 3);
+      net.add_conv(prefix + ".block1.2", B, B, 3, 3);
+      net.add_conv(prefix + ".block2.0", B, B, 3, 3);
+      net.add_conv(prefix + ".block2.2", B, B, 3, 3);
+      net.add_conv(prefix + ".convout", C, B, 1, 1);
+      net.add_conv(prefix + ".conv_filea", B, B, 9, 1);
+    }
+    else {
+      net.add_conv(prefix + ".block.conv1x1a", C, C, 1, 1);
+      net.add_conv(prefix + ".block.conv1x1b", C, C, 1, 1);
+      net.add_conv(prefix + ".block.conv1x1out", C, C, 1, 1);
+      net.add_linear(prefix + ".block.linear", C, 2*C);
+    }
+  }
+  net.add_conv("head.head.0", C, C, 1, 1);
+  net.add_conv("head.head.2", ml::policy_unit/81, C, 1, 1);
+  net.add_conv("value_head.head.0", 1, C, 1, 1);
+  net.tensors["value_head.head.0.bn.bias"].second[0] = 1.0; // keep relu active
+  net.add_linear("value_head.head.3", hidden, 81);
+  net.add_linear("value_head.head.5", 4, hidden);
+  auto path = std::filesystem::temp_directory_path() / "miniosl-test.mnn";
+  net.save(path.string());
+
+  CPUInferenceModel model(path.string(), 4, 2);
+  TEST_CHECK_EQUAL(model.channels(), C);
+  TEST_CHECK_EQUAL(model.n_blocks(), n_blocks);
+  TEST_CHECK_EQUAL(model.value_hidden(), hidden);
+
+  const int N = 11;             // three chunks
+  std::mt19937 rng(2);
+  std::vector<nn_input_element> in(N*ml::input_unit);
+  for (auto& e: in)
+    e = (rng() % 4 == 0) ? rng() % (ml::One+1) : 0;
+  std::vector<policy_logits_t> policy(N);
+  std::vector<value_vector_t> value(N), value_only(N);
+  model.batch_infer(in, policy, value);
+  std::vector<policy_logits_t> no_policy;
+  model.batch_infer(in, no_policy, value_only);
+  for (int i=0; i<N; ++i) {
+    std::vector<float> x(ml::input_unit);
+    for (int j=0; j<ml::input_unit; ++j)
+      x[j] = ml::to_float(in[i*ml::input_unit + j]);
+    auto [p, v] = net.forward(x, n_blocks);
+    float perr = 0, verr = 0;
+    for (int j=0; j<ml::policy_unit; ++j)
+      perr = std::max(perr, std::abs(p[j] - policy[i][j]));
+    for (int j=0; j<4; ++j)
+      verr = std::max(verr, std::abs(v[j] - value[i][j]));
+    TEST_CHECK(perr < 1e-3);
+    TEST_CHECK(verr < 1e-4);
+    TEST_MSG("%d %g %g", i, perr, verr);
+    TEST_CHECK(value_only[i] == value[i]);
+  }
+  std::filesystem::remove(path);
+  TEST_EXCEPTION(CPUInferenceModel(path.string()), std::runtime_error);
+}
+
 void test_aozora() {
   {
     BaseState base(Aozora);  
@@ -5568,11 +7205,13 @@ TEST_LIST = {
   { "csa", test_csa },
   { "offset", test_offset },
   { "king8", test_king8 },
+  { "see", test_see },
   { "state", test_state },
   { "state816k", test_state816k },
   { "effect_state", test_effect_state },
   { "effect_state2", test_effect_state2 },
   { "usi", test_usi },
+  { "usi_string_view", test_usi_string_view },
   { "ki2", test_ki2 },
   { "kanji", test_kanji },
   { "classifier", test_classify },
@@ -5588,14 +7227,37 @@ TEST_LIST = {
   { "policy_move_label", test_policy_move_label },
   { "game_manager", test_game_manager },
   { "parallel_game_manager", test_parallel_game_manager },
+  { "usi_file_parallel", test_usi_file_parallel },
+  { "usi_trusted", test_usi_trusted },
+  { "path_parallel", test_path_parallel },
+  { "indexed_record", test_indexed_record },
+  { "binary_moves", test_binary_moves },
+  { "dynamic_parallel", test_dynamic_parallel },
+  { "rank_coder", test_rank_coder },
+  { "position_shard", test_position_shard },
+  { "opening_concurrent_visit", test_opening_concurrent_visit },
+  { "opening_merge", test_opening_merge },
+  { "record_writer", test_record_writer },
   { "make_move_unsafe", test_make_move_unsafe },
   { "pawn_drop_checkmate", test_pawn_drop_checkmate },
   { "subrecord_sumple", test_subrecord_sample },
+  { "compact_record_block", test_compact_record_block },
+  { "batch_prefetcher", test_batch_prefetcher },
   { "make_feature", test_make_feature },
   { "win-loss-after-move", test_win_loss_after_move},
   { "kifu", test_kifu },
   { "gamearray", test_gamearray },
+  { "usi_engine_pool", test_usi_engine_pool },
+  { "alphabeta_player", test_alphabeta_player },
   { "gumbelplayer", test_gumbelplayer },
+  { "counter_rng", test_counter_rng },
+  { "sequential_halving", test_sequential_halving },
+  { "tree_reuse", test_tree_reuse },
+  { "eval_cache", test_eval_cache },
+  { "batch_scheduler", test_batch_scheduler },
+  { "gamearray_stats", test_gamearray_stats },
+  { "shm_inference", test_shm_inference },
+  { "cpu_inference", test_cpu_inference },
   { "aozora", test_aozora },
   { nullptr, nullptr }
 };